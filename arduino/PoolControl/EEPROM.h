@@ -2,9 +2,8 @@
 // EEPROM.h
 //
 //   A local include file that defines the locations that the other
-//   modules can use to write their config data to EEPROM.
-//
-//   Each module currently gets 32 bytes to scribble into.
+//   modules can use to write their config data to EEPROM. These are
+//   checked against each other in config.cpp.
 //
 //   As a reference, for the Arduino nano the sizes of the types are
 //   as follows. Note that there is no difference in size for unsigned
@@ -22,23 +21,36 @@
 #ifndef MYEEPROM_H
 #define MYEEPROM_H
 
-// the following defines set the EEPROM addresses for each of the
-//   different modules. The _INCR is used to increment the address
-//   when there are (or could be) multiple objects for the given
-//   module.
-
-#define VALVE_EEPROM_ADDRESS		0x10
-#define VALVE_EEPROM_INCR		0x10
+// the configuration of the valves, thermometers, and heaters is kept
+//   in one image (see config.h) - and there are two copies of it so
+//   that a save that is cut short leaves the other one intact. Each
+//   copy gets CONFIG_EEPROM_SLOT bytes.
 
-#define THERMOMETER_EEPROM_ADDRESS	0x30
-#define TERMOMETER_EEPROM_INCR		0x10
+#define CONFIG_EEPROM_ADDRESS		0x10
+#define CONFIG_EEPROM_SLOT		0x40
 
-#define HEATER_EEPROM_ADDRESS		0x50
+// the following defines set the EEPROM addresses for the other
+//   modules. The _INCR is used to increment the address when there
+//   are (or could be) multiple objects for the given module.
 
-#define PUMP_EEPROM_ADDRESS		0x70
+#define PUMP_EEPROM_ADDRESS		0x90
 #define PUMP_EEPROM_INCR		0x10
 
-#define LIGHT_EEPROM_ADDRESS		0x80
+#define LIGHT_EEPROM_ADDRESS		0xb0
 #define LIGHT_EEPROM_INCR		0x10
 
+// valve position is written on every move, so rather than wear out
+//   one spot, it is written round-robin to a ring of records (see
+//   EEPROM_RING in eeprom.cpp). Each valve gets its own ring.
+
+#define VALVE_POSITION_LOG_ADDRESS	0x100
+#define VALVE_POSITION_LOG_INCR		0x80
+#define VALVE_POSITION_LOG_RECORDS	(VALVE_POSITION_LOG_INCR / EEPROM_RING_RECORD)
+
+// the temperature history spills its full blocks here, round-robin
+//   (see history.cpp) - HISTORY_BLOCKS of HISTORY_BLOCK bytes. They are
+//   only kept for as long as the sketch runs.
+
+#define HISTORY_EEPROM_ADDRESS		0x200
+
 #endif
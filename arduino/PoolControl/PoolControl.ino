@@ -9,27 +9,35 @@
 #include "pump.h"
 #include "light.h"
 #include "control.h"
+#include "analog.h"
+#include "scheduler.h"
+#include "config.h"
+#include "history.h"
+#include "trace.h"
 #include <time.h>
 #include "EEPROM.h"
 
+// valves, thermometers, and heaters are given their index into the
+//   config image (see config.h) which has room for CONFIG_VALVES, etc.
+
 Valve valve[] = {
-  //    relay   relay   current  nv storage
-  //   common direction monitor  eeprom address
-  //   ------ --------- ------- ----------------
-  Valve(   2,     3,       A7   ,  VALVE_EEPROM_ADDRESS),
-  Valve(   4,     5,       A6   ,  VALVE_EEPROM_ADDRESS + VALVE_EEPROM_INCR)
+  //    relay   relay   current  config  position log
+  //   common direction monitor  index   eeprom address
+  //   ------ --------- ------- ------  ----------------
+  Valve(   2,     3,       A7   ,  0,    VALVE_POSITION_LOG_ADDRESS),
+  Valve(   4,     5,       A6   ,  1,    VALVE_POSITION_LOG_ADDRESS + VALVE_POSITION_LOG_INCR)
 };
 
 Thermometer therm[] = {
   // thermometers are configured with the pin and the resistor
   //   that forms the voltage divider. The resistor is given in K ohms.
-  Thermometer(A3,10,THERMOMETER_EEPROM_ADDRESS)
+  Thermometer(A3,10,0)
 };
 
 Heater heater[] = {
   // there is but one heater - so set it up with its relay pin
   //   and the termometer
-  Heater(6,&therm[0],HEATER_EEPROM_ADDRESS)
+  Heater(6,&therm[0],0)
 };
 
 Pump pump[] = {
@@ -44,28 +52,91 @@ Light light[] = {
   Light(7, LIGHT_EEPROM_ADDRESS)
 };
 
+// the devices run as tasks in the scheduler - these are the
+//   routines that it calls, with the device number as the arg.
+//   Note that pumps and lights have nothing to do in loop(), so
+//   they aren't tasks at all.
+
+int valveTask[2];	// task numbers so valves can change their rate
+int thermTask[1];	//   and thermometers can follow their filter
+
+void analogTask(int)
+{
+  AnalogLoop();
+}
+
+void controlTask(int)
+{
+  ControlLoop();
+}
+
+void valveLoop(int i)
+{
+  valve[i].loop();
+  TaskPeriod(valveTask[i],valve[i].active()?VALVE_ACTIVE_PERIOD:VALVE_IDLE_PERIOD);
+}
+
+void thermLoop(int i)
+{
+  therm[i].loop();
+  TaskPeriod(thermTask[i],therm[i].filter.period());
+}
+
+void heaterLoop(int i)
+{
+  heater[i].loop();
+}
+
+void configTask(int)
+{
+  ConfigLoop();
+}
+
+void historyTask(int)
+{
+  HistorySample(therm[0].readAVG());
+}
+
 void setup()
 {
-  // initialize serial communication at 9600 bits per second:
-  Serial.begin(9600);
+  // paint the stack first, so its high-water mark can be read back
+  //   with the loop statistics (see TaskStackPaint())
+
+  TaskStackPaint();
+
+#ifdef TRACE_SERIAL
+  // initialize serial communication at 115200 bits per second - it
+  //   only carries the trace (see trace.cpp):
+  Serial.begin(115200);
+#endif
 
   // set-up the control system through I2C. It needs to have access
   //   to the control "surface" so pass it arrays of valves and
   //   thermometers - note the counts of members in the array
 
   ControlSetup(valve,2,therm,1,heater,1,pump,2,light,1);
+
+  // set-up the tasks - period and deadline (how late is "late") in micros
+
+  TaskAdd(analogTask,0,0UL,1000UL);
+  TaskAdd(controlTask,0,0UL,1000UL);
+  valveTask[0] = TaskAdd(valveLoop,0,VALVE_IDLE_PERIOD,VALVE_ACTIVE_PERIOD);
+  valveTask[1] = TaskAdd(valveLoop,1,VALVE_IDLE_PERIOD,VALVE_ACTIVE_PERIOD);
+  thermTask[0] = TaskAdd(thermLoop,0,THERM_SAMPLE_PERIOD,THERM_SAMPLE_PERIOD/2);
+  TaskAdd(heaterLoop,0,HEATER_PERIOD,HEATER_PERIOD/2);
+  TaskAdd(configTask,0,CONFIG_PERIOD,CONFIG_PERIOD);
+  TaskAdd(historyTask,0,HISTORY_SAMPLE_PERIOD,HISTORY_SAMPLE_PERIOD/2);
 }
 
 // the loop serves to process the ongoing state machines for
-//   valves, as initiated by control.
+//   valves, as initiated by control - by way of the scheduler.
+//   At the end of each pass, what there is to read over I2C is
+//   brought up to date (see ControlPublish()), and the trace is sent
+//   as far as it will go without waiting.
 
 void loop()
 {
-  valve[0].loop();
-  valve[1].loop();
-  heater[0].loop();
-  therm[0].loop();
-  pump[0].loop();
-  pump[1].loop();
-  light[0].loop();
+  TaskLoop();
+  ControlPublish();
+  TraceDrain();
 }
@@ -0,0 +1,249 @@
+//
+// analog.cpp
+//
+//   The analog scanner. analogRead() waits around for the conversion
+//   (about 110us on the Nano) so instead, all analog inputs are read
+//   by this scanner. Each pin that is read gets a "slot" that holds
+//   the latest sample and a sequence number that changes each time a
+//   new sample arrives. Readers just look at the slot - they never
+//   wait.
+//
+//   Each slot has its own sample period (in micros). A period of zero
+//   turns the slot off - which is what valves do while they are
+//   inactive.
+//
+//   A slot can also be oversampled (AnalogOversample()) - each sample
+//   is then 4^n conversions back-to-back, summed and shifted down by
+//   n, which gives n more bits than the ADC has. The samples of such a
+//   slot are 10+n bits.
+//
+//   Conversions are chained from the ADC-complete interrupt: when one
+//   finishes, the next slot that is due is started right away. When
+//   no slot is due, the scanner goes idle and AnalogLoop() starts it
+//   up again once one is.
+//
+//   NOTE - slots are added during static construction (from the
+//   device constructors) which is before the Arduino init() sets up
+//   the ADC. So nothing touches the hardware until AnalogLoop().
+//
+
+#include "analog.h"
+
+struct AnalogSlot {
+  byte		pin;		// analog pin (A0 - A7)
+  unsigned long	period;		// micros between samples (0 is off)
+  unsigned long	last;		// micros when the last sample was started
+  volatile int	value;		// latest sample 0 - 1023 (more if oversampled)
+  volatile byte	sequence;	// bumped each time value changes
+  byte		oversample;	// n - where a sample is 4^n conversions
+  byte		conversions;	// conversions so far for this sample
+  unsigned int	sum;		//   and their total
+};
+
+static AnalogSlot slots[ANALOG_CHANNELS];
+static int slotCount;
+
+static volatile int current = -1;	// slot being converted, -1 when idle
+
+static void analogStart(int);
+
+//
+// analogDue() - find the next slot (round-robin, after the given one)
+//    that is due for a sample. Returns -1 if none are.
+//
+static int analogDue(int after, unsigned long now)
+{
+  int i;
+  int slot;
+
+  for(i=1; i <= slotCount; i++) {
+    slot = (after + i) % slotCount;
+    if(slots[slot].period != 0 && now - slots[slot].last >= slots[slot].period) {
+      return(slot);
+    }
+  }
+  return(-1);
+}
+
+//
+// analogComplete() - a conversion has finished. Store it and start
+//    the next one (if anything is due). An oversampled slot keeps
+//    converting until it has all of the conversions for a sample.
+//    This runs in the ADC ISR.
+//
+static void analogComplete(int value)
+{
+  int slot = current;
+  AnalogSlot *s = &slots[slot];
+
+  s->sum += value;
+  if(++s->conversions < (1 << (2 * s->oversample))) {
+    analogStart(slot);
+    return;
+  }
+
+  s->value = s->sum >> s->oversample;
+  s->sum = 0;
+  s->conversions = 0;
+  s->sequence++;
+
+  current = analogDue(slot,micros());
+  if(current != -1) {
+    analogStart(current);
+  }
+}
+
+#ifdef __AVR__
+
+//
+// analogStart() - kick off a conversion on the given slot's pin. The
+//    prescaler and enable were set up by the Arduino init(), so only
+//    the mux, start, and interrupt enable are touched here.
+//
+static void analogStart(int slot)
+{
+  byte pin = slots[slot].pin;
+
+  if(pin >= A0) {
+    pin -= A0;
+  }
+
+  if(slots[slot].conversions == 0) {
+    slots[slot].last = micros();
+  }
+  ADMUX = _BV(REFS0) | (pin & 0x07);	// AVcc reference, like analogRead()
+  ADCSRA |= _BV(ADSC) | _BV(ADIE);
+}
+
+ISR(ADC_vect)
+{
+  analogComplete(ADC);
+}
+
+#else
+
+//
+// analogStart() - (host build) there is no ADC, so the conversion
+//    "completes" right away using analogRead() from the stand-in core.
+//
+static void analogStart(int slot)
+{
+  if(slots[slot].conversions == 0) {
+    slots[slot].last = micros();
+  }
+  analogComplete(analogRead(slots[slot].pin));
+}
+
+#endif
+
+//
+// AnalogChannel() - add the given pin to the scan, sampled every
+//    period micros. Returns the slot to use for AnalogLatest(), or -1
+//    if there are no slots left. The first sample is taken right away.
+//
+int AnalogChannel(int pin, unsigned long period)
+{
+  int slot;
+
+  if(slotCount >= ANALOG_CHANNELS) {
+    return(-1);
+  }
+
+  slot = slotCount++;
+  slots[slot].pin = pin;
+  slots[slot].period = period;
+  slots[slot].last = 0UL - period;	// due immediately
+  slots[slot].value = 0;
+  slots[slot].sequence = 0;
+  slots[slot].oversample = 0;
+  slots[slot].conversions = 0;
+  slots[slot].sum = 0;
+
+  return(slot);
+}
+
+//
+// AnalogRate() - change the sample period of the given slot. Zero
+//    turns it off. If the slot was off, it is due for a sample right
+//    away.
+//
+void AnalogRate(int slot, unsigned long period)
+{
+  if(slot < 0 || slots[slot].period == period) {
+    return;
+  }
+
+  noInterrupts();
+  if(slots[slot].period == 0) {
+    slots[slot].last = micros() - period;
+  }
+  slots[slot].period = period;
+  interrupts();
+}
+
+//
+// AnalogOversample() - make each sample of the given slot the sum of
+//    4^n conversions, shifted down by n (so 10+n bits). Up to n of 3,
+//    since 64 conversions of 1023 just fit in the sum. A sample that
+//    is underway is started over.
+//
+void AnalogOversample(int slot, byte n)
+{
+  if(slot < 0) {
+    return;
+  }
+  if(n > 3) {
+    n = 3;
+  }
+
+  noInterrupts();
+  slots[slot].oversample = n;
+  slots[slot].conversions = 0;
+  slots[slot].sum = 0;
+  interrupts();
+}
+
+//
+// AnalogLatest() - returns the latest sample for the given slot. If
+//    sequence is given, it gets the slot's sequence number so that
+//    the caller can tell if the sample is new.
+//
+int AnalogLatest(int slot, byte *sequence)
+{
+  int value;
+
+  if(slot < 0) {
+    return(0);
+  }
+
+  noInterrupts();
+  value = slots[slot].value;
+  if(sequence) {
+    *sequence = slots[slot].sequence;
+  }
+  interrupts();
+
+  return(value);
+}
+
+//
+// AnalogLoop() - restarts the scan if it went idle and something is
+//    now due. Call it from the main loop - it doesn't wait for
+//    anything.
+//
+void AnalogLoop(void)
+{
+  int slot;
+
+  if(current != -1 || slotCount == 0) {
+    return;
+  }
+
+  slot = analogDue(slotCount - 1,micros());
+  if(slot != -1) {
+    noInterrupts();
+    current = slot;
+    interrupts();
+    analogStart(slot);
+  }
+}
@@ -0,0 +1,21 @@
+//
+// analog.h
+//
+//   (see analog.cpp for information about the analog scanner)
+//
+
+#ifndef ANALOG_H
+#define ANALOG_H
+
+#include <Arduino.h>
+
+#define ANALOG_CHANNELS		3	// max number of analog inputs scanned - the
+					//   valves' current and the thermometer
+
+extern int AnalogChannel(int,unsigned long);	// add a pin, returns the slot
+extern void AnalogRate(int,unsigned long);	// change the sample period of a slot
+extern void AnalogOversample(int,byte);		// 4^n conversions per sample
+extern int AnalogLatest(int,byte *);		// latest sample (and sequence) of a slot
+extern void AnalogLoop(void);			// called from the main loop
+
+#endif // ANALOG_H
@@ -0,0 +1,200 @@
+//
+// config.cpp
+//
+//   The configuration of the valves, thermometers, and heaters lives in
+//   one image (ConfigImage in config.h) that is read from EEPROM in one
+//   pass the first time anyone asks for it - which is from the first
+//   device constructor. Devices then keep their part of it up to date
+//   and call ConfigChanged(), and ConfigLoop() saves it.
+//
+//   The image carries a layout version and a CRC, and there are two
+//   copies of it in EEPROM. A save goes to the copy that wasn't loaded,
+//   with a bumped generation number, so a save that is cut short (like
+//   a brownout) leaves a copy that is bad - and the other one is still
+//   good. At boot, the newest good copy wins. If neither is good (or
+//   the layout version changed) the devices fall back to their
+//   defaults, and those get saved.
+//
+//   Only the bytes that differ from the copy being written are queued
+//   (see EEPROMCacheWrite()) with the CRC last, so a typical change
+//   is a handful of bytes and never waits on the EEPROM.
+//
+
+#include "config.h"
+#include "eeprom.h"
+#include "EEPROM.h"		// (local) for the addresses
+#include "history.h"		//   and the size of the history
+#include <stddef.h>
+
+static_assert(sizeof(float) == 4,"config floats must be 4 bytes");
+static_assert(sizeof(ValveConfig) == 12,"ValveConfig layout changed");
+static_assert(sizeof(ThermometerConfig) == 12,"ThermometerConfig layout changed");
+static_assert(sizeof(HeaterConfig) == 15,"HeaterConfig layout changed");
+static_assert(sizeof(ConfigImage) <= CONFIG_EEPROM_SLOT,"config image doesn't fit in its slot");
+
+// the EEPROM regions can't run into each other
+
+static_assert(CONFIG_EEPROM_ADDRESS + 2 * CONFIG_EEPROM_SLOT <= PUMP_EEPROM_ADDRESS,
+	      "config overlaps pumps");
+static_assert(PUMP_EEPROM_ADDRESS + 2 * PUMP_EEPROM_INCR <= LIGHT_EEPROM_ADDRESS,
+	      "pumps overlap lights");
+static_assert(LIGHT_EEPROM_ADDRESS + LIGHT_EEPROM_INCR <= VALVE_POSITION_LOG_ADDRESS,
+	      "lights overlap the position logs");
+static_assert(VALVE_POSITION_LOG_ADDRESS + CONFIG_VALVES * VALVE_POSITION_LOG_INCR <= HISTORY_EEPROM_ADDRESS,
+	      "position logs overlap the history");
+#ifdef E2END
+static_assert(HISTORY_EEPROM_ADDRESS + HISTORY_BLOCKS * HISTORY_BLOCK <= E2END + 1,
+	      "history runs off the end of EEPROM");
+#endif
+
+#define CONFIG_CRC_SIZE		offsetof(ConfigImage,crc)
+#define SLOT_ADDRESS(slot)	(CONFIG_EEPROM_ADDRESS + (slot) * CONFIG_EEPROM_SLOT)
+
+static ConfigImage image;
+static int loaded;		// image has been read in
+static int valid;		//   and came from a good copy
+static int changed;		// image needs to be saved
+static byte slot;		// copy the image was last loaded from/saved to
+
+//
+// configCRC() - CRC-16 (CCITT, 0x1021) of the given bytes. Bitwise
+//    rather than a table because it only runs at boot and on saves.
+//
+static uint16_t configCRC(const byte *data, int count)
+{
+  uint16_t crc = 0xffff;
+  int i;
+
+  while(count--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for(i=0; i < 8; i++) {
+      crc = (crc & 0x8000)?(crc << 1) ^ 0x1021:(crc << 1);
+    }
+  }
+  return(crc);
+}
+
+//
+// configRead() - read the given copy into the given image, returning
+//    true if it is good.
+//
+static int configRead(int which, ConfigImage *copy)
+{
+  byte *bytes = (byte *)copy;
+  int addr = SLOT_ADDRESS(which);
+  unsigned int i;
+
+  for(i=0; i < sizeof(*copy); i++) {
+    bytes[i] = EEPROMCacheRead(addr + i);
+  }
+
+  return(copy->version == CONFIG_VERSION &&
+	 copy->crc == configCRC(bytes,CONFIG_CRC_SIZE));
+}
+
+//
+// configLoad() - read both copies and keep the newest good one.
+//
+static void configLoad(void)
+{
+  ConfigImage other;
+  int good[2];
+
+  good[0] = configRead(0,&image);
+  good[1] = configRead(1,&other);
+
+  if(good[1] && (!good[0] || (int8_t)(other.generation - image.generation) > 0)) {
+    image = other;
+    slot = 1;
+  } else {
+    slot = 0;
+  }
+
+  valid = good[0] || good[1];
+  if(!valid) {
+    memset(&image,0,sizeof(image));
+    image.version = CONFIG_VERSION;
+    slot = 1;			// so the first save goes to copy 0
+  }
+  loaded = true;
+}
+
+//
+// Config() - returns the image, reading it in the first time.
+//
+ConfigImage *Config(void)
+{
+  if(!loaded) {
+    configLoad();
+  }
+  return(&image);
+}
+
+//
+// ConfigValid() - true if the image came from EEPROM, false if the
+//    devices need to fill in their defaults.
+//
+int ConfigValid(void)
+{
+  Config();
+  return(valid);
+}
+
+void ConfigChanged(void)
+{
+  changed = true;
+}
+
+//
+// ConfigLoop() - save the image to the other copy if it has changed.
+//    This waits for the EEPROM to be idle, then compares the whole
+//    image before queueing anything - once the first byte is queued
+//    the ready ISR is writing, and each later compare would wait on it.
+//    Every byte from the first difference to the last one is queued;
+//    the queue skips the ones that are already right.
+//
+void ConfigLoop(void)
+{
+  byte *bytes = (byte *)&image;
+  int addr;
+  int first, last;
+  int i;
+
+  if(!changed || EEPROMBusy()) {
+    return;
+  }
+  changed = false;
+
+  slot ^= 1;
+  addr = SLOT_ADDRESS(slot);
+
+  image.generation++;
+  image.crc = configCRC(bytes,CONFIG_CRC_SIZE);
+
+  first = -1;
+  last = -1;
+  for(i=0; i < (int)sizeof(image); i++) {
+    if(EEPROMCacheRead(addr + i) != bytes[i]) {
+      if(first == -1) {
+        first = i;
+      }
+      last = i;
+    }
+  }
+
+  for(i=first; first != -1 && i <= last; i++) {
+    EEPROMCacheWrite(addr + i,bytes[i]);
+  }
+}
+
+//
+// ConfigErase() - spoil both copies so that the devices use their
+//    defaults after the next boot. Any unsaved change is dropped.
+//    Use EEPROMFlush() before resetting.
+//
+void ConfigErase(void)
+{
+  changed = false;
+  EEPROMCacheWrite(SLOT_ADDRESS(0) + offsetof(ConfigImage,version),(byte)0xff);
+  EEPROMCacheWrite(SLOT_ADDRESS(1) + offsetof(ConfigImage,version),(byte)0xff);
+}
@@ -0,0 +1,57 @@
+//
+// config.h
+//
+//   (see config.cpp for information about the config image)
+//
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define CONFIG_VERSION	2		// bump when the layout below changes
+#define CONFIG_PERIOD	100000UL	// micros between checks for changes to save
+
+#define CONFIG_VALVES	2
+#define CONFIG_THERMS	1
+#define CONFIG_HEATERS	1
+
+// the image is laid out exactly as it is in EEPROM, so everything is
+//   a fixed-width type and packed - this way the host build (with its
+//   wider int and long) sees the same layout as the Nano.
+
+struct ValveConfig {
+  uint32_t	travelUp;	// calibrated travel time (micros) toward degMAX
+  uint32_t	travelDown;	//   and toward degMIN
+  int16_t	limitMin;	// degrees at the minimum stop
+  int16_t	limitMax;	//   and at the maximum stop
+} __attribute__((packed));
+
+struct ThermometerConfig {
+  float		c1, c2, c3;	// Steinhart-Hart coefficients
+} __attribute__((packed));
+
+struct HeaterConfig {
+  int16_t	setPoint;	// tenths of degrees
+  uint8_t	mode;		// HeaterModes (see heater.h)
+  float		kp, ki, kd;	// PID gains - output (0-1) per degree, and per
+				//   degree-second, and per degree/second
+} __attribute__((packed));
+
+struct ConfigImage {
+  uint8_t		version;	// CONFIG_VERSION
+  uint8_t		generation;	// bumped on every save - newest copy wins
+  ValveConfig		valve[CONFIG_VALVES];
+  ThermometerConfig	therm[CONFIG_THERMS];
+  HeaterConfig		heater[CONFIG_HEATERS];
+  uint16_t		crc;		// CRC-16 of everything above
+} __attribute__((packed));
+
+extern ConfigImage *Config(void);	// the image (loaded on first use)
+extern int ConfigValid(void);		// true if it was loaded from EEPROM
+extern void ConfigChanged(void);	// the image changed - save it
+extern void ConfigLoop(void);		// saves changes, called from the main loop
+extern void ConfigErase(void);		// defaults on the next boot
+
+#endif // CONFIG_H
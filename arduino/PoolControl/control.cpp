@@ -6,9 +6,9 @@
 //   and checking temperature.
 //
 //   Control is implemented as I2C callbacks. The callbacks are
-//   processed as ISRs so they don't do much on their own for the big
-//   control mechanisms. For simple reads, though, they happen inside
-//   the ISR.
+//   processed as ISRs so they don't do much on their own. Writes are
+//   put on a queue that the main loop works through (ControlLoop()).
+//   For simple reads, though, they happen inside the ISR.
 //
 //   Control is implemented as a set of global routines, particularly
 //   the ISR callbacks.
@@ -30,6 +30,9 @@
 //      0 0 0   1/0 1 0  x y  - write/read [target] min degrees (1)
 //      0 0 0   1/0 1 1  x y  - write/read [target] max degrees (1)
 // x    0 0 1   1   0 0  x y  - initiate calibration on valve [target] (0)
+//      0 0 1   1   0 1  x y  - quick verify calibration on valve [target] (0)
+//      0 0 1   0   X X  x y  - read [target] state dwell times, page XX (see dwellGet())
+//                                (only with VALVE_PROFILE)
 //      0 1 0   1   0 0  x y  - move [target] to given degrees (1)
 //      0 1 0   1   0 1  x y  - move [target] to min degrees (0)
 //      0 1 0   1   1 0  x y  - move [target] to max degrees (0)
@@ -45,20 +48,73 @@
 //	1 0 1   1   0 0  x y  - heater off of [target]
 //	1 0 1   1   0 1  x y  - heater on of [target]
 //      1 0 1   1   1 0  x y  - config set point of heater [target]
+//      1 0 1   1   1 1  x y  - heater mode, and gains, of [target] (1 or 13)
+//      1 0 1   0   1 1  x y  - heater control of [target] (see controlI2C())
 //      1 0 1   0   X X  x y  - heater status (on or off) of [target]
 //
 //      1 1 0   1   0 0  x y  - light off for [target]
 //      1 1 0   1   0 1  x y  - light on for [target]
 //      1 1 0   0   0 0  x y  - status of light [target]
 //
-//      1 1 1   1   X X  X X  - eeprom factory reset
+//      1 1 1   1   0 0  0 0  - eeprom factory reset
+//      1 1 1   1   0 0  0 1  - reset loop/task/queue statistics
+//      1 1 1   1   0 0  1 0  - set a sensor filter (see ControlFilterSet())
+//      1 1 1   1   0 1  0 0  - batch of writes (see controlBatch())
+//      1 1 1   0   0 0  0 0  - read system snapshot (see ControlPublish())
+//      1 1 1   0   0 0  0 1  - read loop statistics (see ControlLoopStats())
+//      1 1 1   0   0 0  1 0  - read task statistics (see ControlTaskStats())
+//      1 1 1   0   0 0  1 1  - read command queue statistics (see ControlQueueStats())
+//      1 1 1   0   0 1  0 0  - read task worst case (see ControlTaskWorst())
+//      1 1 1   0   0 1  0 1  - read events (see ControlEvents())
+//      1 1 1   0   0 1  1 0  - read a sensor filter (see ControlFilter())
+//      1 1 1   0   0 1  1 1  - read temperature history (see HistoryFrame())
+//      1 1 1   0   1 0  0 0  - read discovery (see ControlDiscovery())
+//      1 1 1   0   1 0  0 1  - read batch status (2) - sequence, BATCH_* status
+//      1 1 1   0   1 0  1 0  - read a list of registers (see ControlGather())
+//      1 1 1   0   1 0  1 1  - read the trace (see TraceFrame())
+//      1 1 1   1   1 0  0 0  - extended address (see below)
+//
+//   The write that picks the events register to read can carry one
+//   more byte - a sequence number - and the read then starts with the
+//   event after that one (see EventSeek()). Likewise, the write that
+//   picks the filter register can carry the filter channel to read -
+//   which sticks until another one is given. And the one that picks
+//   the history register can carry an entry's sequence number (2
+//   bytes) for the read to start with - or 0xffff for the oldest
+//   entry (see HistorySeek()).
+//
+//   The write that picks the gather register carries the list of
+//   registers that the read is to return - up to GATHER_MAX of them,
+//   any of which can be an extended address (0xf8, register, device).
+//   The list sticks, so the same ones can be read again and again.
+//
+//   The target field only reaches four of each kind of device, so any
+//   register can also be given through the extended address register.
+//   It is followed by the register (its target bits are ignored) and
+//   then a byte with the device number - and for a write, the data:
+//
+//      0xf8  register  device  [data...]
+//
+//   The extended address of a read sticks, so after it has been given
+//   once, a write of just 0xf8 picks it again (for masters that can
+//   only send one byte before a read). Devices that aren't there are
+//   ignored - writes to them do nothing, and reads send nothing back.
 //      
 #include "control.h"
+#include "scheduler.h"
+#include "config.h"
+#include "events.h"
+#include "history.h"
+#include "trace.h"
 #include <Arduino.h>      // can go away later
 #include <Wire.h>
 
 byte targetRegister;	// set to the first byte of any write - necessary to
                         //   identify the register that is being read
+byte targetIndex;	//   and the device it is for
+
+byte extendedRegister;	// the last extended address given for a read
+byte extendedIndex;
 
 Valve *valves;
 int valveCount;
@@ -75,6 +131,283 @@ int pumpCount;
 Light *lights;
 int lightCount;
 
+// the system snapshot and statistics are versioned so that the controller
+//   can tell if it is talking to firmware that lays out the frame differently
+
+#define SNAPSHOT_VERSION	1
+#define STATS_VERSION		2
+#define DISCOVERY_VERSION	1
+
+#define EVENTS_REGISTER		0xe5
+#define FILTER_REGISTER		0xe6
+#define HISTORY_REGISTER	0xe7
+#define DISCOVERY_REGISTER	0xe8
+#define EXTENDED_REGISTER	0xf8
+#define BATCH_REGISTER		0xf4
+#define BATCH_STATUS_REGISTER	0xe9
+#define GATHER_REGISTER		0xea
+#define TRACE_REGISTER		0xeb
+
+// what happened to the last batch (see controlBatch())
+
+#define BATCH_OK		0	// its commands are queued
+#define BATCH_DUPLICATE		1	// same sequence as the last one that was - ignored
+#define BATCH_CRC		2	// didn't check out - ignored
+#define BATCH_FORMAT		3	// commands didn't add up - ignored
+#define BATCH_FULL		4	// no room on the queue - ignored, try again
+#define BATCH_NONE		0xff	// no batch since reset
+
+volatile byte batchSeq;			// the last batch that checked out
+volatile byte batchStatus = BATCH_NONE;	//   and what happened to it
+byte batchQueued;			// the last one that was queued
+bool batchAny;				//   (if there has been one)
+
+// sensor filters are picked by a channel - the high nibble is the kind
+//   of device and the low nibble which one
+
+#define FILTER_VALVE		0x00	// valve current
+#define FILTER_THERM		0x10	// thermometer
+
+volatile byte filterChannel;	// channel that the filter register reads
+
+// the registers that the gather register reads (see ControlGather())
+
+#define GATHER_MAX		8
+
+struct Gather {
+  byte reg;
+  byte index;
+};
+
+Gather gather[GATHER_MAX];
+byte gatherCount;
+
+//
+// The command queue - writes come in through the TWI interrupt, but
+//   carrying them out can take a long time (EEPROM writes, float
+//   math). So the ISR just copies the register and its data into a
+//   Command and puts it on the queue, and ControlLoop() (from the
+//   main loop) takes them off and executes them.
+//
+//   The queue is a ring of bytes, and each Command only takes as much
+//   of it as its data needs - most writes carry a byte or two, and a
+//   slot for the biggest would waste most of the RAM. A Command is
+//   never split at the end of the ring: if it doesn't fit there, a
+//   0 (not a register that is ever queued) is left to say the rest is
+//   unused, and the Command goes at the start.
+//
+//   The ISR is the only one that moves queueHead, and ControlLoop()
+//   is the only one that moves queueTail, so no locking is needed.
+//
+
+#define COMMAND_QUEUE_BYTES	64	// must be a power of 2
+#define COMMAND_DATA_MAX	13	// biggest payload (heater mode and gains)
+#define COMMAND_SKIP		0	// the rest of the ring is unused
+
+struct Command {
+  byte reg;				// the register written
+  byte index;				//   and the device (see ControlRegisterWrite())
+  byte count;				// number of bytes in data
+  byte data[COMMAND_DATA_MAX];		//   (only count of them are in the ring)
+};
+
+#define COMMAND_SIZE(count)	(3 + (count))	// bytes a Command takes in the ring
+
+byte queue[COMMAND_QUEUE_BYTES];
+volatile byte queueHead;		// where the next Command goes (ISR)
+volatile byte queueTail;		// next Command to execute (loop)
+
+//
+// The shadow registers - the registers that are read all the time
+//   (device status, and the snapshot) are put
+//   together by the main loop (ControlPublish()) and the TWI ISR just
+//   copies them out. So a read is quick, and never catches something
+//   (like a valve's position) half-way through being changed. There
+//   are two copies - the ISR reads one while the other is filled in,
+//   and then they trade places.
+//
+//   The shadow starts with the snapshot, which has the status of each
+//   device in it, followed by the rest (see shadowLayout()). Devices
+//   past what the config has room for (pumps and lights past
+//   SHADOW_OTHERS) aren't in it - their registers are put together in
+//   the ISR, as they were before there was a shadow (see deviceRead()).
+//   They are only there with extended addressing, and the shadow isn't
+//   made bigger for them, as RAM is short.
+//
+
+#define SHADOW_OTHERS		2	// pumps or lights
+#define SHADOW_SIZE		(6 + CONFIG_VALVES * 12 + CONFIG_THERMS * 2 + CONFIG_HEATERS * 20 + \
+				 SHADOW_OTHERS * 2)
+#define SHADOW_PERIOD		10000UL	// micros between publishing
+
+byte shadow[2][SHADOW_SIZE];
+volatile byte shadowActive;		// the copy the ISR reads
+unsigned long shadowTime;		// micros when it was last published
+bool shadowStale = true;		//   or true if it should be now
+
+// where each register is in the shadow, and how many of each kind
+//   of device it has room for
+
+byte shadowValves;			// status of each (4)
+byte shadowTherms;			// temperature of each (2)
+byte shadowHeaters;			// status of each (4)
+byte shadowPumps;			// speed of each (1)
+byte shadowLights;			// on/off of each (1)
+byte snapshotLength;			// (the end of the snapshot)
+byte shadowValveConfig;			// travel times (4), min and max (2 each)
+byte shadowHeaterControl;		// (16)
+
+byte shadowCounts[5];			// valves, therms, heaters, pumps, lights
+
+// queue statistics - read through a system register
+
+volatile unsigned long queueCommands;	// commands queued (wraps)
+volatile unsigned long queueOverflows;	// commands dropped because the queue was full
+volatile byte queueDepthMax;		// deepest the queue has been
+
+#define QUEUE_DEPTH()	((byte)(queueHead - queueTail) & (COMMAND_QUEUE_BYTES-1))
+
+//
+// queueRoom() - where a Command of the given size can go, if the queue
+//    (not yet published) ends at head, or -1 if it is full. If it has
+//    to go at the start of the ring, the rest of the ring is marked as
+//    skipped. The head is never allowed to catch up to the tail, as
+//    that would look empty.
+//
+static int queueRoom(byte head, byte size)
+{
+  byte tail = queueTail;
+
+  if(head < tail) {
+    return((tail - head > size)?head:-1);
+  }
+  if(COMMAND_QUEUE_BYTES - head > size || (COMMAND_QUEUE_BYTES - head == size && tail != 0)) {
+    return(head);
+  }
+  if(tail > size) {
+    queue[head] = COMMAND_SKIP;
+    return(0);
+  }
+  return(-1);
+}
+
+//
+// queuePublish() - hand the commands that have been put on the queue
+//    (up to, not including, head) to ControlLoop(), all at once.
+//
+static void queuePublish(byte head, byte commands)
+{
+  byte depth;
+
+  queueHead = head;
+  queueCommands += commands;
+
+  depth = QUEUE_DEPTH();
+  if(depth > queueDepthMax) {
+    queueDepthMax = depth;
+  }
+}
+
+//
+// crc8() - the SMBus PEC (CRC-8, x^8 + x^2 + x + 1) of the given bytes,
+//    carrying on from crc. A nibble at a time, from a small table.
+//
+static const byte crcNibble[16] PROGMEM = {
+  0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+  0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d
+};
+
+static byte crc8(byte crc, const byte *data, int count)
+{
+  while(count--) {
+    crc ^= *data++;
+    crc = (crc << 4) ^ pgm_read_byte(&crcNibble[crc >> 4]);
+    crc = (crc << 4) ^ pgm_read_byte(&crcNibble[crc >> 4]);
+  }
+  return(crc);
+}
+
+//
+// controlBatch() - a batch of writes has come in (frame is what came
+//    after the register). It is:
+//
+//      [0]      sequence number - a new one for each batch, the same
+//               one when it is sent again
+//      [1]      number of commands
+//      then for each command - register, count of data, data
+//      [last]   CRC-8 of the whole write, starting with the slave
+//               address byte (SMBus PEC)
+//
+//    A command can be the extended address register, with its register
+//    and device first in the data. Only writes can be batched.
+//
+//    The commands go on the queue all together, or not at all, so
+//    ControlLoop() carries them out in one go. A batch that is sent
+//    again after it was queued (the master didn't see the status) is
+//    ignored. Returns the BATCH_* status.
+//
+static byte controlBatch(byte *frame, int count)
+{
+  static const byte header[2] = { SLAVE_ADDR << 1, BATCH_REGISTER };
+  Command *command;
+  byte head = queueHead;
+  byte commands = 0;
+  byte reg;
+  byte index;
+  int length;
+  int at = 2;
+  int slot;
+
+  if(count < 3 || crc8(crc8(0,header,2),frame,count) != 0) {
+    return(BATCH_CRC);
+  }
+  count--;				// (the CRC)
+  batchSeq = frame[0];
+  if(batchAny && batchSeq == batchQueued) {
+    return(BATCH_DUPLICATE);
+  }
+
+  while(at + 2 <= count) {
+    reg = frame[at];
+    length = frame[at+1];
+    at += 2;
+    index = reg & 0x03;
+    if(at + length > count) {
+      return(BATCH_FORMAT);
+    }
+    if(reg == EXTENDED_REGISTER && length >= 2) {
+      reg = frame[at];
+      index = frame[at+1];
+      at += 2;
+      length -= 2;
+    }
+    if(!((reg >> 4) & 0x01) || reg == BATCH_REGISTER || reg == EXTENDED_REGISTER ||
+       length > COMMAND_DATA_MAX) {
+      return(BATCH_FORMAT);
+    }
+    if((slot = queueRoom(head,COMMAND_SIZE(length))) < 0) {
+      return(BATCH_FULL);
+    }
+
+    command = (Command *)&queue[slot];
+    command->reg = reg;
+    command->index = index;
+    command->count = length;
+    memcpy(command->data,&frame[at],length);
+    at += length;
+    head = (slot + COMMAND_SIZE(length)) & (COMMAND_QUEUE_BYTES-1);
+    commands++;
+  }
+  if(at != count || commands != frame[1]) {
+    return(BATCH_FORMAT);
+  }
+
+  batchQueued = batchSeq;
+  batchAny = true;
+  queuePublish(head,commands);
+  return(BATCH_OK);
+}
+
 //
 // ControlRegisterWrite() - an incoming write was received. This means
 //    one of two different things:
@@ -86,123 +419,89 @@ int lightCount;
 //      register number. This will be followed by a read. So the
 //      register number is kept in a global.
 //
+//    This is the TWI ISR, so writes are only queued here - see
+//    ControlExecute() for what they actually do.
+//
+//    Either way, the device is the register's target field - unless
+//    the extended address register was used.
+//
 void ControlRegisterWrite(int count)
 {
-  byte incoming;
-  int command;
-  int isWrite;
-  int arg;
-  int i;
-  int target;
-  int degrees;	// used to assemble the move-to degrees
-  byte dataBuffer[10];		// simple data buffer - should be using this  
-  
-  //  Serial.print("Write Received:"); Serial.println(count);
+  Command *command;
+  int slot;
+  unsigned int seq;
+  byte frame[BUFFER_LENGTH];
+  int length;
+  byte reg;
 
   if(count > 0) {
     targetRegister = Wire.read();
+    targetIndex = targetRegister & 0x03;
     count--;
 
-    command = (targetRegister >> 5) & 0x07;
-    isWrite = (targetRegister >> 4) & 0x01;
-    arg = (targetRegister >> 2) & 0x03;
-    target = targetRegister & 0x03;
+    if(targetRegister == EXTENDED_REGISTER) {
+      if(count > 1) {
+	targetRegister = Wire.read();
+	targetIndex = Wire.read();
+	count -= 2;
+	if(!((targetRegister >> 4) & 0x01)) {
+	  extendedRegister = targetRegister;
+	  extendedIndex = targetIndex;
+	}
+      } else {
+	targetRegister = extendedRegister;
+	targetIndex = extendedIndex;
+      }
+    }
 
-    if(isWrite) {
-    
-      // the following switch/table implements the registers that can be
-      //   written - if the incoming targetRegister IS a write.  If the
-      //   incoming request is actually a read, this write will store
-      //   the target register and a request for data will come in
-      //   right afterwards, and that routine will use "targetRegister"
-      //   to decide what to send back.
-    
-      switch(command) {
-
-	// write valve config param
-      case 0b000:
-	switch(arg) {
-	case 0x00:  Serial.print("ERROR (can't write status) "); break;   // one more byte
-	case 0x01:  Serial.print("direction "); break;   // one more byte
-	case 0x02:  Serial.print("min degrees "); break; // one more byte
-	case 0x03:  Serial.print("max degrees "); break; // one more byte
+    if(targetRegister == BATCH_REGISTER) {
+      for(length = 0; count > 0 && length < BUFFER_LENGTH; length++, count--) {
+	frame[length] = Wire.read();
+      }
+      batchStatus = controlBatch(frame,length);
+      if(batchStatus == BATCH_FULL) {
+	queueOverflows++;
+      }
+    } else if((targetRegister >> 4) & 0x01) {
+      length = (count > COMMAND_DATA_MAX)?COMMAND_DATA_MAX:count;
+      if((slot = queueRoom(queueHead,COMMAND_SIZE(length))) < 0) {
+	queueOverflows++;
+      } else {
+	command = (Command *)&queue[slot];
+	command->reg = targetRegister;
+	command->index = targetIndex;
+	command->count = 0;
+	while(command->count < length) {
+	  command->data[command->count++] = Wire.read();
+	  count--;
 	}
-	break;
-
-	// initiate calibration	
-      case 0b001:
-	valves[target].calibrate();
-	break;
-
-	// initiate valve move	
-      case 0b010:
-	if(count > 1) {
-	  degrees = Wire.read() << 8;
-	  degrees |= Wire.read();
+	queuePublish((slot + COMMAND_SIZE(length)) & (COMMAND_QUEUE_BYTES-1),1);
+      }
+    } else if(targetRegister == EVENTS_REGISTER && count > 0) {
+      EventSeek(Wire.read());
+      count--;
+    } else if(targetRegister == FILTER_REGISTER && count > 0) {
+      filterChannel = Wire.read();
+      count--;
+    } else if(targetRegister == HISTORY_REGISTER && count > 1) {
+      seq = Wire.read() << 8;
+      seq |= Wire.read();
+      HistorySeek(seq);
+      count -= 2;
+    } else if(targetRegister == GATHER_REGISTER && count > 0) {
+      for(gatherCount = 0; count > 0 && gatherCount < GATHER_MAX; gatherCount++) {
+	reg = Wire.read();
+	count--;
+	gather[gatherCount].reg = reg;
+	gather[gatherCount].index = reg & 0x03;
+	if(reg == EXTENDED_REGISTER && count > 1) {
+	  gather[gatherCount].reg = Wire.read();
+	  gather[gatherCount].index = Wire.read();
 	  count -= 2;
-	  valves[target].move(degrees);
-	  
-	  //	  switch(arg) {
-	  //	  case 0x00:  Serial.print("to degrees "); break;   // one more byte
-	  //	  case 0x01:  Serial.print("to min degrees "); break;
-	  //	  case 0x02:  Serial.print("to max degrees "); break;
-	  //      }
-	}
-	break;
-
-	// set pump speed - 0 off, 1 low, 2 high
-      case 0b011:
-	pumps[target].control(arg);
-	break;
-
-	// configure thermometer coefficients
-      case 0b100:
-	  Serial.println("therm coef config");
-	  if(count >= 9) {
-	      for(i=0; i < 9; i++) {
-		  dataBuffer[i] = Wire.read();
-	      }
-	      count -= 9;
-	      therms[target].coefficients(dataBuffer);
-	  }
-	  break;
-	  
-	// work with the heater
-      case 0b101:
-	switch(arg) {
-
-	case 0b00:
-	case 0b01:
-	  heaters[target].enable(arg);
-	  break;
-
-	  // configure heater set temp - 2 bytes of tenths of degrees
-	case 0b10:
-	  Serial.println("heater config");
-	  if(count > 1) {
-	    degrees = Wire.read() << 8;
-	    degrees |= Wire.read();
-	    count -= 2;
-	    Serial.println(degrees);
-	    heaters[target].config(degrees);
-	  }
-	  break;
 	}
-	break;
-
-	// control the light - arg is on or off (1 or 0)
-      case 0b110:
-	lights[target].control(arg);
-	break;
-
-	// factory reset of eeprom
-      case 0b111:
-	Serial.println("factory reset");
-	FactoryReset();
-	break;
       }
-
     }
+
     while(count--) {
       Wire.read();	// dump any extra data
     }
@@ -210,85 +509,819 @@ void ControlRegisterWrite(int count)
 }
 
 //
-// ControlRegisterRead() - this is a request to read a particular
-//   "register". The register identifier was given in the previous
-//   write, and is now in "targetRegister".
+// controlTarget() - true if the device that the register is for is
+//    there. The system registers aren't for a device.
 //
-void ControlRegisterRead()
+static int controlTarget(byte reg, int index)
+{
+  switch((reg >> 5) & 0x07) {
+  case 0b000:
+  case 0b001:
+  case 0b010:
+    return(index < valveCount);
+
+  case 0b011:
+    return(index < pumpCount);
+
+  case 0b100:
+    return(index < thermCount);
+
+  case 0b101:
+    return(index < heaterCount);
+
+  case 0b110:
+    return(index < lightCount);
+  }
+  return(true);
+}
+
+//
+// getFloat() - a float sent big-endian (the same four bytes as on the
+//    Nano, just in the other order).
+//
+static float getFloat(byte *data)
+{
+  uint32_t bits = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                  ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+  float value;
+
+  memcpy(&value,&bits,4);
+  return(value);
+}
+
+//
+// controlFilter() - returns the filter for the given channel, or NULL
+//    if there is no such device.
+//
+static FilterBase *controlFilter(byte channel)
+{
+  int which = channel & 0x0f;
+
+  switch(channel & 0xf0) {
+  case FILTER_VALVE:
+    if(which < valveCount) {
+      return(&valves[which].currentFilter);
+    }
+    break;
+
+  case FILTER_THERM:
+    if(which < thermCount) {
+      return(&therms[which].filter);
+    }
+    break;
+  }
+  return(NULL);
+}
+
+//
+// ControlFilterSet() - change the settings of a filter. The data is
+//    laid out like ControlFilter() - the channel and then the
+//    settings. The filter brings them into range, so read them back
+//    to see what was used. Settings aren't saved - a reset goes back
+//    to the defaults.
+//
+void ControlFilterSet(byte *data, int count)
+{
+  FilterBase *filter;
+  FilterSettings set;
+
+  if(count < 8 || (filter = controlFilter(data[0])) == NULL) {
+    return;
+  }
+
+  set.oversample = data[1];
+  set.median = data[2];
+  set.average = data[3];
+  set.period = ((unsigned long)data[4] << 24) | ((unsigned long)data[5] << 16) |
+               ((unsigned long)data[6] << 8) | (unsigned long)data[7];
+  filter->configure(&set);
+}
+
+//
+// ControlExecute() - carry out the given (write) command. This is
+//    called from the main loop (ControlLoop()) - not the ISR - so it
+//    can take its time.
+//
+void ControlExecute(Command *cmd)
 {
   int command;
-  int isWrite;
   int arg;
   int target;
-  byte valveStatus[4];		// used to report current status (cur,prev,deg)
-  byte travelTimes[4];		// used to report current calibration travel times
-  byte degrees[] = {0x01,0x02};	// used to report current degrees
-  byte tempReading[2];
-  byte singleByteData[1];
-  byte dataBuffer[10];		// simple data buffer - should be using this
-  
-  //  Serial.print("Read Received ");  Serial.println(targetRegister);
+  int degrees;	// used to assemble the move-to degrees
+  int before;	// status before a change (to log an event if it changes)
+  uint8_t sreg;	// interrupts as they were (see ControlQueueStats())
+  byte *data = cmd->data;
+  int count = cmd->count;
 
-  command = (targetRegister >> 5) & 0x07;
-  isWrite = (targetRegister >> 4) & 0x01;
-  arg = (targetRegister >> 2) & 0x03;
-  target = targetRegister & 0x03;
+  command = (cmd->reg >> 5) & 0x07;
+  arg = (cmd->reg >> 2) & 0x03;
+  target = cmd->index;
 
-  if(!isWrite) {
+  if(!controlTarget(cmd->reg,target)) {
+    return;
+  }
 
-    switch(command) {
+  // the following switch/table implements the registers that can be
+  //   written. Reads are handled by ControlRegisterRead() using
+  //   "targetRegister".
+    
+  switch(command) {
 
-      // read valve config param
-    case 0x00:
-      switch(arg) {
-      case 0x00:  // send four bytes (cur,prev,deg)
-	valves[target].status(valveStatus);
-	Wire.write(valveStatus,4);
-	break;
+    // write valve config param
+  case 0b000:
+    //   (status, direction, min and max degrees - none do anything yet)
+    TRACE_WARN(TRACE_UNSUPPORTED,target,cmd->reg);
+    break;
+
+    // initiate calibration	
+  case 0b001:
+    if(arg == 0b01) {
+      valves[target].verify();
+    } else {
+      valves[target].calibrate();
+    }
+    break;
+
+    // initiate valve move	
+  case 0b010:
+    if(count > 1) {
+      degrees = data[0] << 8;
+      degrees |= data[1];
+      valves[target].move(degrees);
+    }
+    break;
+
+    // set pump speed - 0 off, 1 low, 2 high
+  case 0b011:
+    before = pumps[target].status;
+    pumps[target].control(arg);
+    if(pumps[target].status != before) {
+      EventLog(EVENT_PUMP,target,pumps[target].status);
+    }
+    break;
+
+    // configure thermometer coefficients
+  case 0b100:
+    if(count >= 9) {
+      therms[target].coefficients(data);
+    }
+    break;
 	  
-      case 0x01:
-	valves[target].travelTime(travelTimes);
-	Wire.write(travelTimes,4);
-	break;
-
-      case 0x02:
-      case 0x03:
-	valves[target].degreesGet(arg&0x01,degrees); // MIN (for 0x02) or MAX (0x03)
-	Wire.write(degrees,2);
-	break;
+    // work with the heater
+  case 0b101:
+    switch(arg) {
+
+    case 0b00:
+    case 0b01:
+      heaters[target].enable(arg);
+      break;
+
+      // configure heater set temp - 2 bytes of tenths of degrees
+    case 0b10:
+      if(count > 1) {
+	degrees = data[0] << 8;
+	degrees |= data[1];
+	TRACE_INFO(TRACE_HEATER_SET,target,degrees);
+	heaters[target].config(degrees);
+      }
+      break;
+
+      // heater mode (HeaterModes) - and if they are given, the PID
+      //   gains kp, ki, kd as floats (big-endian)
+    case 0b11:
+      if(count >= 13) {
+	heaters[target].configGains(getFloat(&data[1]),getFloat(&data[5]),getFloat(&data[9]));
+      }
+      if(count > 0) {
+	heaters[target].configMode(data[0]);
       }
       break;
+    }
+    break;
+
+    // control the light - arg is on or off (1 or 0)
+  case 0b110:
+    before = lights[target].status;
+    lights[target].control(arg);
+    if(lights[target].status != before) {
+      EventLog(EVENT_LIGHT,target,lights[target].status);
+    }
+    break;
+
+    // system registers - arg and target together pick the register
+  case 0b111:
+    switch(cmd->reg & 0x0f) {
+    case 0x00:
+      TRACE_WARN(TRACE_FACTORY_RESET,0,0);
+      FactoryReset();
+      break;
 
-    // get pump speed
-    case 0b011:
-	singleByteData[0] = pumps[target].status;
-	Wire.write(singleByteData,1);
-	break;
-      
-      // read temperature
-    case 0b100:
-      therms[target].readI2C(tempReading);
-      Wire.write(tempReading,2);
+    case 0x01:
+      TaskReset();
+      sreg = SREG;
+      cli();
+      queueCommands = 0;
+      queueOverflows = 0;
+      queueDepthMax = 0;
+      SREG = sreg;
       break;
 
-    // read heater status
-    case 0b101:
-      dataBuffer[0] = heaters[target].enabled;
-      dataBuffer[1] = heaters[target].active;
-      dataBuffer[2] = heaters[target].setPoint >> 8;
-      dataBuffer[3] = heaters[target].setPoint & 0xff;
-      Wire.write(dataBuffer,4);
+    case 0x02:
+      ControlFilterSet(data,count);
+      break;
+    }
+    break;
+  }
+}
+
+//
+// ControlLoop() - execute everything that has been queued up by the
+//    ISR. Called from the main loop.
+//
+void ControlLoop(void)
+{
+  Command *command;
+
+  while(queueTail != queueHead) {
+    if(queue[queueTail] == COMMAND_SKIP) {
+      queueTail = 0;
+      continue;
+    }
+    command = (Command *)&queue[queueTail];
+    ControlExecute(command);
+    queueTail = (queueTail + COMMAND_SIZE(command->count)) & (COMMAND_QUEUE_BYTES-1);
+    shadowStale = true;
+  }
+}
+
+//
+// putLong()/putInt() - put the given value in the buffer big-endian,
+//    returning the number of bytes used.
+//
+int putLong(byte *buffer, unsigned long value)
+{
+  buffer[0] = (byte)((value >> 24) & 0xff);
+  buffer[1] = (byte)((value >> 16) & 0xff);
+  buffer[2] = (byte)((value >> 8) & 0xff);
+  buffer[3] = (byte)(value & 0xff);
+  return(4);
+}
+
+int putInt(byte *buffer, unsigned int value)
+{
+  buffer[0] = (byte)((value >> 8) & 0xff);
+  buffer[1] = (byte)(value & 0xff);
+  return(2);
+}
+
+//
+// ControlLoopStats() - fill in the buffer with the main loop timing
+//    (see LoopStats in scheduler.h), returning the number of bytes
+//    used (31). All times are in micros, big-endian.
+//
+//      [0]      STATS_VERSION
+//      [1-4]    passes through the loop (wraps)
+//      [5-8]    total time of those passes (wraps)
+//      [9-10]   shortest pass (0xffff if over 65ms or none yet)
+//      [11-12]  longest pass (0xffff if over 65ms)
+//      [13-28]  histogram: < 128, < 512, < 2048, and >= 2048 (wraps)
+//      [29-30]  bytes of stack never used since the boot (see
+//               TaskStackFree())
+//
+//    This is called from the TWI ISR. The scheduler updates the
+//    statistics with interrupts off, so they all come from the same
+//    pass - they aren't in the shadow, where they would take up 31
+//    bytes in each copy.
+//
+int ControlLoopStats(byte *buffer)
+{
+  LoopStats *stats = TaskLoopStats();
+  int count = 0;
+  int i;
+
+  buffer[count++] = STATS_VERSION;
+  count += putLong(&buffer[count],stats->passes);
+  count += putLong(&buffer[count],stats->total);
+  count += putInt(&buffer[count],(stats->shortest > 0xffffUL)?0xffff:stats->shortest);
+  count += putInt(&buffer[count],(stats->longest > 0xffffUL)?0xffff:stats->longest);
+  for(i=0; i < LOOP_HISTOGRAM; i++) {
+    count += putLong(&buffer[count],stats->histogram[i]);
+  }
+  count += putInt(&buffer[count],TaskStackFree());
+
+  return(count);
+}
+
+//
+// ControlTaskStats() - fill in the buffer with the cumulative time
+//    spent in each task (in the order they were added in setup())
+//    returning the number of bytes used. Tasks that don't fit are
+//    left out.
+//
+//      [0]      number of tasks in this frame
+//      then for each task - cumulative micros (4, wraps)
+//
+int ControlTaskStats(byte *buffer, int size)
+{
+  int count = 1;
+  int i;
+
+  for(i=0; i < TaskCount() && count + 4 <= size; i++) {
+    count += putLong(&buffer[count],TaskGet(i)->total);
+  }
+  buffer[0] = i;
+
+  return(count);
+}
+
+//
+// ControlTaskWorst() - like ControlTaskStats() but with the worst
+//    single run of each task and how many runs started late.
+//
+//      [0]      number of tasks in this frame
+//      then for each task - worst run in micros (2, 0xffff if over 65ms)
+//                           late runs (2, wraps)
+//
+int ControlTaskWorst(byte *buffer, int size)
+{
+  Task *task;
+  int count = 1;
+  int i;
+
+  for(i=0; i < TaskCount() && count + 4 <= size; i++) {
+    task = TaskGet(i);
+    count += putInt(&buffer[count],task->worst);
+    count += putInt(&buffer[count],task->late);
+  }
+  buffer[0] = i;
+
+  return(count);
+}
+
+//
+// ControlQueueStats() - fill in the buffer with the command queue
+//    statistics, returning the number of bytes used (10).
+//
+//      [0]      bytes of the queue in use right now (of
+//               COMMAND_QUEUE_BYTES - a Command is 3 plus its data)
+//      [1]      the most that have been in use
+//      [2-5]    commands queued (wraps)
+//      [6-9]    commands dropped because the queue was full
+//
+//    This is called from the TWI ISR, so interrupts are left as they
+//    were (not turned on) - turning them on would let the TWI interrupt,
+//    still pending, run the handler again inside itself.
+//
+int ControlQueueStats(byte *buffer)
+{
+  int count = 0;
+  uint8_t sreg = SREG;
+
+  cli();
+  buffer[count++] = QUEUE_DEPTH();
+  buffer[count++] = queueDepthMax;
+  count += putLong(&buffer[count],queueCommands);
+  count += putLong(&buffer[count],queueOverflows);
+  SREG = sreg;
+
+  return(count);
+}
+
+//
+// ControlEvents() - fill in the buffer with the events after the
+//    cursor (see events.cpp) - as many as fit - and move the cursor
+//    past them. Returns the number of bytes used.
+//
+//      [0]      sequence number of the newest event (if it isn't the
+//               last one in this frame, there are more to read)
+//      [1]      number of events in this frame
+//      [2-5]    millis now
+//      then for each event - sequence number
+//                            kind (high nibble), device (low nibble)
+//                            value (2)
+//                            millis ago that it happened (2, 0xffff if
+//                              over 65 seconds)
+//
+int ControlEvents(byte *buffer, int size)
+{
+  Event *event;
+  byte seq;
+  unsigned long now = millis();
+  unsigned long age;
+  int count = 6;
+  int events = 0;
+
+  buffer[0] = EventNewest();
+  putLong(&buffer[2],now);
+
+  while(count + 6 <= size && (event = EventNext(&seq)) != NULL) {
+    age = now - event->time;
+    buffer[count++] = seq;
+    buffer[count++] = event->source;
+    count += putInt(&buffer[count],event->value);
+    count += putInt(&buffer[count],(age > 0xffffUL)?0xffff:age);
+    events++;
+  }
+  buffer[1] = events;
+
+  return(count);
+}
+
+//
+// ControlFilter() - fill in the buffer with the settings of the filter
+//    for filterChannel (see filter.h), returning the number of bytes
+//    used (8).
+//
+//      [0]      channel (0xff if there is no such filter)
+//      [1]      oversample - 4^n conversions per sample
+//      [2]      median of this many samples
+//      [3]      average - over 2^n samples
+//      [4-7]    micros between samples
+//
+int ControlFilter(byte *buffer)
+{
+  FilterBase *filter = controlFilter(filterChannel);
+  FilterSettings set;
+  int count = 0;
+
+  if(filter == NULL) {
+    memset(&set,0,sizeof(set));
+    buffer[count++] = 0xff;
+  } else {
+    filter->settings(&set);
+    buffer[count++] = filterChannel;
+  }
+  buffer[count++] = set.oversample;
+  buffer[count++] = set.median;
+  buffer[count++] = set.average;
+  count += putLong(&buffer[count],set.period);
+
+  return(count);
+}
+
+//
+// shadowLayout() - work out where everything is in the shadow, for the
+//    devices that ControlSetup() was given.
+//
+static void shadowLayout(void)
+{
+  int at = 6;
+
+  shadowCounts[0] = constrain(valveCount,0,CONFIG_VALVES);
+  shadowCounts[1] = constrain(thermCount,0,CONFIG_THERMS);
+  shadowCounts[2] = constrain(heaterCount,0,CONFIG_HEATERS);
+  shadowCounts[3] = constrain(pumpCount,0,SHADOW_OTHERS);
+  shadowCounts[4] = constrain(lightCount,0,SHADOW_OTHERS);
+
+  shadowValves = at;		at += shadowCounts[0] * 4;
+  shadowTherms = at;		at += shadowCounts[1] * 2;
+  shadowHeaters = at;		at += shadowCounts[2] * 4;
+  shadowPumps = at;		at += shadowCounts[3];
+  shadowLights = at;		at += shadowCounts[4];
+  snapshotLength = at;
+  shadowValveConfig = at;	at += shadowCounts[0] * 8;
+  shadowHeaterControl = at;
+}
+
+//
+// ControlPublish() - fill in the shadow copy that the ISR isn't using,
+//    and then have it use that one. Called at the end of each pass of
+//    the main loop - it is only done every SHADOW_PERIOD, or right
+//    away after ControlLoop() has carried out commands, so a read
+//    right after a write sees what it did.
+//
+//    The snapshot at the start of it is the state of the whole system
+//    - the same as the individual status registers, but in one read:
+//
+//      [0]    SNAPSHOT_VERSION
+//      [1-5]  count of valves, thermometers, heaters, pumps, lights
+//             that are in this frame
+//      then, for each valve - state, prev, position hi, position lo
+//            for each therm - average temp hi, lo (tenths of degrees)
+//            for each heater - enabled, active, set point hi, lo
+//            for each pump - speed
+//            for each light - on/off
+//
+void ControlPublish(void)
+{
+  byte *buffer;
+  int i;
+
+  if(!shadowStale && micros() - shadowTime < SHADOW_PERIOD) {
+    return;
+  }
+  shadowTime = micros();
+  shadowStale = false;
+
+  buffer = shadow[shadowActive ^ 1];
+
+  buffer[0] = SNAPSHOT_VERSION;
+  memcpy(&buffer[1],shadowCounts,5);
+
+  for(i=0; i < shadowCounts[0]; i++) {
+    valves[i].status(&buffer[shadowValves + i*4]);
+    valves[i].travelTime(&buffer[shadowValveConfig + i*8]);
+    valves[i].degreesGet(0,&buffer[shadowValveConfig + i*8 + 4]);
+    valves[i].degreesGet(1,&buffer[shadowValveConfig + i*8 + 6]);
+  }
+
+  for(i=0; i < shadowCounts[1]; i++) {
+    therms[i].readI2C(&buffer[shadowTherms + i*2]);
+  }
+
+  for(i=0; i < shadowCounts[2]; i++) {
+    buffer[shadowHeaters + i*4] = heaters[i].enabled;
+    buffer[shadowHeaters + i*4 + 1] = heaters[i].active;
+    buffer[shadowHeaters + i*4 + 2] = heaters[i].setPoint >> 8;
+    buffer[shadowHeaters + i*4 + 3] = heaters[i].setPoint & 0xff;
+    heaters[i].controlI2C(&buffer[shadowHeaterControl + i*16]);
+  }
+
+  for(i=0; i < shadowCounts[3]; i++) {
+    buffer[shadowPumps + i] = pumps[i].status;
+  }
+
+  for(i=0; i < shadowCounts[4]; i++) {
+    buffer[shadowLights + i] = lights[i].status;
+  }
+
+  shadowActive ^= 1;
+}
+
+//
+// shadowFind() - where the given register for the given device is in
+//    the shadow, and its length - or -1 if it isn't there (which any
+//    write register isn't, even though it decodes like a read).
+//
+static int shadowFind(byte reg, int index, int *length)
+{
+  int arg = (reg >> 2) & 0x03;
+
+  if(reg & 0x10) {
+    return(-1);
+  }
+
+  switch((reg >> 5) & 0x07) {
+  case 0b000:
+    if(index >= shadowCounts[0]) {
       break;
+    }
+    *length = (arg < 0x02)?4:2;
+    switch(arg) {
+    case 0x00:  return(shadowValves + index*4);
+    case 0x01:  return(shadowValveConfig + index*8);
+    case 0x02:  return(shadowValveConfig + index*8 + 4);	// min
+    case 0x03:  return(shadowValveConfig + index*8 + 6);	// max
+    }
+    break;
 
-    // read light status
-    case 0b110:
-      dataBuffer[0] = lights[target].status;
-      Wire.write(dataBuffer,1);
+  case 0b011:
+    *length = 1;
+    return((index < shadowCounts[3])?shadowPumps + index:-1);
+
+  case 0b100:
+    *length = 2;
+    return((index < shadowCounts[1])?shadowTherms + index*2:-1);
+
+  case 0b101:
+    if(index >= shadowCounts[2]) {
       break;
+    }
+    if(arg == 0b11) {
+      *length = 16;
+      return(shadowHeaterControl + index*16);
+    }
+    *length = 4;
+    return(shadowHeaters + index*4);
+
+  case 0b110:
+    *length = 1;
+    return((index < shadowCounts[4])?shadowLights + index:-1);
+
+  case 0b111:
+    switch(reg & 0x0f) {
+    case 0x00:
+      *length = snapshotLength;
+      return(0);
+    }
+    break;
+  }
+  return(-1);
+}
+
+//
+// deviceRead() - fill in the buffer with the given register of a device
+//    that isn't in the shadow, straight from the device (see the note
+//    at the shadow). Returns the length - 0 if it isn't a device
+//    register. The buffer needs room for 16 bytes.
+//
+static int deviceRead(byte reg, int index, byte *buffer)
+{
+  int arg = (reg >> 2) & 0x03;
+
+  if(reg & 0x10) {
+    return(0);				// a write register
+  }
+
+  switch((reg >> 5) & 0x07) {
+  case 0b000:
+    if(arg == 0x00) {
+      valves[index].status(buffer);
+      return(4);
+    }
+    if(arg == 0x01) {
+      valves[index].travelTime(buffer);
+      return(4);
+    }
+    valves[index].degreesGet(arg & 0x01,buffer);	// min (0x02) or max (0x03)
+    return(2);
+
+  case 0b011:
+    buffer[0] = pumps[index].status;
+    return(1);
+
+  case 0b100:
+    therms[index].readI2C(buffer);
+    return(2);
+
+  case 0b101:
+    if(arg == 0b11) {
+      heaters[index].controlI2C(buffer);
+      return(16);
+    }
+    buffer[0] = heaters[index].enabled;
+    buffer[1] = heaters[index].active;
+    buffer[2] = heaters[index].setPoint >> 8;
+    buffer[3] = heaters[index].setPoint & 0xff;
+    return(4);
+
+  case 0b110:
+    buffer[0] = lights[index].status;
+    return(1);
+  }
+  return(0);
+}
+
+//
+// ControlGather() - fill in the buffer with the registers in the gather
+//    list, one after the other, returning the number of bytes used.
+//    Only the registers in the shadow (see shadowFind()) and the other
+//    device registers (see deviceRead()) can be read this way.
+//
+//      [0]      number of bytes that follow
+//      then each register, as it would be read on its own
+//
+//    The frame ends before the first register that isn't there - a
+//    write register is never there - or won't fit.
+//
+int ControlGather(byte *buffer, int size)
+{
+  byte device[16];
+  byte *from;
+  int count = 1;
+  int offset;
+  int length;
+  int i;
 
+  for(i=0; i < gatherCount; i++) {
+    if((offset = shadowFind(gather[i].reg,gather[i].index,&length)) >= 0) {
+      from = &shadow[shadowActive][offset];
+    } else if(controlTarget(gather[i].reg,gather[i].index) &&
+	      (length = deviceRead(gather[i].reg,gather[i].index,device)) > 0) {
+      from = device;
+    } else {
+      break;
+    }
+    if(count + length > size) {
+      break;
     }
+    memcpy(&buffer[count],from,length);
+    count += length;
+  }
+  buffer[0] = count - 1;
+
+  return(count);
+}
+
+//
+// ControlDiscovery() - fill in the buffer with what this firmware is
+//    and what it is hooked up to, so the controller can set itself up
+//    with one read. Returns the number of bytes used (10).
+//
+//      [0]      DISCOVERY_VERSION
+//      [1-2]    firmware version - major, minor (see control.h)
+//      [3-7]    count of valves, thermometers, heaters, pumps, lights
+//      [8-9]    the features it has (CONTROL_FEATURE_*, see control.h)
+//
+int ControlDiscovery(byte *buffer)
+{
+  int count = 0;
+
+  buffer[count++] = DISCOVERY_VERSION;
+  buffer[count++] = FIRMWARE_MAJOR;
+  buffer[count++] = FIRMWARE_MINOR;
+  buffer[count++] = valveCount;
+  buffer[count++] = thermCount;
+  buffer[count++] = heaterCount;
+  buffer[count++] = pumpCount;
+  buffer[count++] = lightCount;
+  count += putInt(&buffer[count],CONTROL_FEATURES);
+
+  return(count);
+}
+
+//
+// ControlRegisterRead() - this is a request to read a particular
+//   "register". The register identifier was given in the previous
+//   write, and is now in "targetRegister".
+//
+//   Most registers are just copied out of the shadow (see
+//   ControlPublish()). The rest are ones that are read once in a while
+//   (statistics), move a cursor along (events, history), or are for a
+//   device the shadow has no room for (see deviceRead()).
+//
+void ControlRegisterRead()
+{
+  int isWrite;
+  int offset;
+  int length;
+  byte frame[BUFFER_LENGTH];	// system registers are as big as Wire allows
+  
+  isWrite = (targetRegister >> 4) & 0x01;
+
+  if(isWrite || !controlTarget(targetRegister,targetIndex)) {
+    return;
   }
 
+  if((offset = shadowFind(targetRegister,targetIndex,&length)) >= 0) {
+    Wire.write(&shadow[shadowActive][offset],length);
+    return;
+  }
+  if((length = deviceRead(targetRegister,targetIndex,frame)) > 0) {
+    Wire.write(frame,length);
+    return;
+  }
+
+  switch((targetRegister >> 5) & 0x07) {
+
+#ifdef VALVE_PROFILE
+    // read valve state dwell times
+  case 0b001:
+    Wire.write(frame,valves[targetIndex].dwellGet((targetRegister >> 2) & 0x03,frame));
+    break;
+#endif
+
+    // system registers - arg and target together pick the register
+  case 0b111:
+    switch(targetRegister & 0x0f) {
+    case 0x01:
+      Wire.write(frame,ControlLoopStats(frame));
+      break;
+
+    case 0x02:
+      Wire.write(frame,ControlTaskStats(frame,sizeof(frame)));
+      break;
+
+    case 0x03:
+      Wire.write(frame,ControlQueueStats(frame));
+      break;
+
+    case 0x04:
+      Wire.write(frame,ControlTaskWorst(frame,sizeof(frame)));
+      break;
+
+    case EVENTS_REGISTER & 0x0f:
+      Wire.write(frame,ControlEvents(frame,sizeof(frame)));
+      break;
+
+    case FILTER_REGISTER & 0x0f:
+      Wire.write(frame,ControlFilter(frame));
+      break;
+
+    case HISTORY_REGISTER & 0x0f:
+      Wire.write(frame,HistoryFrame(frame,sizeof(frame)));
+      break;
+
+    case DISCOVERY_REGISTER & 0x0f:
+      Wire.write(frame,ControlDiscovery(frame));
+      break;
+
+    case BATCH_STATUS_REGISTER & 0x0f:
+      frame[0] = batchSeq;
+      frame[1] = batchStatus;
+      Wire.write(frame,2);
+      break;
+
+    case GATHER_REGISTER & 0x0f:
+      Wire.write(frame,ControlGather(frame,sizeof(frame)));
+      break;
+
+    case TRACE_REGISTER & 0x0f:
+      Wire.write(frame,TraceFrame(frame,sizeof(frame)));
+      break;
+    }
+    break;
+  }
 }
 
 
@@ -321,34 +1354,27 @@ void ControlSetup(Valve *valve, int vCount ,
 
   lights = light;
   lightCount = lCount;
+
+  shadowLayout();
+  ControlPublish();
   
   Wire.begin(SLAVE_ADDR);
   Wire.onReceive(ControlRegisterWrite);
   Wire.onRequest(ControlRegisterRead);
 
-  Serial.println("control up dude");
+  TRACE_INFO(TRACE_BOOT,0,(FIRMWARE_MAJOR << 8) | FIRMWARE_MINOR);
 }
 
 void (*ResetFunction)(void) = 0;	// simple function to software reboot
 
 void FactoryReset()
 {
-  int i;
+  // the valves, thermometers, and heaters go back to their defaults
+  //   when the config image is bad (pumps and lights have no config)
 
-  // only call factory reset for those using EEPROM
-  
-  for(i=0; i < valveCount; i++) {	// travel limits, position, travel times
-    valves[i].factoryReset();
-  }
-
-  for(i=0; i < thermCount; i++) {	// coefficients for thermocouple
-    therms[i].factoryReset();
-  }
-
-  for(i=0; i < heaterCount; i++) {	// set point
-    heaters[i].factoryReset();
-  }
+  ConfigErase();
 
+  EEPROMFlush();			// the write queue doesn't survive a reset
   ResetFunction();
 }
 
@@ -13,6 +13,44 @@ extern void ControlSetup(Valve *, int ,
 			 Pump *, int,
 			 Light *, int);
 
+extern void ControlLoop(void);
+extern void ControlPublish(void);
+
 extern void FactoryReset(void);
 
 #define SLAVE_ADDR	0x20
+
+// what the discovery register reports (see ControlDiscovery()) - bump
+//   the version when the registers change, and add a feature bit when
+//   one is added
+
+#define FIRMWARE_MAJOR	1
+#define FIRMWARE_MINOR	0
+
+#define CONTROL_FEATURE_EXTENDED	0x0001	// extended addressing
+#define CONTROL_FEATURE_SNAPSHOT	0x0002	// system snapshot
+#define CONTROL_FEATURE_STATS		0x0004	// loop, task and queue statistics
+#define CONTROL_FEATURE_EVENTS		0x0008	// event log
+#define CONTROL_FEATURE_FILTERS		0x0010	// sensor filter settings
+#define CONTROL_FEATURE_HISTORY		0x0020	// temperature history
+#define CONTROL_FEATURE_VERIFY		0x0040	// quick valve verify
+#define CONTROL_FEATURE_DWELL		0x0080	// valve state dwell times
+#define CONTROL_FEATURE_PID		0x0100	// heater PID and autotune
+#define CONTROL_FEATURE_BATCH		0x0200	// batched writes with CRC
+#define CONTROL_FEATURE_GATHER		0x0400	// reading a list of registers
+#define CONTROL_FEATURE_TRACE		0x0800	// trace over I2C
+
+// the dwell times are only there in a VALVE_PROFILE build (see valve.h)
+
+#ifdef VALVE_PROFILE
+#define CONTROL_FEATURE_PROFILE		CONTROL_FEATURE_DWELL
+#else
+#define CONTROL_FEATURE_PROFILE		0
+#endif
+
+#define CONTROL_FEATURES	(CONTROL_FEATURE_EXTENDED | CONTROL_FEATURE_SNAPSHOT | \
+				 CONTROL_FEATURE_STATS | CONTROL_FEATURE_EVENTS | \
+				 CONTROL_FEATURE_FILTERS | CONTROL_FEATURE_HISTORY | \
+				 CONTROL_FEATURE_VERIFY | CONTROL_FEATURE_PROFILE | \
+				 CONTROL_FEATURE_PID | CONTROL_FEATURE_BATCH | \
+				 CONTROL_FEATURE_GATHER | CONTROL_FEATURE_TRACE)
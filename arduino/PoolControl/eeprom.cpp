@@ -1,75 +1,361 @@
 //
 // eeprom.cpp
 //
-//   Implements the basic eeprom functions that all resources use.
+//   Implements the EEPROM write queue that everything writes through
+//   (config images and the logs).
+//
+//   Also implements EEPROM_RING - a wear-leveled log for values that
+//   are written often.
+//
+//   Nothing here writes the EEPROM directly. A byte write takes about
+//   3.3ms on the Nano, and EEPROM.put() waits for each one to finish,
+//   so a config change used to stall the main loop for tens of ms.
+//   Instead, writes go into a small queue of pending bytes that is
+//   drained one byte at a time from the EEPROM-ready interrupt:
+//
+//    - a byte that is written again while it is still pending just
+//      gets its new value (it keeps its place in line), so a burst of
+//      writes to the same spot - like the "has been set" marker -
+//      costs one write.
+//    - when a byte comes up, it is only written if it is different
+//      from what is already in the EEPROM.
+//    - reads look in the queue first, so they always see the newest
+//      value.
+//
+//   EEPROMFlush() waits until everything is written - use it before
+//   anything that would lose the queue (like a reset).
 //
 #include "eeprom.h"
 
-EEPROM_CONTROL::EEPROM_CONTROL(int addr)
+static int pendingAddr[EEPROM_PENDING];
+static byte pendingValue[EEPROM_PENDING];
+static volatile byte pendingHead;	// where the next byte is queued
+static volatile byte pendingTail;	// the next byte to be written
+
+static void eepromStart(int,byte);
+static void eepromKick(void);
+static int eepromReady(void);
+
+//
+// pendingFind() - returns the queue spot of the given address, or -1
+//    if it isn't pending. Call with interrupts off.
+//
+static int pendingFind(int addr)
 {
-  myAddress = addr;
+  byte i;
+
+  for(i=pendingTail; i != pendingHead; i = (i + 1) % EEPROM_PENDING) {
+    if(pendingAddr[i] == addr) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+//
+// eepromNext() - the EEPROM can take another write. Start the next
+//    pending byte that actually changes something. Returns false once
+//    there is nothing left to write. This runs in the EEPROM-ready ISR.
+//
+static int eepromNext(void)
+{
+  int addr;
+  byte value;
+
+  while(pendingTail != pendingHead) {
+    addr = pendingAddr[pendingTail];
+    value = pendingValue[pendingTail];
+    pendingTail = (pendingTail + 1) % EEPROM_PENDING;
+
+    if(EEPROM.read(addr) != value) {
+      eepromStart(addr,value);
+      return(true);
+    }
+  }
+  return(false);
+}
+
+#ifdef __AVR__
+
+ISR(EE_READY_vect)
+{
+  if(!eepromNext()) {
+    EECR &= ~_BV(EERIE);		// nothing left, stop the interrupt
+  }
+}
+
+//
+// eepromStart() - start writing a byte. Only called when the EEPROM is
+//    ready, so this doesn't wait.
+//
+static void eepromStart(int addr, byte value)
+{
+  eeprom_write_byte((uint8_t *)addr,value);
+}
+
+//
+// eepromKick() - make sure the queue is draining. The ready interrupt
+//    fires as soon as it is enabled if the EEPROM isn't busy.
+//
+static void eepromKick(void)
+{
+  EECR |= _BV(EERIE);
+}
+
+//
+// eepromReady() - true if no write is underway, so a read won't wait.
+//
+static int eepromReady(void)
+{
+  return(eeprom_is_ready());
+}
+
+#else
+
+static void eepromStart(int addr, byte value)
+{
+  EEPROM.write(addr,value);
+}
+
+//
+// eepromKick() - (host build) there is no EEPROM-ready interrupt and
+//    writes take no time, so the queue is drained right away.
+//
+static void eepromKick(void)
+{
+  while(eepromNext()) {
+  }
+}
+
+static int eepromReady(void)
+{
+  return(true);
 }
 
-void EEPROM_CONTROL::factoryReset()
+#endif
+
+//
+// EEPROMCacheWrite() - queue a byte to be written. This only waits if
+//    the queue is full, in which case it waits for one spot to drain.
+//    Don't call it from an ISR.
+//
+void EEPROMCacheWrite(int addr, byte value)
 {
-  EEPROM.write(myAddress,(byte)255);
+  int spot;
+
+  for(;;) {
+    noInterrupts();
+    spot = pendingFind(addr);
+    if(spot != -1) {
+      pendingValue[spot] = value;
+      break;
+    }
+    if((pendingHead + 1) % EEPROM_PENDING != pendingTail) {
+      pendingAddr[pendingHead] = addr;
+      pendingValue[pendingHead] = value;
+      pendingHead = (pendingHead + 1) % EEPROM_PENDING;
+      break;
+    }
+    interrupts();
+    eepromKick();
+  }
+  interrupts();
+
+  eepromKick();
 }
 
 //
-// eepromHasBeenSet() - returns true/false depending upon whether the eeprom
-//    as been written for this object (if the first byte is 255). Note that this
-//    is how factoryReset is accomplished - that byte is changed to 255.
+// EEPROMCacheRead() - read a byte, seeing any write that is pending.
+//    The read itself is done with interrupts off once the EEPROM is
+//    ready - otherwise the ready ISR could start the next write between
+//    the check and the read, and EEPROM.read() would then sit out the
+//    whole write (or race it for the address register). Waits at most
+//    for the write that is underway.
 //
-int EEPROM_CONTROL::eepromHasBeenSet()
+byte EEPROMCacheRead(int addr)
 {
-  return(EEPROM.read(myAddress) != (byte)255);
+  int spot;
+  byte value;
+
+  for(;;) {
+    noInterrupts();
+    spot = pendingFind(addr);
+    if(spot != -1) {
+      value = pendingValue[spot];
+      break;
+    }
+    if(eepromReady()) {
+      value = EEPROM.read(addr);
+      break;
+    }
+    interrupts();
+  }
+  interrupts();
+
+  return(value);
 }
 
-int EEPROM_CONTROL::eepromWrite(int offset,byte value)
+//
+// EEPROMCachePeek() - for an ISR (or with interrupts off): like
+//    EEPROMCacheRead(), but rather than wait out a write that is
+//    underway it returns false.
+//
+int EEPROMCachePeek(int addr, byte *value)
 {
-  EEPROM.put(myAddress,(byte)1);
-  EEPROM.put(myAddress+1+offset,value);
-  return(sizeof(value));
+  int spot = pendingFind(addr);
+
+  if(spot != -1) {
+    *value = pendingValue[spot];
+    return(true);
+  }
+  if(!eepromReady()) {
+    return(false);
+  }
+  *value = EEPROM.read(addr);
+  return(true);
 }
 
-int EEPROM_CONTROL::eepromWrite(int offset,int value)
+//
+// EEPROMFlush() - wait until every pending byte has been written.
+//
+void EEPROMFlush(void)
 {
-  EEPROM.put(myAddress,(byte)1);
-  EEPROM.put(myAddress+1+offset,value);
-  return(sizeof(value));
+  eepromKick();
+
+#ifdef __AVR__
+  while(pendingTail != pendingHead || (EECR & _BV(EEPE))) {
+  }
+#endif
 }
 
-int EEPROM_CONTROL::eepromWrite(int offset,float value)
+//
+// EEPROMPending() - number of bytes waiting to be written.
+//
+int EEPROMPending(void)
 {
-  EEPROM.put(myAddress,(byte)1);
-  EEPROM.put(myAddress+1+offset,value);
-  return(sizeof(value));
+  int count;
+
+  noInterrupts();
+  count = (pendingHead + EEPROM_PENDING - pendingTail) % EEPROM_PENDING;
+  interrupts();
+
+  return(count);
 }
 
-int EEPROM_CONTROL::eepromWrite(int offset,unsigned long value)
+//
+// EEPROMBusy() - true if there are bytes pending or one is being
+//    written. While this is false, EEPROMCacheRead() doesn't wait.
+//
+int EEPROMBusy(void)
 {
-  EEPROM.put(myAddress,(byte)1);
-  EEPROM.put(myAddress+1+offset,value);
-  return(sizeof(value));
+#ifdef __AVR__
+  if(EECR & _BV(EEPE)) {
+    return(true);
+  }
+#endif
+  return(EEPROMPending() != 0);
 }
 
-int EEPROM_CONTROL::eepromRead(int offset, byte *retValue)
+//
+// EEPROM_RING() - (constructor) a ring of the given number of records
+//    starting at the given address. Each record is EEPROM_RING_RECORD
+//    bytes:
+//
+//      [0] sequence number - one more than the record before it
+//      [1] value hi
+//      [2] value lo
+//      [3] check - so that erased or half-written records are ignored
+//
+//    Writes go to the record after the newest one. On start-up, the
+//    newest record is the valid one whose next record is NOT the next
+//    sequence number - there is always such a break in the ring since
+//    the record after the newest is one that is a full lap older (or
+//    is erased/invalid). The sequence number is a byte, so there can
+//    be at most 255 records.
+//
+EEPROM_RING::EEPROM_RING(int addr, int count)
 {
-  EEPROM.get(myAddress+1+offset,*retValue);
-  return(sizeof(*retValue));
+  myAddress = addr;
+  records = count;
+  find();
 }
-int EEPROM_CONTROL::eepromRead(int offset, int *retValue)
+
+#define RING_CHECK(seq,hi,lo)	((byte)~((seq) ^ (hi) ^ (lo) ^ 0x5a))
+
+//
+// recordValid() - returns true if the given record passes its check,
+//    filling in the sequence and value.
+//
+int EEPROM_RING::recordValid(int record, byte *seq, int *value)
 {
-  EEPROM.get(myAddress+1+offset,*retValue);
-  return(sizeof(*retValue));
+  int addr = myAddress + record * EEPROM_RING_RECORD;
+  byte hi, lo;
+
+  *seq = EEPROMCacheRead(addr);
+  hi = EEPROMCacheRead(addr+1);
+  lo = EEPROMCacheRead(addr+2);
+  *value = (int)(short)((hi << 8) | lo);
+
+  return(EEPROMCacheRead(addr+3) == RING_CHECK(*seq,hi,lo));
 }
-int EEPROM_CONTROL::eepromRead(int offset, float *retValue)
+
+//
+// find() - scan the ring for the newest record
+//
+void EEPROM_RING::find(void)
 {
-  EEPROM.get(myAddress+1+offset,*retValue);
-  return(sizeof(*retValue));
+  int i;
+  int value;
+  byte seq, nextSeq;
+  int valid, nextValid;
+
+  newest = -1;
+  sequence = 0;
+
+  valid = recordValid(0,&seq,&value);
+  for(i=0; i < records; i++) {
+    nextValid = recordValid((i+1) % records,&nextSeq,&value);
+    if(valid && (!nextValid || nextSeq != (byte)(seq+1))) {
+      newest = i;
+      sequence = seq;
+      break;
+    }
+    valid = nextValid;
+    seq = nextSeq;
+  }
 }
-int EEPROM_CONTROL::eepromRead(int offset, unsigned long *retValue)
+
+//
+// read() - get the newest value in the ring. Returns false (and leaves
+//    value alone) if the ring has never been written.
+//
+int EEPROM_RING::read(int *value)
 {
-  EEPROM.get(myAddress+1+offset,*retValue);
-  return(sizeof(*retValue));
+  byte seq;
+
+  if(newest == -1) {
+    return(false);
+  }
+  return(recordValid(newest,&seq,value));
+}
+
+//
+// write() - write the value as the next record. The check byte goes
+//    last so that a record is only valid once it is all there (the
+//    write queue keeps the order).
+//
+void EEPROM_RING::write(int value)
+{
+  int addr;
+  byte hi = (byte)((value >> 8) & 0xff);
+  byte lo = (byte)(value & 0xff);
+
+  newest = (newest + 1) % records;
+  sequence++;
+
+  addr = myAddress + newest * EEPROM_RING_RECORD;
+  EEPROMCacheWrite(addr,sequence);
+  EEPROMCacheWrite(addr+1,hi);
+  EEPROMCacheWrite(addr+2,lo);
+  EEPROMCacheWrite(addr+3,RING_CHECK(sequence,hi,lo));
 }
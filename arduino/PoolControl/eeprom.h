@@ -10,28 +10,43 @@
 #include <Arduino.h>
 #include <EEPROM.h>
 
-class EEPROM_CONTROL {
-public:
-  void factoryReset(void);
+// EEPROM writes are queued and drained in the background (see
+//   eeprom.cpp). The queue holds this many bytes that are waiting to
+//   be written - a byte that is written again while it is still
+//   waiting doesn't take another spot.
+
+#define EEPROM_PENDING	32
+
+extern void EEPROMCacheWrite(int,byte);
+extern byte EEPROMCacheRead(int);
+extern int EEPROMCachePeek(int,byte *);
+extern void EEPROMFlush(void);
+extern int EEPROMPending(void);
+extern int EEPROMBusy(void);
 
+//
+// EEPROM_RING - a wear-leveled log of a single int value. Each write
+//   goes to the next record in a ring of records, so no one cell gets
+//   all of the writes. (see eeprom.cpp)
+//
 
-protected:
-  int myAddress;	// my eeprom address that is used as the base for
-                        //   storage for all parameters.
+#define EEPROM_RING_RECORD	4	// bytes per record
 
-  EEPROM_CONTROL(int);
+class EEPROM_RING {
+public:
+  EEPROM_RING(int,int);
 
-  int eepromHasBeenSet(void);
+  int read(int *);		// newest value - returns false if there is none
+  void write(int);
 
-  int eepromWrite(int,int);
-  int eepromWrite(int,byte);
-  int eepromWrite(int,float);
-  int eepromWrite(int,unsigned long);
+private:
+  int myAddress;	// start of the ring
+  int records;		// number of records in the ring
+  int newest;		// record number of the newest record (-1 if none)
+  byte sequence;	// sequence number of the newest record
 
-  int eepromRead(int,int*);
-  int eepromRead(int,byte*);
-  int eepromRead(int,float*);
-  int eepromRead(int,unsigned long *);
+  int recordValid(int,byte *,int *);
+  void find(void);
 };
 
 
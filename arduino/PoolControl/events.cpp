@@ -0,0 +1,105 @@
+//
+// events.cpp
+//
+//   The event log - a ring of the last EVENT_LOG_SIZE things that
+//   happened (valves changing state, the heater going on and off, and
+//   so on) so that the controller can find out about them without
+//   polling every device.
+//
+//   Each event gets a sequence number (a byte, one more than the last
+//   one). The controller reads the events after the last one it has
+//   seen, and the log keeps track of where that is - the "cursor".
+//   Reading moves the cursor along, and the controller can move it
+//   back (EventSeek()) if it lost a read. If the cursor falls so far
+//   behind that events have been overwritten, reading picks up at the
+//   oldest one left - the gap in sequence numbers shows what was lost.
+//
+//   If EVENT_ATTENTION_PIN is defined, that pin is pulled low while
+//   there are events after the cursor, and left floating otherwise
+//   (like an open-drain interrupt line) so the controller can watch
+//   it instead of polling.
+//
+//   Events are logged from the main loop and read from the TWI ISR.
+//
+
+#include "events.h"
+
+static Event events[EVENT_LOG_SIZE];
+static volatile byte newest;		// sequence of the newest event
+static volatile byte held;		// number of events in the ring
+static volatile byte cursor;		// sequence of the last event read
+
+#define EVENT_SLOT(seq)		((seq) & (EVENT_LOG_SIZE-1))
+
+//
+// eventAttention() - update the attention pin.
+//
+static void eventAttention(void)
+{
+#ifdef EVENT_ATTENTION_PIN
+  if(newest != cursor) {
+    digitalWrite(EVENT_ATTENTION_PIN,LOW);
+    pinMode(EVENT_ATTENTION_PIN,OUTPUT);
+  } else {
+    pinMode(EVENT_ATTENTION_PIN,INPUT);
+  }
+#endif
+}
+
+//
+// EventLog() - add an event, overwriting the oldest if the log is
+//    full. The time is taken now.
+//
+void EventLog(byte kind, byte device, int value)
+{
+  Event *event;
+
+  noInterrupts();
+  event = &events[EVENT_SLOT((byte)(newest + 1))];
+  event->source = (kind << 4) | (device & 0x0f);
+  event->value = value;
+  event->time = millis();
+  newest++;
+  if(held < EVENT_LOG_SIZE) {
+    held++;
+  }
+  eventAttention();
+  interrupts();
+}
+
+byte EventNewest(void)
+{
+  return(newest);
+}
+
+//
+// EventSeek() - have the next read start after the given sequence.
+//
+void EventSeek(byte seq)
+{
+  cursor = seq;
+  eventAttention();
+}
+
+//
+// EventNext() - returns the next unread event, filling in its sequence
+//    number, and moves the cursor past it. Returns NULL if there are no
+//    unread events.
+//
+Event *EventNext(byte *seq)
+{
+  byte unread = newest - cursor;
+
+  if(unread > held) {			// overwritten (or the cursor is
+    cursor = newest - held;		//   from before a reboot)
+  }
+  if(cursor == newest) {
+    return(NULL);
+  }
+
+  cursor++;
+  eventAttention();
+
+  *seq = cursor;
+  return(&events[EVENT_SLOT(cursor)]);
+}
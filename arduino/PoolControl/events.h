@@ -0,0 +1,41 @@
+//
+// events.h
+//
+//   (see events.cpp for information about the event log)
+//
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <Arduino.h>
+
+#define EVENT_LOG_SIZE		16	// events kept - a power of 2, up to 128
+					//   (7 bytes of RAM each). A calibration
+					//   logs about 20 states per valve, which
+					//   no size the RAM allows would hold -
+					//   the sequence numbers show what was
+					//   missed
+#define EVENT_ATTENTION_PIN	8	// held low while there are unread events
+					//   (comment out to not use a pin)
+
+// what an event is about - the device number and value depend on it
+
+enum EventKinds {
+  EVENT_VALVE = 1,		// valve [n] changed state - value is the new state
+  EVENT_HEATER = 2,		// heater [n] turned on (1) or off (0)
+  EVENT_PUMP = 3,		// pump [n] changed speed - value is the speed
+  EVENT_LIGHT = 4		// light [n] turned on (1) or off (0)
+};
+
+struct Event {
+  byte		source;		// kind (high nibble) and device number (low)
+  int		value;		// depends on the kind
+  unsigned long	time;		// millis when it happened
+};
+
+extern void EventLog(byte,byte,int);		// add an event (kind, device, value)
+extern byte EventNewest(void);			// sequence number of the newest event
+extern void EventSeek(byte);			// the next read starts after this sequence
+extern Event *EventNext(byte *);		// next unread event (and its sequence)
+
+#endif // EVENTS_H
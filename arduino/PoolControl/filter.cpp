@@ -0,0 +1,181 @@
+//
+// filter.cpp
+//
+//   Sensor filters - the thermometers and the valve current readings
+//   go through one of these. A filter owns an analog scanner slot (see
+//   analog.cpp) and runs each new sample through three stages, any of
+//   which can be turned off:
+//
+//     oversample - each sample is 4^n conversions, summed and shifted
+//                  down by n, for n more bits (done by the scanner)
+//     median     - the median of the last k samples, which throws out
+//                  the odd spike
+//     average    - an exponential moving average with a window of 2^n
+//                  samples - a shift and an add, no division
+//
+//   Values are kept in fixed point - 1/16ths of an ADC count - so the
+//   extra bits from oversampling and averaging aren't thrown away.
+//
+//   The filter only moves when a new sample comes in, and samples come
+//   in every "period" micros, so the window is a matter of time - not
+//   of how often update() is called (as long as that is at least once
+//   a period).
+//
+//   Filter<N> (filter.h) just adds the room for a median of N.
+//
+
+#include "filter.h"
+#include "analog.h"
+
+FilterBase::FilterBase(int pin, const FilterSettings *settings, unsigned int *storage, byte max)
+{
+  history = storage;
+  historyMax = max;
+  enabled = false;
+  analogSlot = AnalogChannel(pin,0UL);	// off until enabled
+  configure(settings);
+}
+
+//
+// restart() - forget everything - the next sample starts it all over.
+//
+void FilterBase::restart(void)
+{
+  AnalogLatest(analogSlot,&analogSequence);	// whatever is there is old
+  historyNext = 0;
+  historyCount = 0;
+  primed = false;
+}
+
+//
+// configure() - change the settings, bringing them into range. The
+//    median needs an odd count, so an even one is taken down by one.
+//
+void FilterBase::configure(const FilterSettings *settings)
+{
+  set = *settings;
+
+  if(set.oversample > FILTER_OVERSAMPLE_MAX) {
+    set.oversample = FILTER_OVERSAMPLE_MAX;
+  }
+  if(set.median > historyMax) {
+    set.median = historyMax;
+  }
+  if(set.median == 0) {
+    set.median = 1;
+  }
+  if(!(set.median & 1)) {
+    set.median--;
+  }
+  if(set.average > FILTER_AVERAGE_MAX) {
+    set.average = FILTER_AVERAGE_MAX;
+  }
+  if(set.period == 0) {
+    set.period = 1;
+  }
+
+  AnalogOversample(analogSlot,set.oversample);
+  if(enabled) {
+    AnalogRate(analogSlot,set.period);
+  }
+  restart();
+}
+
+void FilterBase::settings(FilterSettings *settings)
+{
+  *settings = set;
+}
+
+//
+// enable() - start (or stop) sampling. Starting again starts the
+//    filter over, since what it had is old by then.
+//
+void FilterBase::enable(int onoff)
+{
+  if(onoff == enabled) {
+    return;
+  }
+  enabled = onoff;
+  AnalogRate(analogSlot,enabled?set.period:0UL);
+  if(enabled) {
+    restart();
+  }
+}
+
+//
+// median() - the median of the samples in the history. There are only
+//    a few of them, so they are just copied and insertion sorted.
+//
+unsigned int FilterBase::median(void)
+{
+  unsigned int sorted[historyCount];
+  unsigned int value;
+  int i, j;
+
+  for(i=0; i < historyCount; i++) {
+    value = history[i];
+    for(j=i; j > 0 && sorted[j-1] > value; j--) {
+      sorted[j] = sorted[j-1];
+    }
+    sorted[j] = value;
+  }
+  return(sorted[historyCount / 2]);
+}
+
+//
+// update() - run a new sample (if there is one) through the stages.
+//    Returns true if there was one. A filter that didn't get an analog
+//    slot (the scanner was full) never has one.
+//
+int FilterBase::update(void)
+{
+  byte sequence;
+  unsigned int sample;
+
+  if(analogSlot < 0) {
+    return(false);
+  }
+  sample = AnalogLatest(analogSlot,&sequence);
+
+  if(sequence == analogSequence) {
+    return(false);
+  }
+  analogSequence = sequence;
+
+  sample <<= FILTER_FRACTION - set.oversample;
+
+  if(set.median > 1) {
+    history[historyNext] = sample;
+    if(++historyNext >= set.median) {
+      historyNext = 0;
+    }
+    if(historyCount < set.median) {
+      historyCount++;
+    }
+    sample = median();
+  }
+
+  if(!primed) {
+    total = (unsigned long)sample << set.average;
+    primed = true;
+  } else {
+    total = total - (total >> set.average) + sample;
+  }
+
+  return(true);
+}
+
+unsigned int FilterBase::value(void)
+{
+  return(total >> set.average);
+}
+
+int FilterBase::raw(void)
+{
+  return(AnalogLatest(analogSlot,NULL) >> set.oversample);
+}
+
+unsigned long FilterBase::period(void)
+{
+  return(set.period);
+}
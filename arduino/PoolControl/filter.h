@@ -0,0 +1,72 @@
+//
+// filter.h
+//
+//   (see filter.cpp for information about sensor filters)
+//
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <Arduino.h>
+
+#define FILTER_FRACTION		4	// filtered values are in 1/16ths of an ADC count
+#define FILTER_OVERSAMPLE_MAX	3	// up to 4^3 conversions per sample (13 bits)
+#define FILTER_AVERAGE_MAX	7	// up to a window of 2^7 samples
+
+// the settings of a filter - what can be changed over I2C
+
+struct FilterSettings {
+  byte		oversample;	// n - each sample is 4^n conversions (0 is off)
+  byte		median;		// median of this many samples (odd, 1 is off)
+  byte		average;	// n - average over a window of 2^n samples (0 is off)
+  unsigned long	period;		// micros between samples
+};
+
+class FilterBase {
+
+public:
+  void configure(const FilterSettings *);	// change (and clamp) the settings
+  void settings(FilterSettings *);		// get them
+  void enable(int);		// sample at the period (true) or not at all
+  int update(void);		// take in a new sample - true if there was one
+  unsigned int value(void);	// filtered value (1/16ths of an ADC count)
+  int raw(void);		// latest sample (ADC counts)
+  unsigned long period(void);
+
+protected:
+  FilterBase(int,const FilterSettings *,unsigned int *,byte);
+
+private:
+  int analogSlot;		// where the analog scanner puts the samples
+  byte analogSequence;		//   and the sequence of the last one used
+  int enabled;
+  FilterSettings set;
+
+  unsigned int *history;	// the last few samples (for the median)
+  byte historyMax;		//   room for this many
+  byte historyNext;		// where the next one goes
+  byte historyCount;		// how many are there
+
+  int primed;			// average has been started
+  unsigned long total;		// average times 2^set.average
+
+  void restart(void);
+  unsigned int median(void);
+};
+
+//
+// Filter<N> - a filter with room for a median of up to N samples. All
+//   of the work is in FilterBase, so every size shares the same code.
+//
+template <byte MEDIAN_MAX>
+class Filter : public FilterBase {
+
+public:
+  Filter(int pin, const FilterSettings *settings) :
+    FilterBase(pin,settings,storage,MEDIAN_MAX) {}
+
+private:
+  unsigned int storage[MEDIAN_MAX];
+};
+
+#endif // FILTER_H
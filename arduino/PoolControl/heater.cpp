@@ -5,10 +5,27 @@
 //   mode, and turning it on when the temp drops below the
 //   set point.
 //
+//   There are two ways of deciding when to heat (see HeaterModes):
+//
+//   - hysteresis - on when the temp is HOLD_OFF below the set point,
+//     and off when it is HOLD_OFF above. Simple, but the heat keeps
+//     coming from the heater (and the pipes) after it is off, so it
+//     overshoots, and then it cycles around the set point.
+//
+//   - PID - the output (0 - 100%) is the error, its integral, and how
+//     fast the temp is changing, each times a gain. The heater can
+//     only be on or off, so the output is the part of each
+//     HEATER_WINDOW that it is on ("time-proportioned"). The gains
+//     come from auto-tuning (see tuneLoop()).
+//
+//   Either way, the heater is never turned on for less than
+//   HEATER_MIN_ON or left off for less than HEATER_MIN_OFF - except
+//   that disabling it turns it off right away.
+//
 
 #include "heater.h"
+#include "events.h"
 #include <Arduino.h>
-#include <EEPROM.h>
 
 // go ahead and adjust these two values if the relays change
 #define RELAY_ON	LOW
@@ -20,14 +37,24 @@
 // need some hysteresis to stop fast cycling of on/off (in tenths)
 #define HOLD_OFF 20	// 2 degrees
 
-Heater::Heater(int pin, Thermometer *therm, int eepromAddress) : EEPROM_CONTROL(eepromAddress)
+// default PID gains - from auto-tuning the spa in the simulator (see
+//   arduino/host/heaterbench.cpp) - until the real one is tuned
+
+#define DEFAULT_KP	0.25
+#define DEFAULT_KI	0.00005
+#define DEFAULT_KD	90.0
+
+Heater::Heater(int pin, Thermometer *therm, int configIndex)
 {
+  myIndex = configIndex;
   myPin = pin;
   myTherm = therm;
-  myAddress = eepromAddress;
+  myConfig = &Config()->heater[configIndex];
 
-  if(!eepromHasBeenSet()) {
+  if(!ConfigValid()) {
     config(DEFAULT_SETPOINT);		// set default if none is in eeprom
+    configMode(HEATER_HYSTERESIS);
+    configGains(DEFAULT_KP,DEFAULT_KI,DEFAULT_KD);
   } else {
     loadConfig();		// otherwise use eeprom value
   }
@@ -36,6 +63,10 @@ Heater::Heater(int pin, Thermometer *therm, int eepromAddress) : EEPROM_CONTROL(
 
   enabled = 0;	// heater starts off disabled
   active = 0;	//   and inactive
+  tuning = 0;
+  output = 0;
+  switched = millis();
+  pidReset();
 }
 
 //
@@ -44,22 +75,106 @@ Heater::Heater(int pin, Thermometer *therm, int eepromAddress) : EEPROM_CONTROL(
 //
 void Heater::config(int tenths)
 {
-  int offset = 0;
-  
   setPoint = tenths;
 
-  offset += eepromWrite(offset,setPoint);
+  myConfig->setPoint = setPoint;
+  ConfigChanged();
 }
+
+//
+// configMode() - pick how the heat is controlled (see HeaterModes).
+//    HEATER_TUNE isn't kept as the mode - it starts auto-tuning, which
+//    switches to PID when it is done.
+//
+void Heater::configMode(int newMode)
+{
+  if(newMode == HEATER_TUNE) {
+    tuning = 1;
+    tuneStart = millis();
+    tuneSwings = 0;
+    tuneRange = 0;
+    tunePeriod = 0;
+    tuneWasActive = active;
+    return;
+  }
+
+  tuning = 0;
+  mode = (newMode == HEATER_PID)?HEATER_PID:HEATER_HYSTERESIS;
+  pidReset();
+
+  myConfig->mode = mode;
+  ConfigChanged();
+}
+
+void Heater::configGains(float p, float i, float d)
+{
+  kp = p;
+  ki = i;
+  kd = d;
+
+  myConfig->kp = kp;
+  myConfig->ki = ki;
+  myConfig->kd = kd;
+  ConfigChanged();
+}
+
 void Heater::loadConfig()
 {
-  int offset = 0;
+  setPoint = myConfig->setPoint;
+  mode = myConfig->mode;
+  kp = myConfig->kp;
+  ki = myConfig->ki;
+  kd = myConfig->kd;
+}
 
-  offset += eepromRead(offset,&setPoint);
+//
+// controlI2C() - fill in the buffer (16 bytes) for an I2C read of the
+//    heater control:
+//
+//      [0]      mode (HeaterModes)
+//      [1]      true if auto-tuning
+//      [2-3]    PID output in tenths of a percent
+//      [4-15]   kp, ki, kd (floats, big-endian)
+//
+//    It is read from the TWI ISR, so the gains go straight into the
+//    buffer (see floatPut()) rather than through a copy on the stack.
+//
+static void floatPut(byte *buffer, float value)
+{
+  uint32_t bits;
+
+  memcpy(&bits,&value,4);
+  buffer[0] = (bits >> 24) & 0xff;
+  buffer[1] = (bits >> 16) & 0xff;
+  buffer[2] = (bits >> 8) & 0xff;
+  buffer[3] = bits & 0xff;
 }
 
+void Heater::controlI2C(byte *buffer)
+{
+  buffer[0] = mode;
+  buffer[1] = tuning;
+  buffer[2] = (output >> 8) & 0xff;
+  buffer[3] = output & 0xff;
+
+  floatPut(&buffer[4],kp);
+  floatPut(&buffer[8],ki);
+  floatPut(&buffer[12],kd);
+}
+
+//
+// enable() - enable/disable the heater. Disabling turns the heat
+//    off right away, rather than waiting for loop(), because the
+//    pump is often turned off right after.
+//
 void Heater::enable(int onoff)
 {
   enabled = onoff?1:0;
+  if(!enabled) {
+    heatOFF();
+    tuning = 0;		// tuning needs the heater the whole time
+    pidReset();
+  }
 }
 
 //
@@ -79,21 +194,201 @@ void Heater::loop(void)
 
   reading = myTherm->readAVG();
 
+  if(tuning) {
+    heatWant(tuneLoop(reading));
+  } else if(mode == HEATER_PID) {
+    heatWant(pidLoop(reading));
+  } else {
+    heatWant(hysteresisLoop(reading));
+  }
+}
+
+//
+// hysteresisLoop() - the simple on below/off above the set point, with
+//    HOLD_OFF either way to keep it from fast cycling.
+//
+int Heater::hysteresisLoop(int reading)
+{
   // we build in the hysteresis here with the hold off
   if(active && reading >= (setPoint + HOLD_OFF)) {
-    heatOFF();
+    return(false);
   } else if(!active && reading < (setPoint - HOLD_OFF)) {
-    heatON();
+    return(true);
+  }
+  return(active);
+}
+
+//
+// pidReset() - start the PID over - the next run has nothing to take
+//    a derivative from, and starts a new window.
+//
+void Heater::pidReset(void)
+{
+  integral = 0.0;
+  primed = 0;
+  output = 0;
+  onTime = 0;
+  owed = 0;
+}
+
+//
+// pidLoop() - figure the PID output and return whether the heater is
+//    on at this point in the window. Everything is in degrees and
+//    seconds, so the gains don't depend on HEATER_PERIOD.
+//
+//    The derivative is of the reading rather than the error, so that
+//    changing the set point doesn't kick it, and it is smoothed over
+//    HEATER_SLOPE_TIME - the reading moves in tenths, and a tenth in
+//    a second would otherwise look like a fast climb. The integral stops
+//    growing while the output is pinned (at 0 or 100%) the same way
+//    the error is pushing it, so it doesn't wind up during a long
+//    heat-up.
+//
+//    The on time is set at the start of each window from the output
+//    then. If that is less than the minimum on (or off) time, the
+//    heater is off (or on) for the whole window instead - and what it
+//    was short (or over) is carried to the next window, so a small
+//    output still comes out right on average. Holding a spa is mostly
+//    small outputs. If the output drops to nothing (like coming up to
+//    the set point) the rest of the window is dropped too.
+//
+int Heater::pidLoop(int reading)
+{
+  unsigned long now = millis();
+  float dt = 0.0;
+  float error = (setPoint - reading) / 10.0;
+  float i;
+  float out;
+
+  if(primed) {
+    dt = (now - lastRun) / 1000.0;
+    slope += ((reading - previous) / 10.0 - slope * dt) / (HEATER_SLOPE_TIME + dt);
+  } else {
+    slope = 0.0;
+    windowStart = now - HEATER_WINDOW;	// start a window now
+    primed = 1;
+  }
+  lastRun = now;
+  previous = reading;
+
+  i = integral + ki * error * dt;
+  i = constrain(i,0.0,1.0);
+  out = kp * error + i - kd * slope;
+  if(!((out > 1.0 && error > 0.0) || (out < 0.0 && error < 0.0))) {
+    integral = i;
   }
+  out = constrain(kp * error + integral - kd * slope,0.0,1.0);
+  output = (int)(out * 1000.0 + 0.5);
+
+  if(now - windowStart >= HEATER_WINDOW) {
+    windowStart = now;
+    owed += (long)output * (HEATER_WINDOW / 1000);
+    onTime = constrain(owed,0L,(long)HEATER_WINDOW);
+    if(onTime < HEATER_MIN_ON) {
+      onTime = 0;
+    } else if(HEATER_WINDOW - onTime < HEATER_MIN_OFF) {
+      onTime = HEATER_WINDOW;
+    }
+    owed -= onTime;
+  }
+  if(output == 0) {		// no heat wanted at all - don't finish the window
+    onTime = 0;
+    owed = 0;
+  }
+
+  return(now - windowStart < onTime);
+}
+
+//
+// tuneLoop() - auto-tune by "relay feedback": heat below the set point
+//    and don't above it (by HEATER_TUNE_BAND) and the temp swings
+//    around the set point. How far it swings for the heater's full
+//    output, and how long a swing takes, say how strong the heater is
+//    against the pool and how long the heat takes to show up - which
+//    is what the gains need to know.
+//
+//    A swing starts each time the heater goes on. The first one (the
+//    heat-up to the set point, or whatever was going on when tuning
+//    started) isn't measured, the next HEATER_TUNE_CYCLES are. If it takes more than HEATER_TUNE_TIMEOUT
+//    tuning is given up, and the mode is left as it was.
+//
+int Heater::tuneLoop(int reading)
+{
+  unsigned long now = millis();
+  int want = active;
+
+  if(now - tuneStart > HEATER_TUNE_TIMEOUT) {
+    tuning = 0;
+    return(false);
+  }
+
+  if(active && !tuneWasActive) {		// a new swing
+    if(tuneSwings > 1) {
+      tuneRange += tuneHigh - tuneLow;
+      tunePeriod += now - tuneOnTime;
+    }
+    tuneSwings++;
+    tuneOnTime = now;
+    tuneHigh = tuneLow = reading;
+
+    if(tuneSwings > HEATER_TUNE_CYCLES + 1) {
+      tuneDone();
+      return(active);
+    }
+  }
+  tuneWasActive = active;
+
+  if(reading > tuneHigh) {
+    tuneHigh = reading;
+  }
+  if(reading < tuneLow) {
+    tuneLow = reading;
+  }
+
+  if(reading < setPoint - HEATER_TUNE_BAND) {
+    want = true;
+  } else if(reading > setPoint + HEATER_TUNE_BAND) {
+    want = false;
+  }
+  return(want);
+}
+
+//
+// tuneDone() - figure the gains from the swings and switch to PID.
+//    The output swung between 0 and 1, so the "ultimate gain" is
+//    4 x 0.5 / (pi x the swing's amplitude) and the "ultimate period"
+//    is the length of a swing. The gains are the Tyreus-Luyben ones,
+//    which are gentler than Ziegler-Nichols - overshoot in a spa just
+//    means waiting for it to cool.
+//
+void Heater::tuneDone(void)
+{
+  float amplitude = tuneRange / (float)HEATER_TUNE_CYCLES / 20.0;	// degrees
+  float period = tunePeriod / (float)HEATER_TUNE_CYCLES / 1000.0;	// seconds
+  float ku, p;
+
+  if(amplitude < 0.05) {
+    amplitude = 0.05;
+  }
+  ku = 2.0 / (PI * amplitude);
+  p = ku / 2.2;
+
+  configGains(p,p / (2.2 * period),p * period / 6.3);
+  configMode(HEATER_PID);
 }
 
 //
 // on() - turn on the heater - which means turn on the relay
-//    and set active
+//    and set active. Turning on (or off) is logged as an event, but
+//    only when it is a change.
 //
 void Heater::heatON(void)
 {
   relayControl(RELAY_ON);
+  if(!active) {
+    EventLog(EVENT_HEATER,myIndex,1);
+    switched = millis();
+  }
   active = 1;
 }
 
@@ -103,9 +398,32 @@ void Heater::heatON(void)
 void Heater::heatOFF(void)
 {
   relayControl(RELAY_OFF);
+  if(active) {
+    EventLog(EVENT_HEATER,myIndex,0);
+    switched = millis();
+  }
   active = 0;
 }
 
+//
+// heatWant() - turn the heater on or off, unless it hasn't been on (or
+//    off) for its minimum time yet.
+//
+void Heater::heatWant(int on)
+{
+  if(on == active) {
+    return;
+  }
+  if(millis() - switched < (active?HEATER_MIN_ON:HEATER_MIN_OFF)) {
+    return;
+  }
+  if(on) {
+    heatON();
+  } else {
+    heatOFF();
+  }
+}
+
 
 //
 // relayControl() - controls the given relay where:
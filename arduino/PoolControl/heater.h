@@ -5,12 +5,39 @@
 //
 
 #include "thermometer.h"
-#include "eeprom.h"
+#include "config.h"
 
 #ifndef HEATER_H
 #define HEATER_H
 
-class Heater : public EEPROM_CONTROL {
+#define HEATER_PERIOD	1000000UL	// micros between loop() runs (1 Hz)
+
+// the heater is never switched faster than this, whatever the mode
+
+#define HEATER_MIN_ON		60000UL		// millis it stays on once on
+#define HEATER_MIN_OFF		120000UL	//   and off once off
+
+// PID mode turns its output (0 - 100%) into that much of each window
+//   with the heater on
+
+#define HEATER_WINDOW		300000UL	// millis in a window (5 minutes)
+#define HEATER_SLOPE_TIME	60.0		// seconds the derivative is smoothed over
+
+// auto-tuning switches the heater on and off around the set point
+//   (like the hysteresis mode, but with a narrow band) and measures
+//   how far the temp swings and how long a swing takes
+
+#define HEATER_TUNE_BAND	3		// tenths of degrees either side of the set point
+#define HEATER_TUNE_CYCLES	3		// swings measured (after the first)
+#define HEATER_TUNE_TIMEOUT	(8UL * 3600000UL)	// millis before giving up
+
+enum HeaterModes {
+  HEATER_HYSTERESIS = 0,	// on below the set point, off above (with a band)
+  HEATER_PID = 1,		// time-proportioned PID
+  HEATER_TUNE = 2		// (not kept) auto-tune the PID gains, then use PID
+};
+
+class Heater {
 
 public:
   int enabled;	// heater is enabled
@@ -18,19 +45,53 @@ public:
 
   int setPoint;	// heating set point in tenths of degrees - 105 degrees is 1050
 
+  int mode;	// HeaterModes - how the heat is controlled
+  int tuning;	// true while auto-tuning
+  int output;	// PID output in tenths of a percent (0 - 1000)
+
   void loop(void);	// heat management loop
 
   Heater(int,Thermometer *,int);
   void config(int);
+  void configMode(int);			// HeaterModes - HEATER_TUNE starts tuning
+  void configGains(float,float,float);	// kp, ki, kd
   void enable(int);
+  void controlI2C(byte *);		// fills in the mode, output, and gains
 
 private:
+  int	       myIndex;		// which heater this is (config and events)
   int	       myPin;		// pin to turn on the heat
   Thermometer *myTherm;		// the thermometer to use for heat control
+  HeaterConfig *myConfig;	// where the set point, mode, and gains are kept
+  unsigned long switched;	// millis when the heater last went on or off
+
+  float kp, ki, kd;		// PID gains (see HeaterConfig)
+  float integral;		// PID integral term (0 - 1)
+  int previous;			// last reading (for the derivative)
+  float slope;			// how fast the reading is changing (smoothed)
+  int primed;			// previous and lastRun are good
+  unsigned long lastRun;	// millis of the last PID run
+  unsigned long windowStart;	// millis when the current window started
+  unsigned long onTime;		//   and millis of it to have the heater on
+  long owed;			// on time carried over from the last window
+
+  unsigned long tuneStart;	// millis when tuning started
+  unsigned long tuneOnTime;	// millis when the current swing started
+  int tuneHigh, tuneLow;	// highest and lowest temp in this swing
+  int tuneSwings;		// swings so far (the first isn't measured)
+  long tuneRange;		// total of (high - low) of the measured swings
+  unsigned long tunePeriod;	//   and of their length in millis
+  int tuneWasActive;		// heater state at the last tuning run
 
   void relayControl(int);   	// internal relay control
   void heatON(void);
   void heatOFF(void);
+  void heatWant(int);		// on or off, within the minimum on/off times
+  int hysteresisLoop(int);	// each mode returns whether it wants heat
+  int pidLoop(int);
+  int tuneLoop(int);
+  void tuneDone(void);
+  void pidReset(void);
   void loadConfig(void);
 };
 
@@ -0,0 +1,445 @@
+//
+// history.cpp
+//
+//   The temperature history - a minute-by-minute record of the pool
+//   temperature going back a day and more, so that the controller can
+//   fill in its charts after a restart without having polled for it.
+//
+//   Readings are taken every HISTORY_SAMPLE_PERIOD and averaged into
+//   an entry every HISTORY_SAMPLES of them. Each entry gets a sequence
+//   number (16 bits, one more than the last one).
+//
+//   A day of ints would take most of the RAM, so entries go into
+//   blocks (HISTORY_BLOCK bytes). A block holds its first entry as a
+//   value and every one after it as the difference from the one before,
+//   written as "crumbs" (2 bits, lowest first in each byte):
+//
+//      0 - the same     1 - up 0.1     2 - down 0.1
+//      3 - something else - the difference follows, zig-zagged (so
+//          small negatives are small) as a varint of nibbles, each one
+//          two crumbs (low first): three bits of the difference, lowest
+//          first, with the high bit set if more follow
+//
+//   The pool rarely moves more than 0.1 degrees a minute, so almost
+//   every entry is one crumb. An entry never runs past the end of a
+//   block.
+//
+//   Only the block being filled is in RAM. When it is full it is
+//   spilled to the EEPROM, which keeps HISTORY_BLOCKS of them, written
+//   round-robin (at HISTORY_EEPROM_ADDRESS) so that no cell is written
+//   even once a day. When they are all in use, the oldest
+//   one is dropped to make room - so the history holds fewer hours of
+//   big swings than of steady temps. The EEPROM only stands in for
+//   RAM: the history starts over with each boot.
+//
+//   The controller reads it in chunks (HistoryFrame()) through a read
+//   "cursor", which moves along with each read like the event log's
+//   (see events.cpp). HistorySeek() moves it - to an entry that has
+//   already been dropped (or one from before a reboot) and it starts
+//   at the oldest one left.
+//
+//   Entries are added from the main loop and read from the TWI ISR. The
+//   ISR can't wait out an EEPROM write (3.3ms), so a read that gets to
+//   a spilled block while one is underway ends its chunk early - with
+//   no entries at all if it couldn't get the first one.
+//
+
+#include "history.h"
+#include "eeprom.h"
+#include "EEPROM.h"		// (local) for where the blocks go
+
+#define BLOCK_CRUMBS		((HISTORY_BLOCK - 2) * 4)
+#define BLOCK_ADDRESS(n)	(HISTORY_EEPROM_ADDRESS + (n) * HISTORY_BLOCK)
+#define RAM_BLOCK		HISTORY_BLOCKS		// block number of the one being filled
+#define NO_BLOCK		0xff			// (cursor) has to be found
+#define CRUMB_SAME		0
+#define CRUMB_UP		1
+#define CRUMB_DOWN		2
+#define CRUMB_MORE		3
+
+static byte block[HISTORY_BLOCK];	// the block being filled
+static byte blockCrumbs;		//   crumbs of it used
+static byte entries[HISTORY_BLOCKS + 1];	// entries in each block (RAM_BLOCK last)
+static byte spilled;			// blocks in the EEPROM
+static byte spillNext;			// EEPROM block the next spill goes to
+static uint16_t oldestSeq;		// sequence of the oldest entry
+static uint16_t held;			// entries in all
+static int newestValue;			// value of the newest entry
+static unsigned long newestTime;	//   and millis when it was added
+
+// the read cursor - the next entry to read, where it is, and the value
+//   of the entry before it
+
+struct HistoryCursor {
+  uint16_t seq;
+  byte block;			// (NO_BLOCK after a seek)
+  byte index;			// entry in the block
+  byte crumb;			// where its difference is
+  int value;
+};
+
+static HistoryCursor cursor = { 0, NO_BLOCK, 0, 0, 0 };
+
+// the entry being averaged
+
+static long sampleTotal;
+static byte sampleCount;
+
+#define NEWEST_SEQ()	((uint16_t)(oldestSeq + held - 1))
+
+//
+// oldestBlock() - the block with the oldest entry, and blockAfter() the
+//    one after a block.
+//
+static byte oldestBlock(void)
+{
+  return(spilled?(spillNext + HISTORY_BLOCKS - spilled) % HISTORY_BLOCKS:RAM_BLOCK);
+}
+
+static byte blockAfter(byte b)
+{
+  b = (b + 1) % HISTORY_BLOCKS;
+  return((b == spillNext)?RAM_BLOCK:b);
+}
+
+//
+// blockByte() - a byte of a block, wherever it is. Returns false if
+//    it is in the EEPROM and a write is underway. Call with interrupts
+//    off.
+//
+static int blockByte(byte b, byte i, byte *value)
+{
+  if(b == RAM_BLOCK) {
+    *value = block[i];
+    return(true);
+  }
+  return(EEPROMCachePeek(BLOCK_ADDRESS(b) + i,value));
+}
+
+static int crumbGet(byte b, byte *pos, byte *crumb)
+{
+  byte value;
+
+  if(!blockByte(b,2 + (*pos >> 2),&value)) {
+    return(false);
+  }
+  *crumb = (value >> ((*pos & 3) * 2)) & 0x03;
+  (*pos)++;
+  return(true);
+}
+
+static void crumbPut(byte *bytes, uint16_t pos, byte crumb)
+{
+  byte shift = (pos & 3) * 2;
+
+  bytes[pos >> 2] = (bytes[pos >> 2] & ~(0x03 << shift)) | (crumb << shift);
+}
+
+//
+// historyLength() - how many crumbs a difference takes, and
+//    historyEncode() writes them at the given crumb of the bytes,
+//    returning the crumb after them. (Straight in, with no copy on the
+//    stack - HistoryFrame() is called from the TWI ISR.)
+//
+static byte historyLength(int delta)
+{
+  uint16_t zigzag;
+  byte count = 1;
+
+  if(delta >= -1 && delta <= 1) {
+    return(1);
+  }
+  zigzag = (delta < 0)?((uint16_t)(-delta) << 1) - 1:(uint16_t)delta << 1;
+  do {
+    zigzag >>= 3;
+    count += 2;
+  } while(zigzag);
+  return(count);
+}
+
+static uint16_t historyEncode(int delta, byte *bytes, uint16_t pos)
+{
+  uint16_t zigzag;
+  byte nibble;
+
+  if(delta >= -1 && delta <= 1) {
+    crumbPut(bytes,pos++,(delta < 0)?CRUMB_DOWN:(delta > 0)?CRUMB_UP:CRUMB_SAME);
+    return(pos);
+  }
+
+  zigzag = (delta < 0)?((uint16_t)(-delta) << 1) - 1:(uint16_t)delta << 1;
+  crumbPut(bytes,pos++,CRUMB_MORE);
+  do {
+    nibble = zigzag & 0x07;
+    zigzag >>= 3;
+    if(zigzag) {
+      nibble |= 0x08;
+    }
+    crumbPut(bytes,pos++,nibble & 0x03);
+    crumbPut(bytes,pos++,nibble >> 2);
+  } while(zigzag);
+  return(pos);
+}
+
+//
+// historyDecode() - read the difference at the given crumb, moving
+//    past it. Returns false if the EEPROM is busy.
+//
+static int historyDecode(byte b, byte *pos, int *delta)
+{
+  uint16_t zigzag = 0;
+  byte shift = 0;
+  byte crumb;
+  byte nibble;
+
+  if(!crumbGet(b,pos,&crumb)) {
+    return(false);
+  }
+  if(crumb != CRUMB_MORE) {
+    *delta = (crumb == CRUMB_DOWN)?-1:(crumb == CRUMB_UP)?1:0;
+    return(true);
+  }
+  do {
+    if(!crumbGet(b,pos,&nibble) || !crumbGet(b,pos,&crumb)) {
+      return(false);
+    }
+    nibble |= crumb << 2;
+    zigzag |= (uint16_t)(nibble & 0x07) << shift;
+    shift += 3;
+  } while(nibble & 0x08);
+
+  *delta = (zigzag & 1)?-(int)(zigzag >> 1) - 1:(int)(zigzag >> 1);
+  return(true);
+}
+
+//
+// historySpill() - write the block being filled to the EEPROM, dropping
+//    the oldest block if there isn't one free. The oldest is dropped
+//    before its bytes are written over, and the new one isn't counted
+//    until they are all queued - so the ISR never reads a block that is
+//    half one thing and half the other.
+//
+static void historySpill(void)
+{
+  byte i;
+
+  noInterrupts();
+  if(spilled == HISTORY_BLOCKS) {
+    oldestSeq += entries[spillNext];
+    held -= entries[spillNext];
+    spilled--;
+    if(cursor.block == spillNext) {
+      cursor.block = NO_BLOCK;		// it starts over at the oldest
+    }
+  }
+  interrupts();
+
+  for(i=0; i < 2 + (blockCrumbs + 3) / 4; i++) {
+    EEPROMCacheWrite(BLOCK_ADDRESS(spillNext) + i,block[i]);
+  }
+
+  noInterrupts();
+  entries[spillNext] = entries[RAM_BLOCK];
+  if(cursor.block == RAM_BLOCK) {
+    cursor.block = spillNext;
+  }
+  spillNext = (spillNext + 1) % HISTORY_BLOCKS;
+  spilled++;
+  entries[RAM_BLOCK] = 0;
+  blockCrumbs = 0;
+  interrupts();
+}
+
+//
+// historyAdd() - add an entry, spilling the block first if there isn't
+//    room for it.
+//
+static void historyAdd(int value)
+{
+  int delta = value - newestValue;
+
+  if(entries[RAM_BLOCK] != 0 && blockCrumbs + historyLength(delta) > BLOCK_CRUMBS) {
+    historySpill();
+  }
+
+  noInterrupts();
+  if(entries[RAM_BLOCK] == 0) {
+    block[0] = (value >> 8) & 0xff;
+    block[1] = value & 0xff;
+  } else {
+    blockCrumbs = historyEncode(delta,&block[2],blockCrumbs);
+  }
+  entries[RAM_BLOCK]++;
+  held++;
+  newestValue = value;
+  newestTime = millis();
+  interrupts();
+}
+
+//
+// HistorySample() - take in a reading, adding an entry with the
+//    average of the last HISTORY_SAMPLES of them.
+//
+void HistorySample(int tenths)
+{
+  sampleTotal += tenths;
+  if(++sampleCount < HISTORY_SAMPLES) {
+    return;
+  }
+
+  historyAdd((int)(sampleTotal / HISTORY_SAMPLES));
+  sampleTotal = 0;
+  sampleCount = 0;
+}
+
+//
+// historyStep() - move the cursor past the entry it is at, which the
+//    caller knows is there. Its value is then the cursor's. Returns
+//    false (leaving the cursor where it was) if the EEPROM is busy.
+//
+static int historyStep(void)
+{
+  byte pos;
+  byte hi, lo;
+  int delta;
+
+  if(cursor.index == entries[cursor.block]) {
+    cursor.block = blockAfter(cursor.block);
+    cursor.index = 0;
+    cursor.crumb = 0;
+  }
+
+  pos = cursor.crumb;
+  if(cursor.index == 0) {
+    if(!blockByte(cursor.block,0,&hi) || !blockByte(cursor.block,1,&lo)) {
+      return(false);
+    }
+    cursor.value = (int)((hi << 8) | lo);
+  } else {
+    if(!historyDecode(cursor.block,&pos,&delta)) {
+      return(false);
+    }
+    cursor.value += delta;
+  }
+  cursor.crumb = pos;
+  cursor.index++;
+  cursor.seq++;
+  return(true);
+}
+
+//
+// historyFind() - after a seek, find the block with the entry the
+//    cursor asks for (or the oldest, if it isn't there) and walk to it.
+//    Returns false if the EEPROM is busy - the cursor is then left
+//    asking for the same entry.
+//
+static int historyFind(void)
+{
+  uint16_t target = cursor.seq;
+  uint16_t first = oldestSeq;
+  byte b = oldestBlock();
+
+  if((uint16_t)(target - oldestSeq) > held) {	// dropped (or from before a reboot)
+    target = oldestSeq;
+  }
+  while(b != RAM_BLOCK && (uint16_t)(target - first) >= entries[b]) {
+    first += entries[b];
+    b = blockAfter(b);
+  }
+
+  cursor.seq = first;
+  cursor.block = b;
+  cursor.index = 0;
+  cursor.crumb = 0;
+  while(cursor.seq != target) {
+    if(!historyStep()) {
+      cursor.seq = target;
+      cursor.block = NO_BLOCK;
+      return(false);
+    }
+  }
+  return(true);
+}
+
+//
+// HistorySeek() - have the next read start with the given entry. It is
+//    found on the next read, walking the block it is in - so this is
+//    only for starting over, reads after that just carry on.
+//
+//    HISTORY_OLDEST starts with the oldest entry, whatever its sequence
+//    is. (The sequence goes around every 45 days or so, so a seek to 0
+//    can land in the middle.) That means entry 0xffff itself can't be
+//    asked for - a seek to it starts at the oldest.
+//
+void HistorySeek(unsigned int seq)
+{
+  cursor.seq = (seq == HISTORY_OLDEST)?oldestSeq:(uint16_t)seq;
+  cursor.block = NO_BLOCK;
+}
+
+//
+// HistoryFrame() - fill in the buffer with the entries at the cursor -
+//    as many as fit - and move the cursor past them. Returns the number
+//    of bytes used.
+//
+//      [0-1]    sequence of the newest entry (if it isn't the last one
+//               in this frame, there are more to read)
+//      [2-3]    seconds since the newest entry was added (0xffff if
+//               over 18 hours)
+//      [4-5]    sequence of the first entry in this frame
+//      [6]      number of entries in this frame
+//      [7-8]    value of the first entry (tenths of degrees)
+//      then the differences of the rest, in crumbs (as above), lowest
+//      first in each byte, with the last byte padded with 0
+//
+//    Entries are a minute apart, so the time of any entry is that of
+//    the newest less a minute for each sequence number between them.
+//
+int HistoryFrame(byte *buffer, int size)
+{
+  unsigned long age = (millis() - newestTime) / 1000UL;
+  uint16_t newest = NEWEST_SEQ();
+  uint16_t first;
+  uint16_t out = 0;
+  uint16_t room = (size - 9) * 4;	// crumbs that fit after the header
+  HistoryCursor save;
+  byte count = 0;
+
+  if(held == 0) {
+    age = 0xffff;
+  }
+  buffer[0] = newest >> 8;
+  buffer[1] = newest & 0xff;
+  buffer[2] = (age > 0xffffUL)?0xff:(age >> 8);
+  buffer[3] = (age > 0xffffUL)?0xff:(age & 0xff);
+  memset(&buffer[7],0,size - 7);
+
+  if(cursor.block == NO_BLOCK) {
+    historyFind();
+  }
+  first = cursor.seq;
+
+  while(cursor.block != NO_BLOCK && cursor.seq != (uint16_t)(newest + 1) && count < 0xff) {
+    save = cursor;
+    if(!historyStep()) {
+      break;
+    }
+    if(count == 0) {
+      buffer[7] = (cursor.value >> 8) & 0xff;
+      buffer[8] = cursor.value & 0xff;
+    } else {
+      if(historyLength(cursor.value - save.value) > room - out) {
+	cursor = save;			// doesn't fit - leave it for the next read
+	break;
+      }
+      out = historyEncode(cursor.value - save.value,&buffer[9],out);
+    }
+    count++;
+  }
+
+  buffer[4] = first >> 8;
+  buffer[5] = first & 0xff;
+  buffer[6] = count;
+
+  return(9 + (out + 3) / 4);
+}
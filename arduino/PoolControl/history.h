@@ -0,0 +1,25 @@
+//
+// history.h
+//
+//   (see history.cpp for information about the temperature history)
+//
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <Arduino.h>
+
+#define HISTORY_BLOCK		32		// bytes in a block - the first entry's value,
+						//   then 120 crumbs, one for each entry after it
+						//   when the temp holds steady
+#define HISTORY_BLOCKS		16		// full blocks kept in the EEPROM (see EEPROM.h) -
+						//   over 32 hours with the one being filled
+#define HISTORY_SAMPLE_PERIOD	1000000UL	// micros between samples
+#define HISTORY_SAMPLES		60		//   samples averaged into an entry (a minute)
+#define HISTORY_OLDEST		0xffff		// seek to the oldest entry there is
+
+extern void HistorySample(int);			// a reading (tenths), every HISTORY_SAMPLE_PERIOD
+extern void HistorySeek(unsigned int);		// the next read starts with this entry
+extern int HistoryFrame(byte *,int);		// fill in the next chunk, returns its size
+
+#endif // HISTORY_H
@@ -7,6 +7,7 @@
 //   and the booster pump has just one.
 //
 #include "pump.h"
+#include "trace.h"
 #include <Arduino.h>
 
 // go ahead and adjust these two values if the relays change
@@ -63,7 +64,7 @@ Pump::Pump(int pinOnRed, int eepromAddress)
   redRelay = pinOnRed;
   status = 0;
 
-  Serial.print("pump init, status "); Serial.println(status);
+  TRACE_DEBUG(TRACE_PUMP_INIT,redRelay,status);
   relayControl(redRelay,RELAY_OFF);
   
   pinMode(redRelay,OUTPUT);
@@ -77,9 +78,8 @@ Pump::Pump(int pinOnRed, int eepromAddress)
 //
 void Pump::control(int speed)
 {
-  Serial.print("pump speed ");
-  Serial.println(speed);
-  
+  TRACE_INFO(TRACE_PUMP_SPEED,redRelay,speed);
+
   status = speed;
 
   switch(mode) {
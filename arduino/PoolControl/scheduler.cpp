@@ -0,0 +1,274 @@
+//
+// scheduler.cpp
+//
+//   A small cooperative scheduler for the main loop. Each device adds
+//   a task with a period (how often it should run) and a deadline
+//   (how late it can start before we call it "late"). TaskLoop() is
+//   then called as fast as possible from loop(), and runs whatever
+//   is due, in the order the tasks were added.
+//
+//   A task can change its own period while running - valves, for
+//   example, run fast while they are moving and slowly otherwise.
+//
+//   Every task keeps a run count, a late count, and its worst-case
+//   and cumulative run time so that the loop can be profiled. The
+//   time between passes of TaskLoop() is also kept (see LoopStats).
+//
+
+#include "scheduler.h"
+
+static Task tasks[TASK_MAX];
+static int taskCount;
+
+static LoopStats loopStats = { 0, 0, 0xffffffffUL, 0, { 0 } };
+static unsigned long lastPass;		// micros at the start of the last pass
+static volatile int resetRequested;	// set by TaskReset(), done by TaskLoop()
+
+//
+// taskStatsReset() - clear all of the statistics, for the loop and for
+//    each task.
+//
+static void taskStatsReset(void)
+{
+  int i;
+
+  memset(&loopStats,0,sizeof(loopStats));
+  loopStats.shortest = 0xffffffffUL;
+  lastPass = 0;
+
+  for(i=0; i < taskCount; i++) {
+    tasks[i].runs = 0;
+    tasks[i].late = 0;
+    tasks[i].worst = 0;
+    tasks[i].total = 0;
+  }
+}
+
+//
+// loopStatsUpdate() - account for the time since the last pass.
+//
+static void loopStatsUpdate(unsigned long now)
+{
+  unsigned long period = now - lastPass;
+  unsigned long scaled;
+  int bucket;
+
+  if(lastPass != 0) {
+    loopStats.passes++;
+    loopStats.total += period;
+    if(period < loopStats.shortest) {
+      loopStats.shortest = period;
+    }
+    if(period > loopStats.longest) {
+      loopStats.longest = period;
+    }
+
+    // buckets are 4x apart, starting at 128
+
+    scaled = period >> 7;
+    for(bucket=0; scaled != 0 && bucket < LOOP_HISTOGRAM-1; bucket++) {
+      scaled >>= 2;
+    }
+    loopStats.histogram[bucket]++;
+  }
+  lastPass = now;
+}
+
+//
+// TaskAdd() - add a task that calls run(arg) every period micros.
+//    A period of zero runs the task on every pass. Returns the task
+//    number (used for TaskPeriod()) or -1 if there is no room.
+//    The first run is due right away.
+//
+int TaskAdd(void (*run)(int), int arg, unsigned long period, unsigned long deadline)
+{
+  Task *task;
+
+  if(taskCount >= TASK_MAX) {
+    return(-1);
+  }
+
+  task = &tasks[taskCount];
+  task->run = run;
+  task->arg = arg;
+  task->period = period;
+  task->deadline = deadline;
+  task->due = micros();
+  task->runs = 0;
+  task->late = 0;
+  task->worst = 0;
+  task->total = 0;
+
+  return(taskCount++);
+}
+
+//
+// TaskPeriod() - change the period of the given task. If it gets
+//    shorter, the next run is pulled in so that the new rate takes
+//    effect right away.
+//
+void TaskPeriod(int id, unsigned long period)
+{
+  Task *task;
+  unsigned long now;
+
+  if(id < 0 || id >= taskCount || tasks[id].period == period) {
+    return;
+  }
+
+  task = &tasks[id];
+  now = micros();
+  if(period < task->period && (long)(task->due - (now + period)) > 0) {
+    task->due = now + period;
+  }
+  task->period = period;
+}
+
+//
+// TaskLoop() - run every task that is due. After a run, the next due
+//    time is one period after the last one, unless the task has
+//    fallen more than a period behind, in which case it is simply
+//    rescheduled from now (no catching up with a burst of runs).
+//
+//    The time is read once per pass for checking what is due, so
+//    tasks that aren't due cost only a compare.
+//
+//    The loop and task statistics are read from the TWI ISR
+//    (ControlLoopStats() and the others in control.cpp), so they are
+//    updated with interrupts off - a read never gets a count half way
+//    through changing, or some of them from before a pass and some
+//    from after.
+//
+void TaskLoop(void)
+{
+  int i;
+  Task *task;
+  unsigned long now = micros();
+  unsigned long start;
+  unsigned long elapsed;
+  bool late;
+  uint8_t sreg = SREG;
+
+  cli();
+  if(resetRequested) {
+    taskStatsReset();
+    resetRequested = 0;
+  }
+  loopStatsUpdate(now);
+  SREG = sreg;
+
+  for(i=0; i < taskCount; i++) {
+    task = &tasks[i];
+
+    if((long)(now - task->due) < 0) {
+      continue;
+    }
+
+    start = micros();
+    late = (start - task->due > task->deadline);
+
+    (*task->run)(task->arg);
+
+    elapsed = micros() - start;
+    sreg = SREG;
+    cli();
+    if(late) {
+      task->late++;
+    }
+    task->runs++;
+    task->total += elapsed;
+    if(elapsed > task->worst) {
+      task->worst = (elapsed > 0xffffUL)?0xffff:elapsed;
+    }
+    SREG = sreg;
+
+    task->due += task->period;
+    if((long)(start - task->due) > 0) {
+      task->due = start + task->period;
+    }
+  }
+}
+
+int TaskCount(void)
+{
+  return(taskCount);
+}
+
+Task *TaskGet(int id)
+{
+  if(id < 0 || id >= taskCount) {
+    return(NULL);
+  }
+  return(&tasks[id]);
+}
+
+LoopStats *TaskLoopStats(void)
+{
+  return(&loopStats);
+}
+
+//
+// TaskReset() - ask for all of the statistics to be cleared. This is
+//    safe to call from an ISR - the clearing happens at the start of
+//    the next pass of TaskLoop().
+//
+void TaskReset(void)
+{
+  resetRequested = 1;
+}
+
+//
+// TaskStackPaint() - paint the RAM between the variables and the stack
+//    with STACK_PAINT, so that TaskStackFree() can tell how deep the
+//    stack has ever gone. It is called first thing in setup(), with
+//    interrupts off so that none of them push a frame into the paint
+//    as it goes on. (There is no heap - nothing calls malloc() - so
+//    all of it belongs to the stack.)
+//
+//    TaskStackFree() - the bytes of paint left above the variables,
+//    which is how close the stack has come to them since the boot.
+//    It is read from the TWI ISR (see ControlLoopStats()). A frame
+//    that happens to leave a byte of STACK_PAINT at its bottom makes
+//    it look a little better than it is. The host build has no paint,
+//    and says 0xffff.
+//
+#ifdef __AVR__
+
+extern uint8_t __heap_start;		// (avr-libc) just past the variables
+
+static uint8_t *stackPainted;		// end of the paint
+
+void TaskStackPaint(void)
+{
+  uint8_t *p;
+  uint8_t sreg = SREG;
+
+  cli();
+  stackPainted = (uint8_t *)SP;
+  for(p = &__heap_start; p < stackPainted; p++) {
+    *p = STACK_PAINT;
+  }
+  SREG = sreg;
+}
+
+unsigned int TaskStackFree(void)
+{
+  uint8_t *p;
+
+  for(p = &__heap_start; p < stackPainted && *p == STACK_PAINT; p++) {
+  }
+  return(p - &__heap_start);
+}
+
+#else
+
+void TaskStackPaint(void)
+{
+}
+
+unsigned int TaskStackFree(void)
+{
+  return(0xffff);
+}
+
+#endif
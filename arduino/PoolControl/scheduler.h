@@ -0,0 +1,58 @@
+//
+// scheduler.h
+//
+//   (see scheduler.cpp for information about the task scheduler)
+//
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#define TASK_MAX	8	// max number of tasks that can be added
+#define STACK_PAINT	0xc5	// what the unused stack is painted with (see
+				//   TaskStackPaint())
+
+struct Task {
+  void		(*run)(int);	// what to call, and
+  int		arg;		//   what to call it with
+  unsigned long	period;		// micros between runs (0 is every pass)
+  unsigned long	deadline;	// micros after due before a run is "late"
+  unsigned long	due;		// micros when the next run is due
+
+  // statistics (micros are as measured by micros()) - late and worst
+  //   only have the 16 bits that go over I2C (see ControlTaskWorst())
+
+  unsigned long	runs;		// number of times run
+  unsigned int	late;		// number of runs that started past deadline (wraps)
+  unsigned int	worst;		// longest single run (0xffff if over 65ms)
+  unsigned long	total;		// cumulative time in run
+};
+
+// the main loop itself is profiled too - pass count and total time
+//   (both of which wrap, so take differences) along with the shortest
+//   and longest pass, and a histogram of pass times with buckets at
+//   128, 512, and 2048 micros.
+
+#define LOOP_HISTOGRAM	4
+
+struct LoopStats {
+  unsigned long	passes;		// number of passes through TaskLoop()
+  unsigned long	total;		// sum of the pass times
+  unsigned long	shortest;	// shortest pass
+  unsigned long	longest;	// longest pass
+  unsigned long	histogram[LOOP_HISTOGRAM];
+};
+
+extern int TaskAdd(void (*)(int),int,unsigned long,unsigned long);
+extern void TaskPeriod(int,unsigned long);
+extern void TaskLoop(void);
+
+extern int TaskCount(void);
+extern Task *TaskGet(int);
+extern LoopStats *TaskLoopStats(void);
+extern void TaskReset(void);
+extern void TaskStackPaint(void);
+extern unsigned int TaskStackFree(void);
+
+#endif // SCHEDULER_H
@@ -47,18 +47,31 @@ struct
     
 #include <Arduino.h>
 #include "thermometer.h"
+#include "trace.h"
+
+//
+// the default filter - 2 more bits from oversampling, a median of 3 to
+//   throw out the spikes, and an average over 16 samples (about 1.6
+//   seconds at THERM_SAMPLE_PERIOD)
+//
+static const FilterSettings thermFilter = { 1, 3, 4, THERM_SAMPLE_PERIOD };
 
 //
 // Thermometer() - simply configure the pin and the default
 //     coefficients.
 //
-Thermometer::Thermometer(int pin, int kohms, int eepromAddress) : EEPROM_CONTROL(eepromAddress)
+Thermometer::Thermometer(int pin, int kohms, int configIndex) :
+  filter(pin,&thermFilter)
 {
     int	curve = TC_MEASURED;
     myPin = pin;
+    filter.enable(true);
+    readingAverage = 0;
     myResistor = (float)kohms * 1000.0;	// used during reading as a float -
                                         //   so go ahead and set it as such
-  if(!eepromHasBeenSet()) {
+    myConfig = &Config()->therm[configIndex];
+
+  if(!ConfigValid()) {
       // set the defaults if none have been written to eeprom
       config(ThermCurves[curve].c1,ThermCurves[curve].c2,ThermCurves[curve].c3);
 
@@ -66,34 +79,32 @@ Thermometer::Thermometer(int pin, int kohms, int eepromAddress) : EEPROM_CONTROL
       // otherwise load them from eeprom
       loadConfig();
   }
-
-  // set up for reading averaging
-  readingPointer = -1;
 }
 
 //
-// loadConfig() - load the default constants from EEPROM. This will happen
-//   upon the first arduino load, or after a "factorReset".
+// loadConfig() - load the constants from the config image. The defaults
+//   are used instead upon the first arduino load, or after a "factorReset".
 //
 void Thermometer::loadConfig()
 {
-  int offset = 0;
+  c1 = myConfig->c1;
+  c2 = myConfig->c2;
+  c3 = myConfig->c3;
 
-  offset += eepromRead(offset,&c1);
-  offset += eepromRead(offset,&c2);
-  offset += eepromRead(offset,&c3);
+  buildTable();
 }  
 void Thermometer::config(float con1, float con2, float con3)
 {
-  int offset = 0;
-  
   c1 = con1;
   c2 = con2;
   c3 = con3;
 
-  offset += eepromWrite(offset,c1);
-  offset += eepromWrite(offset,c2);
-  offset += eepromWrite(offset,c3);
+  myConfig->c1 = c1;
+  myConfig->c2 = c2;
+  myConfig->c3 = c3;
+  ConfigChanged();
+
+  buildTable();
 }
 
 //
@@ -111,15 +122,27 @@ void Thermometer::readI2C(byte *buffer)
 //    tenths of degrees (805 = 80.5 F).
 //
 int Thermometer::read(void)
+{
+  // get the reading, which is between 0 and 1023 inclusive
+  //   which represents the voltage at the voltage divider
+  //   created with myResistor - the analog scanner keeps the
+  //   latest one around, so there is no waiting here
+
+  return(convert(filter.raw()));
+}
+
+//
+// curve() - convert the given ADC reading to tenths of degrees using
+//    the Steinhart-Hart equation directly. This is all float math
+//    and a log(), which is expensive on the Nano, so it is only used
+//    to build the table that convert() uses.
+//
+int Thermometer::curve(int adc)
 {
   float	reading;
   float logR2, R2, T;
   
-  // get the reading, which is between 0 and 1023 inclusive
-  //   which represents the voltage at the voltage divider
-  //   created with myResistor
- 
-  reading = (float) analogRead(myPin);
+  reading = (float) adc;
   
   R2 = myResistor * (1023.0 / reading - 1.0);
   logR2 = log(R2);
@@ -136,6 +159,69 @@ int Thermometer::read(void)
   return((int)(T * 10.0));
 }
 
+//
+// buildTable() - run the curve for every THERM_TABLE_SHIFT'th reading
+//    so that convert() can interpolate. This is called any time the
+//    coefficients change (config() and loadConfig()).
+//
+//    The table is in RAM (rather than PROGMEM) because the curve can
+//    be changed over I2C - so it is kept to 33 entries. That is
+//    accurate to within 0.1 degrees from 50 to 120 degrees, and 0.3
+//    degrees for readings between 150 and 900, which covers anything
+//    the pool will see. Outside of that, the curve is so steep that
+//    the readings weren't meaningful anyway. Half as many entries
+//    would save 32 bytes, but be off by up to 0.5 degrees.
+//
+void Thermometer::buildTable()
+{
+  int i;
+  int adc;
+
+  for(i=0; i < THERM_TABLE_SIZE; i++) {
+    adc = i << THERM_TABLE_SHIFT;
+    if(adc > 1023) {
+      adc = 1023;
+    }
+    table[i] = curve(adc);
+  }
+}
+
+//
+// convert() - convert an ADC reading to tenths of degrees using the
+//    table and linear interpolation - all integer math.
+//
+int Thermometer::convert(int adc)
+{
+  return(convertFixed((unsigned int)adc << FILTER_FRACTION));
+}
+
+//
+// convertFixed() - same as convert(), but for a reading in 1/16ths of
+//    a count (what the filter gives) so the extra bits go into the
+//    interpolation rather than being thrown away.
+//
+#define FIXED_SHIFT	(THERM_TABLE_SHIFT + FILTER_FRACTION)
+
+int Thermometer::convertFixed(unsigned int fixed)
+{
+  int i = fixed >> FIXED_SHIFT;
+  long fraction = fixed & ((1 << FIXED_SHIFT) - 1);
+  long span = (long)table[i+1] - (long)table[i];
+
+  return(table[i] + (int)((span * fraction) >> FIXED_SHIFT));
+}
+
+//
+// floatBits() - a float as it is in memory, for the trace.
+//
+static unsigned long floatBits(float value)
+{
+  unsigned long bits;
+
+  memcpy(&bits,&value,4);
+  return(bits);
+}
+
 //
 // coefficients() - given a byte buffer from an I2C read, translate
 //    that information into coefficients, and then call config on
@@ -159,10 +245,9 @@ void Thermometer::coefficients(byte *buffer)
 
     SHcoefficients(tA,tB,tC,rA,rB,rC,&A,&B,&C);
 
-    Serial.println("Coefficients");
-    Serial.println(A,10);
-    Serial.println(B,10);
-    Serial.println(C,10);
+    TRACE_LONG_AT(TRACE_LEVEL_INFO,TRACE_THERM_A,myPin,floatBits(A));
+    TRACE_LONG_AT(TRACE_LEVEL_INFO,TRACE_THERM_B,myPin,floatBits(B));
+    TRACE_LONG_AT(TRACE_LEVEL_INFO,TRACE_THERM_C,myPin,floatBits(C));
     
     config(A,B,C);
 }
@@ -174,40 +259,17 @@ int Thermometer::readAVG()
 
 //
 // loop() - the purpose of the Thermometer loop is to read the thermometer
-//    and average the readings. It appears that they can jump about a bit.
-//    So we set the average reading count, and keep the local average up
-//    to date with the loop. Callers can ask for a reading or for the
-//    average.
+//    and filter the readings. It appears that they can jump about a bit.
+//    So the filter (see filter.cpp) throws out the spikes and averages
+//    the rest, and the loop keeps the converted average up to date.
+//    Callers can ask for a reading or for the average.
+//
+//    Readings come from the analog scanner every filter.period(), so
+//    the average only moves when a new one has arrived.
 //
 void Thermometer::loop()
 {
-  int i;
-  int reading;
-  int oldReading;
-
-  reading = read();	// get reading in tenths of degree
-  //  Serial.print(reading);
-  //  if(reading > 700) {
-  //    Serial.print(" **** ");
-  //  } else {
-  //    Serial.print(" ");
-  //  }
-
-  if(readingPointer == -1) {
-    // first reading, just fill the array
-    for(i=0; i < READINGS_FOR_AVERAGE; i++) {
-      readings[i] = reading;
-    }
-    readingPointer = 1;
-    readingAverage = reading;
-    readingTotal = READINGS_FOR_AVERAGE * reading;
-  } else {
-    oldReading = readings[readingPointer];
-    readings[readingPointer] = reading;
-    readingTotal = readingTotal - oldReading + reading;
-    readingAverage = readingTotal / READINGS_FOR_AVERAGE;
-    readingPointer = (readingPointer+1)%READINGS_FOR_AVERAGE;
+  if(filter.update()) {
+    readingAverage = convertFixed(filter.value());	// tenths of degree
   }
-
-  // Serial.println(readingAverage);
 }
@@ -7,21 +7,33 @@
 #ifndef THERMOMETER_H
 #define THERMOMETER_H
 
-#define READINGS_FOR_AVERAGE	20
+#define THERM_SAMPLE_PERIOD	100000UL	// micros between readings (10 Hz)
+
+// the conversion from ADC reading to temp is done with a table that
+//   has an entry every (1 << THERM_TABLE_SHIFT) readings, and linear
+//   interpolation in between - see buildTable()
+
+#define THERM_TABLE_SHIFT	5
+#define THERM_TABLE_SIZE	((1024 >> THERM_TABLE_SHIFT) + 1)
 
 #include <Arduino.h>
-#include "eeprom.h"
+#include "config.h"
+#include "filter.h"
 
-class Thermometer : public EEPROM_CONTROL {
+class Thermometer {
 
 public:
 
   Thermometer(int,int,int);
   void readI2C(byte *);	// this read is for I2C return - uses readAVG()
-  int read(void);	// return tenths of degrees (1000 => 100.0)
-  int readAVG(void);	// returns the average of the last READINGS_FOR_AVERAGE readings (use this)
+  int read(void);	// return tenths of degrees (1000 => 100.0) from the latest sample
+  int readAVG(void);	// returns the filtered reading (use this)
+  int convert(int);	// converts a raw reading (0-1023) to tenths of degrees
+  int convertFixed(unsigned int);	// same, for a filtered reading (1/16ths)
   void loop(void);	// used to keep the average up
 
+  Filter<5> filter;	// readings are oversampled, medianed, and averaged
+
   // coefficients can also be given, which will call config()
 
   void coefficients(byte *);
@@ -34,17 +46,22 @@ public:
 private:
   int myPin;
   float myResistor;	// this is kept as a float because that's how it is used
+  ThermometerConfig *myConfig;	// where the coefficients are kept
 
   // the following constants are used to convert the analog
   //   reading to a temp
      
   float c1,c2,c3;
 
-  // we need to average the temp readings so that the outlyers don't cause
+  // ...and these are those constants turned into a table of tenths
+  //   of degrees, rebuilt whenever the constants change
+
+  int table[THERM_TABLE_SIZE];
+  void buildTable(void);
+  int curve(int);	// the full Steinhart-Hart (float) conversion
+
+  // we need to filter the temp readings so that the outlyers don't cause
   //   heating to fast cycle
-  int readings[READINGS_FOR_AVERAGE];
-  int readingPointer;
-  long readingTotal;
   int readingAverage;
   void loadConfig(void);
 
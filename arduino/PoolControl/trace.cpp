@@ -0,0 +1,161 @@
+//
+// trace.cpp
+//
+//   The trace - a ring of the last TRACE_SIZE debugging records, each
+//   just an id (TraceIds), a device number, a 16 bit argument, and the
+//   low 16 bits of millis. It replaces printing to Serial, which at
+//   9600 baud held up whatever was printing once the transmit buffer
+//   filled - a millisecond a character.
+//
+//   Adding a record never waits. If the ring is full the oldest record
+//   is dropped, and the gap in sequence numbers shows it. The records
+//   go out as they fit:
+//
+//     - out Serial (if TRACE_SERIAL is defined), from loop(), only as
+//       much as the transmit buffer has room for
+//     - or read over I2C (the trace register), whatever hasn't been
+//       sent out Serial
+//
+//   Either way, each record is sent as TRACE_WIRE_SIZE bytes:
+//
+//      SYNC  seq   id  device  arg hi  arg lo  time hi  time lo
+//     |-----|-----|-----|-----|-------|-------|--------|--------|
+//
+//   and host/tracedump turns them back into text.
+//
+//   Which records are compiled in at all is up to TRACE_LEVEL (see
+//   trace.h) - the macros for the levels above it are empty.
+//
+
+#include "trace.h"
+
+struct TraceRecord {
+  byte		id;
+  byte		device;
+  int		arg;
+  uint16_t	time;			// millis (the low 16 bits)
+};
+
+static TraceRecord trace[TRACE_SIZE];
+static volatile byte newest;		// sequence of the newest record
+static volatile byte held;		// number of records in the ring
+static volatile byte sent;		// sequence of the last record sent
+
+#define TRACE_SLOT(seq)		((seq) & (TRACE_SIZE-1))
+
+//
+// traceAdd() - add a record, overwriting the oldest if the ring is
+//    full. Interrupts must be off.
+//
+static void traceAdd(byte id, byte device, int arg, uint16_t time)
+{
+  TraceRecord *record;
+
+  record = &trace[TRACE_SLOT((byte)(newest + 1))];
+  record->id = id;
+  record->device = device;
+  record->arg = arg;
+  record->time = time;
+  newest++;
+  if(held < TRACE_SIZE) {
+    held++;
+  }
+}
+
+void TraceLog(byte id, byte device, int arg)
+{
+  uint16_t now = millis();
+
+  noInterrupts();
+  traceAdd(id,device,arg,now);
+  interrupts();
+}
+
+//
+// TraceLong() - a record with a 32 bit argument: the high 16 bits in
+//    this one, and the low ones in a TRACE_MORE right after it.
+//
+void TraceLong(byte id, byte device, unsigned long value)
+{
+  uint16_t now = millis();
+
+  noInterrupts();
+  traceAdd(id,device,(int)(value >> 16),now);
+  traceAdd(TRACE_MORE,device,(int)(value & 0xffff),now);
+  interrupts();
+}
+
+//
+// traceNext() - puts the next record that hasn't been sent into the
+//    buffer as it goes on the wire, and moves past it. Returns false if
+//    everything has been sent. Interrupts must be off.
+//
+static bool traceNext(byte *buffer)
+{
+  TraceRecord *record;
+
+  if((byte)(newest - sent) > held) {	// overwritten
+    sent = newest - held;
+  }
+  if(sent == newest) {
+    return(false);
+  }
+
+  sent++;
+  record = &trace[TRACE_SLOT(sent)];
+  buffer[0] = TRACE_SYNC;
+  buffer[1] = sent;
+  buffer[2] = record->id;
+  buffer[3] = record->device;
+  buffer[4] = (record->arg >> 8) & 0xff;
+  buffer[5] = record->arg & 0xff;
+  buffer[6] = (record->time >> 8) & 0xff;
+  buffer[7] = record->time & 0xff;
+  return(true);
+}
+
+//
+// TraceDrain() - send records out Serial as long as they fit in the
+//    transmit buffer without waiting. Called from loop().
+//
+void TraceDrain(void)
+{
+#ifdef TRACE_SERIAL
+  byte buffer[TRACE_WIRE_SIZE];
+  bool more;
+  int i;
+
+  while(Serial.availableForWrite() >= TRACE_WIRE_SIZE) {
+    noInterrupts();
+    more = traceNext(buffer);
+    interrupts();
+    if(!more) {
+      break;
+    }
+    for(i=0; i < TRACE_WIRE_SIZE; i++) {
+      Serial.write(buffer[i]);
+    }
+  }
+#endif
+}
+
+//
+// TraceFrame() - the trace register: the number of records, and then
+//    as many of the records that haven't been sent as fit. Called from
+//    the TWI ISR.
+//
+//        count   record    record    ...
+//      |-------|---------|---------|-----
+//
+int TraceFrame(byte *frame, int size)
+{
+  int count = 0;
+  int offset = 1;
+
+  while(offset + TRACE_WIRE_SIZE <= size && traceNext(&frame[offset])) {
+    offset += TRACE_WIRE_SIZE;
+    count++;
+  }
+  frame[0] = count;
+  return(offset);
+}
@@ -0,0 +1,74 @@
+//
+// trace.h
+//
+//   (see trace.cpp for information about the trace)
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+#define TRACE_SIZE		16	// records kept - a power of 2, up to 128
+					//   (6 bytes of RAM each) - the boot and
+					//   a calibration of both valves log 11
+// #define TRACE_SERIAL			// drained out Serial from loop() too - this
+					//   links in Serial, and its buffers take
+					//   about 175 bytes of RAM (the host build
+					//   defines it)
+#define TRACE_SYNC		0xa5	// first byte of each record sent
+#define TRACE_WIRE_SIZE		8	//   and the size of one
+
+// severity - a trace less severe than TRACE_LEVEL (a higher number)
+//   isn't compiled in
+
+#define TRACE_LEVEL_ERROR	1
+#define TRACE_LEVEL_WARN	2
+#define TRACE_LEVEL_INFO	3
+#define TRACE_LEVEL_DEBUG	4
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL		TRACE_LEVEL_INFO
+#endif
+
+// what a record is about - the device number and argument depend on
+//   it. The ones marked "long" are followed by a TRACE_MORE with the low
+//   16 bits. Keep host/tracedump.cpp in step with these.
+
+enum TraceIds {
+  TRACE_MORE = 0,		// low 16 bits of the long before it
+  TRACE_BOOT = 1,		// control is up - argument is the firmware version
+  TRACE_VALVE_STATE = 2,	// valve [n] entered a state
+  TRACE_VALVE_CALIBRATE = 3,	// valve [n] calibration started
+  TRACE_VALVE_LIMIT = 4,	// valve [n] reached a limit - 1 positive, 2 negative
+  TRACE_VALVE_UP = 5,		// valve [n] travel up (long, micros)
+  TRACE_VALVE_DOWN = 6,		// valve [n] travel down (long, micros)
+  TRACE_VALVE_CURRENT = 7,	// valve [n] idle current benchmark
+  TRACE_PUMP_INIT = 8,		// pump on (red relay) pin [n] set-up - argument is its status
+  TRACE_PUMP_SPEED = 9,		// pump on pin [n] speed set
+  TRACE_THERM_A = 10,		// thermometer on pin [n] coefficients (long, float bits)
+  TRACE_THERM_B = 11,
+  TRACE_THERM_C = 12,
+  TRACE_HEATER_SET = 13,	// heater [n] set temperature (tenths)
+  TRACE_FACTORY_RESET = 14,	// factory reset
+  TRACE_UNSUPPORTED = 15,	// write to a register that does nothing - argument is the register
+  TRACE_VALVE_FAIL = 16,	// valve [n] gave up on a state - argument is the state
+  TRACE_IDS = 17
+};
+
+extern void TraceLog(byte,byte,int);		// add a record (id, device, argument)
+extern void TraceLong(byte,byte,unsigned long);	//   and one with a long argument
+extern void TraceDrain(void);			// send what will fit out Serial
+extern int TraceFrame(byte *,int);		// records for the I2C register
+
+#define TRACE_AT(level,id,device,arg) \
+  do { if((level) <= TRACE_LEVEL) TraceLog((id),(device),(arg)); } while(0)
+#define TRACE_LONG_AT(level,id,device,value) \
+  do { if((level) <= TRACE_LEVEL) TraceLong((id),(device),(value)); } while(0)
+
+#define TRACE_ERROR(id,device,arg)	TRACE_AT(TRACE_LEVEL_ERROR,id,device,arg)
+#define TRACE_WARN(id,device,arg)	TRACE_AT(TRACE_LEVEL_WARN,id,device,arg)
+#define TRACE_INFO(id,device,arg)	TRACE_AT(TRACE_LEVEL_INFO,id,device,arg)
+#define TRACE_DEBUG(id,device,arg)	TRACE_AT(TRACE_LEVEL_DEBUG,id,device,arg)
+
+#endif // TRACE_H
@@ -18,13 +18,21 @@
 //       right now - but it is there and gets stored
 //
 //     - the current position of the valve is always put into EEPROM
-//       so that a power fail doesn't forget where the valve is
+//       so that a power fail doesn't forget where the valve is. Since
+//       this is written on every move, it goes into a wear-leveled
+//       ring of records (EEPROM_RING) rather than the valve's config
 //
 //     - the calibrated travel time (clockwise and counter)
 //
+//   The limits and travel times are the valve's part of the config
+//   image (see config.cpp).
+//
 
 #include <Arduino.h>
 #include "valve.h"
+#include "events.h"
+#include "trace.h"
+#include "EEPROM.h"		// (local) for the position log size
 #include <EEPROM.h>
 
 // Default values for EEPROM-stored data
@@ -36,15 +44,6 @@
 #define DEFAULT_DOWN_TIME    5000000L
 #define DEFAULT_POSITION    0
 
-// Since valves stored multiple categories of data, the config/store
-//   routines need different offsets - one after the other
-
-#define TRAVEL_TIMES_OFFSET	0
-#define TRAVEL_TIMES_SIZE	(sizeof(unsigned long)*2)
-#define TRAVEL_LIMITS_OFFSET	(TRAVEL_TIMES_OFFSET + TRAVEL_TIMES_SIZE)
-#define TRAVEL_LIMITS_SIZE	(sizeof(int)*2)
-#define POSITION_OFFSET		(TRAVEL_LIMITS_OFFSET + TRAVEL_LIMITS_SIZE)
-
 // go ahead and adjust these two values if the relays change
 #define RELAY_ON	LOW
 #define RELAY_OFF	HIGH
@@ -105,72 +104,191 @@ void Valve::travelTime(byte *buffer)
 }
   
 
-void Valve::stateSwitch(ValveStates newState)
-{
-  stateSwitch(newState,0UL);
-}
+//
+// The state machine is a table (steps[], in flash) of what to do on
+//   entering each state and how to leave it - see ValveStep in valve.h.
+//   The actions are small members that do the work of one state (turn
+//   relays on or off, take a reading, work out a time) and the checks
+//   are ones that watch for something (like the current dropping).
+//
+//   Only an active valve runs the table at all (see loop()).
+//
 
-void Valve::stateSwitch(ValveStates newState, unsigned long delay)
+//
+// stateSwitch() - go to the given state on the next run. This is how
+//    calibrate(), move() and such start the state machine.
+//
+void Valve::stateSwitch(ValveStates newState)
 {
-  //  Serial.print("->"); Serial.println((int)newState);
   state_next = newState;
-  state_delay = delay;
 }
 
-void Valve::stateTimeout(ValveStates newState, unsigned long timeout)
+//
+// stateTime() - for an enter action to give its state a different time
+//    (micros) than the table does - like a move's time budget.
+//
+void Valve::stateTime(unsigned long time)
 {
-  state_failure = newState;
-  state_timeout = timeout;
+  state_time = time;
 }
 
 //
-// ::stateUpdate() - checks for delays and timeouts, updating the
-//    state if appropriate.
-//    Returns 1/true if the state machine chould continue, or
-//    0/false if not. This is used so that states issueing a
-//    "next state" don't continue to process.
+// stateFind() - the steps[] row for the given state, or -1 if it isn't
+//    in the table (like INACTIVE).
 //
-int Valve::stateUpdate()
+static int stateFind(const ValveStep *steps, ValveStates state)
 {
-  unsigned long currentMicros = micros();
-  unsigned long since = currentMicros - state_lastSwitch;
+  int i;
 
-  //  Serial.print("Since:");
-  //  Serial.println(since);
-  
-  //  Serial.print("Delay:");
-  //  Serial.println((unsigned long)state_delay);
-  
-  if(state_delay != 0UL && since < state_delay) {// move to next state if it's time
-    return(false);				//   otherwise indicate waiting
+  for(i=0; i < VALVE_STEPS; i++) {
+    if((ValveStates)pgm_read_byte(&steps[i].state) == state) {
+      return(i);
+    }
   }
+  return(-1);
+}
+
+//
+// stepLong() - a time or timeout of a steps[] row, from flash.
+//
+static unsigned long stepLong(const unsigned long *at)
+{
+  unsigned long value;
 
-  state_delay = 0UL;
+  memcpy_P(&value,at,sizeof(value));
+  return(value);
+}
 
-  // first, are we looking to switch states
-  if(state_next != state_current) {
+//
+// stateEnter() - leave the current state for the given one. Its enter
+//    action is run, and if that says to go somewhere else - or if the
+//    state has nothing to wait for - that is entered right away too.
+//
+//    With VALVE_PROFILE, the time spent in each state (in millis, up
+//    to 65535) is kept in state_dwell[]. Every state change goes in the
+//    event log.
+//
+void Valve::stateEnter(ValveStates state)
+{
+#ifdef VALVE_PROFILE
+  unsigned long dwell;
+#endif
+  ValveStates go;
+  byte waits;
+  int hops;
+
+  for(hops = 0; hops < VALVE_STEPS; hops++) {
+
+    if(state_row >= 0) {
+#ifdef VALVE_PROFILE
+      dwell = (micros() - state_lastSwitch) / 1000UL;
+      state_dwell[state_row] = (dwell > 0xffffUL)?0xffff:(uint16_t)dwell;
+#endif
+      go = (ValveStates)pgm_read_byte(&steps[state_row].then);
+      if(go != ValveStates::NONE) {
+	state_return = go;			// calling a sub-machine
+      }
+    }
+    if(state == ValveStates::RETURN) {
+      state = state_return;
+    }
 
     state_prev = state_current;
-    state_current = state_next;
-    state_delay = 0;
-    state_timeout = 0;
-    state_lastSwitch = currentMicros;
+    state_current = state_next = state;
+    state_lastSwitch = micros();
+    EventLog(EVENT_VALVE,myIndex,(int)state_current);
+    TRACE_DEBUG(TRACE_VALVE_STATE,myIndex,(int)state_current);
 
-  } else {
-    // no state change requested, check timeout
-    if(state_timeout > 0 && since >= state_timeout) {
-      state_prev = state_current;
-      state_current = state_failure;
-      state_delay = 0;
-      state_timeout = 0;
-      state_lastSwitch = currentMicros;
+    if((state_row = stateFind(steps,state)) < 0) {
+      return;
+    }
+    state_time = stepLong(&steps[state_row].time);
+
+    // the row's members are only read into their own blocks, so that
+    //   they can share the stack
+
+    {
+      int (Valve::*check)(void);
+
+      memcpy_P(&check,&steps[state_row].check,sizeof(check));
+      waits = check?true:false;
+    }
+
+    go = ValveStates::NONE;
+    if(waits && stepLong(&steps[state_row].timeout) == 0) {
+      go = ValveStates::SEEK_FAIL;		// table error - it could wait forever
+    } else {
+      ValveStates (Valve::*enter)(void);
+
+      memcpy_P(&enter,&steps[state_row].enter,sizeof(enter));
+      if(enter) {
+	go = (this->*enter)();
+      }
     }
+    if(go == ValveStates::NONE) {
+      if(waits || state_time != 0) {
+	return;					// something to wait for
+      }
+      go = (ValveStates)pgm_read_byte(&steps[state_row].next);
+    }
+    state = go;
   }
+}
 
-  return(true);
-  
+//
+// stateRun() - one run of the state machine: a state asked for by
+//    stateSwitch() is entered, otherwise the current state's check is
+//    made and its time and timeout looked at. The row is read from
+//    flash each time rather than kept, as RAM is shorter than time -
+//    and only the fields needed, as a whole row on the stack is the
+//    deepest part of loop() (stateEnter() does the same).
+//
+void Valve::stateRun()
+{
+  int (Valve::*check)(void);
+  unsigned long spent;
+
+  if(state_next != state_current) {
+    stateEnter(state_next);
+    return;
+  }
+  if(state_row < 0) {
+    return;
+  }
+  memcpy_P(&check,&steps[state_row].check,sizeof(check));
+  if(check && (this->*check)()) {
+    stateEnter((ValveStates)pgm_read_byte(&steps[state_row].branch));
+    return;
+  }
+  spent = micros() - state_lastSwitch;
+  if((state_time != 0 || !check) && spent >= state_time) {
+    stateEnter((ValveStates)pgm_read_byte(&steps[state_row].next));
+  } else if(check && spent >= stepLong(&steps[state_row].timeout)) {
+    stateEnter((ValveStates)pgm_read_byte(&steps[state_row].fail));
+  }
 }
 
+#ifdef VALVE_PROFILE
+//
+// dwellGet() - how long each state took the last time the valve was in
+//    it, for profiling. The states are read VALVE_DWELL_PAGE at a time
+//    (page is 0 on up) as 3 bytes each - the state and the millis (2,
+//    big endian). Returns the number of bytes, which is 0 past the end.
+//
+int Valve::dwellGet(int page, byte *buffer)
+{
+  int count = 0;
+  int i;
+
+  for(i=page * VALVE_DWELL_PAGE; i < VALVE_STEPS && i < (page + 1) * VALVE_DWELL_PAGE; i++) {
+    buffer[count++] = pgm_read_byte(&steps[i].state);
+    buffer[count++] = (byte)(state_dwell[i] >> 8);
+    buffer[count++] = (byte)(state_dwell[i] & 0xff);
+  }
+  return(count);
+}
+#endif
+
 //
 // relayControl() - controls the given relay where:
 //    relayPin - set to tiehter pinON or pinDIR for that relay
@@ -194,29 +312,40 @@ void Valve::relayControl(int relayPin, int onoff)
 //    forward & reverse current, with one between 0 and 2.5v and the
 //    other between 2.5 and 5v.
 //
+//    The reading comes from currentFilter, which only samples the
+//    valve while it is doing something (see loop()). By default it
+//    is a median of 3 (a relay closing can throw a spike) and a short
+//    average of 4 samples - a few millis, well inside of the limit
+//    detection's VALVE_LIMIT_SETTLE.
+//
 int Valve::readCurrent(void)
 {
-  int current = analogRead(pinMONITOR);// between 0 and 1023 inclusive;
-
-  return(current);
+  return(currentFilter.value() >> FILTER_FRACTION);	// between 0 and 1023 inclusive
 }
 
+static const FilterSettings valveFilter = { 0, 3, 2, VALVE_SAMPLE_PERIOD };
+
 //
 // Valve() - (constructor) Creates a new valve that can be controlled.
 //    ARGS:
 //       onPin - the digital pin controlling the "on" relay
 //       dirPin - the digital pin controlling the "direction" relay
 //       monitorPin - the analog pin monitoring valve movement
-//       min - the degrees where the minimum stop is
-//       max - the degrees where the maximum stop is (should be bigger than min)
+//       configIndex - which of the config image's valves is this one
+//       logAddress - where the ring of position records is kept
 //      
-Valve::Valve(int onPin, int dirPin, int monitorPin, int eepromAddress) : EEPROM_CONTROL(eepromAddress)
+Valve::Valve(int onPin, int dirPin, int monitorPin, int configIndex, int logAddress) :
+  currentFilter(monitorPin,&valveFilter),	// off until there is something to do
+  positionLog(logAddress,VALVE_POSITION_LOG_RECORDS)
 {
+  myIndex = configIndex;
   pinON = onPin;
   pinDIR = dirPin;
   pinMONITOR = monitorPin;
+  myConfig = &Config()->valve[configIndex];
+  timedMoves = VALVE_VERIFY_TRUST;	// the logged position may be from before a move
 
-  if(!eepromHasBeenSet()) {
+  if(!ConfigValid()) {
     configTravelTimes(DEFAULT_UP_TIME,DEFAULT_DOWN_TIME);
     configTravelLimits(DEFAULT_MIN_DEG,DEFAULT_MAX_DEG);
     configPosition(DEFAULT_POSITION);
@@ -235,10 +364,16 @@ Valve::Valve(int onPin, int dirPin, int monitorPin, int eepromAddress) : EEPROM_
   state_current = ValveStates::INACTIVE;
   state_next = ValveStates::INACTIVE;
   state_prev = ValveStates::INACTIVE;
-  state_timeout = 0;
-  state_delay = 0;
+  state_return = ValveStates::INACTIVE;
+  state_row = -1;
+  state_time = 0;
+  state_lastSwitch = 0;
+#ifdef VALVE_PROFILE
+  memset(state_dwell,0,sizeof(state_dwell));
+#endif
 
   currentBenchmark = 0;		// useless default
+  limitSeek = false;
 }
 
 //
@@ -246,8 +381,6 @@ Valve::Valve(int onPin, int dirPin, int monitorPin, int eepromAddress) : EEPROM_
 //
 void Valve::configTravelLimits(int min, int max)
 {
-  int offset = TRAVEL_LIMITS_OFFSET;
-
   if(min < max) {
     degMIN = min;
     degMAX = max;
@@ -256,48 +389,48 @@ void Valve::configTravelLimits(int min, int max)
     degMAX = min;
   }
 
-  offset += eepromWrite(offset,degMIN);
-  offset += eepromWrite(offset,degMAX);
+  myConfig->limitMin = degMIN;
+  myConfig->limitMax = degMAX;
+  ConfigChanged();
 }
 void Valve::loadTravelLimits()
 {
-  int offset = TRAVEL_LIMITS_OFFSET;
-
-  offset += eepromRead(offset,&degMIN);
-  offset += eepromRead(offset,&degMAX);
+  degMIN = myConfig->limitMin;
+  degMAX = myConfig->limitMax;
 }
 
 void Valve::configTravelTimes(unsigned long up, unsigned long down)
 {
-  int offset = TRAVEL_TIMES_OFFSET;
-
   pos_time = up;
   neg_time = down;
 
-  offset += eepromWrite(offset,pos_time);
-  offset += eepromWrite(offset,neg_time);
+  myConfig->travelUp = pos_time;
+  myConfig->travelDown = neg_time;
+  ConfigChanged();
 }
 void Valve::loadTravelTimes()
 {
-  int offset = TRAVEL_TIMES_OFFSET;
-
-  offset += eepromRead(offset,&pos_time);
-  offset += eepromRead(offset,&neg_time);
+  pos_time = myConfig->travelUp;
+  neg_time = myConfig->travelDown;
 }
 
 void Valve::configPosition(int pos)
 {
-  int offset = POSITION_OFFSET;
-
   degNOW = pos;
 
-  offset += eepromWrite(offset,degNOW);
+  positionLog.write(degNOW);
 }
+
+//
+// loadPosition() - the position comes from the newest record in the
+//    position log. If the log has never been written, the valve is
+//    taken to be at the default position.
+//
 void Valve::loadPosition()
 {
-  int offset = POSITION_OFFSET;
-
-  offset += eepromRead(offset,&degNOW);
+  if(!positionLog.read(&degNOW)) {
+    degNOW = DEFAULT_POSITION;
+  }
 }
 
 //
@@ -306,372 +439,544 @@ void Valve::loadPosition()
 //    the loop() routine being called repeatedly allows the calibration
 //    to complete. This should be called quite often.
 //
-// calibrate states
-// - turn off all relays, and wait for 1/2 second
-// - take current reading, setting that as "quiescent" - turn on CW and power relays - wait 1/10 sec
-//  - note that the motor takes time for power-up, so the current reading should be delayed
-//- take current reading, if within 10% quiescent - next state - other wise repeat
-
 void Valve::loop()
 {
-  if(stateUpdate()) {	// updates state as needed, false if waiting
-    calibrationLoop();
-    movementLoop();
+  // the current is only sampled - and the state machine only run -
+  //   when the valve is doing something
+
+  currentFilter.enable(active());
+  if(!active()) {
+    return;
   }
+  currentFilter.update();
+  stateRun();
+}
+
+//
+// active() - returns true if the valve is in the middle of something
+//    (or about to be) - as opposed to sitting there INACTIVE.
+//
+int Valve::active()
+{
+  return(state_current != ValveStates::INACTIVE || state_next != ValveStates::INACTIVE);
 }
 
 //
 // calibrate() - used to "calibrate" a valve by running it to one stop,
 //    then to the other, measuring the time it takes to get to the
-//    second stop from the first. For this version, we are assuming
-//    that the motor has the same speed in getting from the first
-//    stop to the second.
+//    second stop from the first, and then back again.
 //
-//    Note that it can take many seconds to do a full travel, so the
-//    MS can be (probably) in the tens of thousands, which is just fine
-//    for an int.
-//
-//    This routine uses its own state machine to maintain its operation
-//    when the calibrationLoop() is repeatedly called.
+//    It starts with a wiggle (3 seconds each way) to get the valve
+//    moving, then each of the three runs is the seek sub-machine
+//    (CALIBRATE_BENCHMARK to CALIBRATE_LIMITSEEK2) going the way that
+//    seekDir says - benchmark the idle current, turn the motor on and
+//    wait out the spin-up, then wait for the current to come back
+//    within 20% of idle and stay there for 100ms.
 //
 void Valve::calibrate()
 {
+  limitSeek = false;
   stateSwitch(ValveStates::CALIBRATE_START);
 }
 
-int Valve::calibrationComplete()
+//
+// verify() - a quick check of the calibration, for routine use. It
+//    times a traverse to the farther stop, the way a limit move does
+//    (see limitReached()), and compares it to the calibrated time for
+//    that many degrees. If that is within VALVE_VERIFY_DRIFT percent,
+//    the calibration is kept - nudged toward what was measured -
+//    otherwise it falls back to the full calibrate().
+//
+//    The traverse starts from where the valve is if its position can
+//    be trusted (see VALVE_VERIFY_TRUST) - that is at least half of
+//    the travel, and takes no more than a full traverse. Otherwise it
+//    runs to the nearer stop first, and times the whole way across.
+//
+//    A valve that has never been calibrated just gets calibrate().
+//
+void Valve::verify()
 {
-  return(1);
+  limitSeek = false;
+  if(pos_time == DEFAULT_UP_TIME && neg_time == DEFAULT_DOWN_TIME) {
+    stateSwitch(ValveStates::CALIBRATE_START);
+  } else {
+    stateSwitch(ValveStates::CALIBRATE_VERIFY);
+  }
 }
 
 //
-// calibrationLoop() - (see calibrate() for information on the process)
-//      Needs to be called repeatedly/quickly to maintain the process
-//      of calibration. The state machine for calibration is maintained
-//      and updated here.
+// move() - given a target degrees, move there.
+//   The limits are special cased, in that they can be used
+//   to reset the positioning accuracy.
 //
-//      You *could* call this only when in a calibration process, but
-//      since it only reacts to calibration states, you can call it any
-//      time really.
+void Valve::move(int target)
+{
+  limitSeek = false;
+  degTARGET = target;
+  if(target == degMIN) {
+    stateSwitch(ValveStates::MOVE_LIMIT_LOW);
+  } else if(target == degMAX) {
+    stateSwitch(ValveStates::MOVE_LIMIT_HIGH);
+  } else {
+    stateSwitch(ValveStates::MOVE_TARGET);
+  }
+}
+
 //
-void Valve::calibrationLoop()
+// steps[] - the state table (see ValveStep in valve.h).
+//
+
+#define S(x)	ValveStates::x
+#define A(x)	&Valve::x
+
+const ValveStep Valve::steps[VALVE_STEPS] PROGMEM = {
+
+  //  state                    enter             check            time      next            branch          timeout   fail            then
+
+  // calibration
+
+  { S(CALIBRATE_START),        A(calStart),      NULL,            100000UL, S(CALIBRATE_START2), S(NONE),   0UL,      S(NONE),        S(NONE) },
+  { S(CALIBRATE_START2),       A(calNegative),   NULL,            3000000UL,S(CALIBRATE_START3), S(NONE),   0UL,      S(NONE),        S(NONE) },
+  { S(CALIBRATE_START3),       A(calPositive),   NULL,            3000000UL,S(CALIBRATE_START4), S(NONE),   0UL,      S(NONE),        S(NONE) },
+  { S(CALIBRATE_START4),       A(calQuiet),      NULL,            100000UL, S(CALIBRATE_BENCHMARK), S(NONE), 0UL,     S(NONE),        S(CALIBRATE_LIMIT) },
+  { S(CALIBRATE_LIMIT),        A(calLimit),      NULL,            100000UL, S(CALIBRATE_BENCHMARK), S(NONE), 0UL,     S(NONE),        S(CALIBRATE_LIMIT2) },
+  { S(CALIBRATE_LIMIT2),       A(calLimit2),     NULL,            100000UL, S(CALIBRATE_BENCHMARK), S(NONE), 0UL,     S(NONE),        S(CALIBRATE_LIMIT3) },
+  { S(CALIBRATE_LIMIT3),       A(calLimit3),     NULL,            0UL,      S(INACTIVE),      S(NONE),        0UL,      S(NONE),        S(NONE) },
+
+  // the seek sub-machine - to the stop that seekDir says
+
+  { S(CALIBRATE_BENCHMARK),    A(seekBenchmark), NULL,            0UL,      S(CALIBRATE_INITIATE), S(NONE), 0UL,      S(NONE),        S(NONE) },
+  { S(CALIBRATE_INITIATE),     A(seekInitiate),  NULL,            VALVE_SPINUP, S(CALIBRATE_LIMITSEEK1), S(NONE), 0UL,  S(NONE),        S(NONE) },
+  { S(CALIBRATE_LIMITSEEK1),   NULL,             A(seekIdle),     0UL,      S(NONE),         S(CALIBRATE_LIMITSEEK2), VALVE_STATE_TIMEOUT, S(SEEK_FAIL), S(NONE) },
+  { S(CALIBRATE_LIMITSEEK2),   NULL,             A(seekBusy),     VALVE_LIMIT_SETTLE, S(RETURN), S(CALIBRATE_LIMITSEEK1), VALVE_STATE_TIMEOUT, S(SEEK_FAIL), S(NONE) },
+
+  // quick verify
+
+  { S(CALIBRATE_VERIFY),       A(verifyBegin),   NULL,            VALVE_LIMIT_SETTLE, S(CALIBRATE_VERIFY_SEEK), S(NONE), 0UL, S(NONE),   S(NONE) },
+  { S(CALIBRATE_VERIFY_SEEK),  A(verifySeek),    A(limitCheck),   0UL,      S(CALIBRATE_VERIFY_LIMIT), S(CALIBRATE_VERIFY_LIMIT), VALVE_STATE_TIMEOUT, S(SEEK_FAIL), S(NONE) },
+  { S(CALIBRATE_VERIFY_LIMIT), A(verifyLimit),   NULL,            VALVE_LIMIT_SETTLE, S(CALIBRATE_VERIFY_TIMED), S(NONE), 0UL, S(NONE),   S(NONE) },
+  { S(CALIBRATE_VERIFY_TIMED), A(verifyTimed),   A(limitCheck),   0UL,      S(CALIBRATE_START), S(CALIBRATE_VERIFY_CHECK), VALVE_STATE_TIMEOUT, S(SEEK_FAIL), S(NONE) },
+  { S(CALIBRATE_VERIFY_CHECK), A(verifyCheck),   NULL,            0UL,      S(INACTIVE),      S(NONE),        0UL,      S(NONE),        S(NONE) },
+
+  // moves
+
+  { S(MOVE_LIMIT_LOW),         A(moveLow),       NULL,            0UL,      S(MOVE_TARGET),   S(NONE),        0UL,      S(NONE),        S(NONE) },
+  { S(MOVE_LIMIT_HIGH),        A(moveHigh),      NULL,            0UL,      S(MOVE_TARGET),   S(NONE),        0UL,      S(NONE),        S(NONE) },
+  { S(MOVE_TARGET),            A(moveTarget),    NULL,            0UL,      S(MOVE_TARGET_PROCESS), S(NONE),  0UL,      S(NONE),        S(NONE) },
+  { S(MOVE_TARGET_BENCHMARK),  NULL,             NULL,            VALVE_LIMIT_SETTLE, S(MOVE_TARGET_PROCESS), S(NONE), 0UL, S(NONE),  S(NONE) },
+  { S(MOVE_TARGET_PROCESS),    A(moveBegin),     A(moveCheck),    0UL,      S(MOVE_TARGET_DONE), S(MOVE_TARGET_DONE), VALVE_STATE_TIMEOUT, S(SEEK_FAIL), S(NONE) },
+  { S(MOVE_TARGET_DONE),       A(moveDone),      NULL,            0UL,      S(INACTIVE),      S(NONE),        0UL,      S(NONE),        S(NONE) },
+
+  // a state with a check that ran out of time (or had none)
+
+  { S(SEEK_FAIL),              A(seekFail),      NULL,            0UL,      S(INACTIVE),      S(NONE),        0UL,      S(NONE),        S(NONE) }
+};
+
+#undef S
+#undef A
+
+// CALIBRATION
+
+ValveStates Valve::calStart()
 {
-  // potentially used later, takes just a bit of time
-  //   to set them up now - putting them in the case statement breaks it!
+  limitSeek = false;			// (verify can fall back to here)
+  relayControl(pinON,RELAY_OFF);	// ensure off for .1 seconds
+  TRACE_INFO(TRACE_VALVE_CALIBRATE,myIndex,0);
+  return(ValveStates::NONE);
+}
 
-  // BIG NOTE - the calibrationLoop() runs continuously (obviously) which
-  //   means that by the time it is needed, the currentBenchmark has been
-  //   set, allowing appropriate usage of the three derivative measures.
-  
-  int tolerance = currentBenchmark / 5;		// 20% tolerance - seems high...
-  int lowBracket = currentBenchmark - tolerance;
-  int highBracket = currentBenchmark + tolerance;
-  
+ValveStates Valve::calNegative()
+{
+  relayControl(pinDIR,DIR_NEGATIVE);	// run negative for 3 seconds
+  relayControl(pinON,RELAY_ON);
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::calPositive()
+{
+  relayControl(pinDIR,DIR_POSITIVE);	// run positive for 3 seconds
+  relayControl(pinON,RELAY_ON);
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::calQuiet()
+{
+  relayControl(pinON,RELAY_OFF);	// ensure off for .1 seconds
+  seekDir = DIR_NEGATIVE;		//   then get to the lower limit
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::calLimit()
+{
+  TRACE_DEBUG(TRACE_VALVE_LIMIT,myIndex,2);
+  relayControl(pinON,RELAY_OFF);
+  seekDir = DIR_POSITIVE;		// to the positive limit, timing it
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::calLimit2()
+{
+  TRACE_DEBUG(TRACE_VALVE_LIMIT,myIndex,1);
+  relayControl(pinON,RELAY_OFF);
+  pos_time = micros() - seekStart;
+  degNOW = degMAX;			// just for illustration - doesn't play a role here
+  seekDir = DIR_NEGATIVE;		// (back) to the lower limit, timing it
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::calLimit3()
+{
+  configPosition(degMIN);
+  timedMoves = 0;
+  TRACE_DEBUG(TRACE_VALVE_LIMIT,myIndex,2);
+  relayControl(pinON,RELAY_OFF);
+  configTravelTimes(pos_time,micros() - seekStart);
+  TRACE_LONG_AT(TRACE_LEVEL_INFO,TRACE_VALVE_UP,myIndex,pos_time);
+  TRACE_LONG_AT(TRACE_LEVEL_INFO,TRACE_VALVE_DOWN,myIndex,neg_time);
+  return(ValveStates::NONE);
+}
+
+// the seek sub-machine
+
+ValveStates Valve::seekBenchmark()
+{
+  currentBenchmark = readCurrent();
+  TRACE_DEBUG(TRACE_VALVE_CURRENT,myIndex,currentBenchmark);
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::seekInitiate()
+{
+  seekStart = micros();
+  relayControl(pinDIR,seekDir);
+  relayControl(pinON,RELAY_ON);
+  return(ValveStates::NONE);
+}
+
+//
+// seekIdle() - true when the current is back within 20% of the idle
+//    benchmark (which seems high...) - and seekBusy() when it isn't.
+//
+int Valve::seekIdle()
+{
+  int tolerance = currentBenchmark / 5;
   int current = readCurrent();
 
-#define USING_CURRENT (current >= highBracket || current <= lowBracket)
-  
-  //  Serial.print("::"); Serial.print((int)state_current); Serial.println("::");
-  
-  switch(state_current) {
-    
-  case ValveStates::CALIBRATE_START:
-    relayControl(pinON,RELAY_OFF);	// ensure off for .1 seconds
-    Serial.println("Starting");
-    stateSwitch(ValveStates::CALIBRATE_START2,100000UL);
-    break;
-
-  case ValveStates::CALIBRATE_START2:
-    relayControl(pinDIR,DIR_NEGATIVE);		// run negative for 3 seconds
-    relayControl(pinON,RELAY_ON);
-    Serial.println("one second negative");
-    stateSwitch(ValveStates::CALIBRATE_START3,3000000UL);
-    break;
-
-  case ValveStates::CALIBRATE_START3:
-    relayControl(pinDIR,DIR_POSITIVE);
-    relayControl(pinON,RELAY_ON);		// run positive for 3 second
-    Serial.println("one second positive");
-    stateSwitch(ValveStates::CALIBRATE_START4,3000000UL);
-    break;
-
-  case ValveStates::CALIBRATE_START4:
-    relayControl(pinON,RELAY_OFF);		// ensure off for .1 seconds
-    stateSwitch(ValveStates::CALIBRATE_BENCHMARK,100000UL);
-    break;
-
-  // PHASE I - get to the lower limit
-    
-  case ValveStates::CALIBRATE_BENCHMARK:
-    currentBenchmark = current;
-    Serial.print("Current:");
-    Serial.println(currentBenchmark);
-    stateSwitch(ValveStates::CALIBRATE_INITIATE);
-    break;
-
-  case ValveStates::CALIBRATE_INITIATE:
-    relayControl(pinDIR,DIR_NEGATIVE);
-    relayControl(pinON,RELAY_ON);
-    stateSwitch(ValveStates::CALIBRATE_LIMITSEEK1,1000000UL); // 1s to spin-up
-    break;
-
-  case ValveStates::CALIBRATE_LIMITSEEK1:
-    if(!USING_CURRENT) {
-      // when we see an inactive current, attempt to read it
-      //   for 100ms, or come back here
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK2);
-    }
-    break;
+  return(current < currentBenchmark + tolerance && current > currentBenchmark - tolerance);
+}
 
-  case ValveStates::CALIBRATE_LIMITSEEK2:
-    // wait for 100ms to see if we are ACTUALLY settled, by
-    //   letting this state timeout
-    stateTimeout(ValveStates::CALIBRATE_LIMIT,100000UL);
+int Valve::seekBusy()
+{
+  return(!seekIdle());
+}
 
-    // if we see something OTHER than inactive, switch back to waiting
-    if(USING_CURRENT) {
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK1);
-    }
-    break;
-    
-  case ValveStates::CALIBRATE_LIMIT:
-    Serial.println("LIMIT");
-    relayControl(pinON,RELAY_OFF);
-    stateSwitch(ValveStates::CALIBRATE_BENCHMARK2,100000UL);
-    break;
-
-  // PHASE II - get to the positive limit, timing it
-    
-  case ValveStates::CALIBRATE_BENCHMARK2:
-    currentBenchmark = current;
-    Serial.print("Current:");
-    Serial.println(currentBenchmark);
-    stateSwitch(ValveStates::CALIBRATE_INITIATE2);
-    break;
-
-  case ValveStates::CALIBRATE_INITIATE2:
-    pos_time = micros();
-    relayControl(pinDIR,DIR_POSITIVE);
-    relayControl(pinON,RELAY_ON);
-    stateSwitch(ValveStates::CALIBRATE_LIMITSEEK21,1000000UL); // 1s to spin-up
-    break;
-
-  case ValveStates::CALIBRATE_LIMITSEEK21:
-    if(!USING_CURRENT) {
-      // when we see an inactive current, attempt to read it
-      //   for 100ms, or come back here
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK22);
-    }
-    break;
+//
+// seekFail() - a state with a check gave up (see ValveStep). The motor
+//    is stopped where it is, and the state that failed goes in the
+//    trace. The position isn't trusted for a quick verify after this.
+//
+ValveStates Valve::seekFail()
+{
+  limitSeek = false;
+  relayControl(pinON,RELAY_OFF);
+  timedMoves = VALVE_VERIFY_TRUST;
+  TRACE_ERROR(TRACE_VALVE_FAIL,myIndex,(int)state_prev);
+  return(ValveStates::NONE);
+}
 
-  case ValveStates::CALIBRATE_LIMITSEEK22:
-    // wait for 100ms to see if we are ACTUALLY settled, by
-    //   letting this state timeout
-    stateTimeout(ValveStates::CALIBRATE_LIMIT2,100000UL);
+// QUICK VERIFY - to the nearer stop, then one timed traverse to the
+//   other. Not getting to the other stop in time falls back to the
+//   full calibration.
 
-    // if we see something OTHER than inactive, switch back to waiting
-    if(USING_CURRENT) {
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK21);
-    }
-    break;
-    
-  case ValveStates::CALIBRATE_LIMIT2:
-    Serial.println("LIMIT");
-    relayControl(pinON,RELAY_OFF);
-    pos_time = micros() - pos_time;
-    degNOW = degMAX;		// just for illustration - doesn't play a role here
-    stateSwitch(ValveStates::CALIBRATE_BENCHMARK3);
-    break;
-
-  // PHASE III - go (back) to the lower limit
-    
-  case ValveStates::CALIBRATE_BENCHMARK3:
-    currentBenchmark = current;
-    Serial.print("Current:");
-    Serial.println(currentBenchmark);
-    stateSwitch(ValveStates::CALIBRATE_INITIATE3,100000UL);
-    break;
-
-  case ValveStates::CALIBRATE_INITIATE3:
-    neg_time = micros();
-    relayControl(pinDIR,DIR_NEGATIVE);
-    relayControl(pinON,RELAY_ON);
-    stateSwitch(ValveStates::CALIBRATE_LIMITSEEK31,1000000UL); // 1s to spin-up
-    break;
-
-  case ValveStates::CALIBRATE_LIMITSEEK31:
-    if(!USING_CURRENT) {
-      // when we see an inactive current, attempt to read it
-      //   for 100ms, or come back herej
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK32);
-    }
-    break;
+ValveStates Valve::verifyBegin()
+{
+  relayControl(pinON,RELAY_OFF);	// limitStart() needs an idle reading
+  verifyDir = (degNOW - degMIN <= degMAX - degNOW)?DIR_POSITIVE:DIR_NEGATIVE;
+  if(degNOW == degMIN || degNOW == degMAX || timedMoves < VALVE_VERIFY_TRUST) {
+    return(ValveStates::CALIBRATE_VERIFY_LIMIT);	// no need for the seek
+  }
+  return(ValveStates::NONE);
+}
+
+//
+// verifySeek() - like a limit move, the time budget ends it if the stop
+//    isn't seen - which happens if the valve is already there, and its
+//    limit switch won't let the motor run at all.
+//
+ValveStates Valve::verifySeek()
+{
+  if(verifyDir == DIR_POSITIVE) {
+    limitStart(DIR_NEGATIVE);
+    stateTime(neg_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degNOW - degMIN) +
+	      VALVE_LIMIT_OVERRUN);
+  } else {
+    limitStart(DIR_POSITIVE);
+    stateTime(pos_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degMAX - degNOW) +
+	      VALVE_LIMIT_OVERRUN);
+  }
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::verifyLimit()
+{
+  if(limitSeek) {			// the seek got to the stop
+    configPosition((verifyDir == DIR_POSITIVE)?degMIN:degMAX);
+  }
+  limitSeek = false;
+  relayControl(pinON,RELAY_OFF);
+  return(ValveStates::NONE);
+}
+
+//
+// verifySpan() - degrees from where the timed traverse started (degFROM)
+//    to the stop it is going to.
+//
+unsigned long Valve::verifySpan()
+{
+  return((verifyDir == DIR_POSITIVE)?degMAX - degFROM:degFROM - degMIN);
+}
+
+ValveStates Valve::verifyTimed()
+{
+  unsigned long calibrated = (verifyDir == DIR_POSITIVE)?pos_time:neg_time;
+
+  degFROM = degNOW;
+  calibrated = calibrated / (unsigned long)(degMAX - degMIN) * verifySpan();
+  limitStart(verifyDir);
+  stateTime(calibrated + calibrated / 100 * VALVE_VERIFY_DRIFT + VALVE_LIMIT_OVERRUN);
+  return(ValveStates::NONE);
+}
 
-  case ValveStates::CALIBRATE_LIMITSEEK32:
-    // wait for 100ms to see if we are ACTUALLY settled, by
-    //   letting this state timeout
-    stateTimeout(ValveStates::CALIBRATE_LIMIT3,100000UL);
+ValveStates Valve::verifyCheck()
+{
+  unsigned long measured = micros() - moveStart;
+  unsigned long calibrated = (verifyDir == DIR_POSITIVE)?pos_time:neg_time;
+  unsigned long other = (verifyDir == DIR_POSITIVE)?neg_time:pos_time;
+  unsigned long expected = calibrated / (unsigned long)(degMAX - degMIN) * verifySpan();
+  unsigned long drift = (measured > expected)?(measured - expected):(expected - measured);
+  ValveStates go = ValveStates::NONE;
+
+  limitSeek = false;
+  relayControl(pinON,RELAY_OFF);
+  timedMoves = 0;
+
+  if(drift > expected / 100 * VALVE_VERIFY_DRIFT) {
+    go = ValveStates::CALIBRATE_START;
+  } else {
 
-    // if we see something OTHER than inactive, switch back to waiting
-    if(USING_CURRENT) {
-      stateSwitch(ValveStates::CALIBRATE_LIMITSEEK31);
+    // close enough - the measured time is scaled up to a full traverse,
+    //   and the other direction is taken to have drifted the same way
+
+    measured = measured / verifySpan() * (unsigned long)(degMAX - degMIN);
+    other = (unsigned long)((float)other * measured / calibrated);
+    if(verifyDir == DIR_POSITIVE) {
+      configTravelTimes(measured,other);
+    } else {
+      configTravelTimes(other,measured);
     }
-    break;
-    
-  case ValveStates::CALIBRATE_LIMIT3:
-    configPosition(degMIN);
-    Serial.println("LIMIT DONE");
-    relayControl(pinON,RELAY_OFF);
-    configTravelTimes(pos_time,micros() - neg_time);
-    Serial.print("POS:");
-    Serial.println(pos_time);
-    Serial.print("NEG:");
-    Serial.println(neg_time);
-    stateSwitch(ValveStates::INACTIVE);
-    break;
-
-  default:
-    break;
   }
+
+  // the position goes in last - its write is the deepest call from
+  //   loop(), so none of the times above are kept on the stack for it
+
+  configPosition((verifyDir == DIR_POSITIVE)?degMAX:degMIN);
+  return(go);
 }
 
 //
-// move() - given a target degrees, move there.
-//   The limits are special cased, in that they can be used
-//   to reset the positioning accuracy.
+// limitCheck() - true when a limit move (or verify) is at the stop.
 //
-void Valve::move(int target)
+int Valve::limitCheck()
 {
-  degTARGET = target;
-  if(target == degMIN) {
-    stateSwitch(ValveStates::MOVE_LIMIT_LOW);
-  } else if(target == degMAX) {
-    stateSwitch(ValveStates::MOVE_LIMIT_HIGH);
+  return(limitSeek && limitReached());
+}
+
+// MOVES - to points other than the limits, the move is timed from the
+//   calibrated travel time. Moves to the limits use the current sensor
+//   to stop as soon as the valve hits the stop (see limitReached()).
+//   They are still given the time PLUS a bit as a budget - which is
+//   what ends the move if the current can't be read clearly.
+
+ValveStates Valve::moveLow()
+{
+  degTARGET = degMIN;
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::moveHigh()
+{
+  degTARGET = degMAX;
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::moveTarget()
+{
+  // do nothing if we're already at the right target
+
+  if(degNOW == degTARGET) {
+    return(ValveStates::INACTIVE);
+  }
+
+  // now set the time that we need to move based upon where we are
+
+  if(degNOW < degTARGET) {
+    travelFull = pos_time;
+    targetTime = pos_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degTARGET - degNOW);
   } else {
-    stateSwitch(ValveStates::MOVE_TARGET);
+    travelFull = neg_time;
+    targetTime = neg_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degNOW - degTARGET);
+  }
+
+  // if we're moving to a limit, add a bit of movement time to take
+  //   care of any slop that has accumulated - this is only a budget,
+  //   the current normally ends the move first
+
+  if(degTARGET == degMAX || degTARGET == degMIN) {
+    targetTime += VALVE_LIMIT_OVERRUN;
+    relayControl(pinON,RELAY_OFF);	// get a fresh idle reading first
+    return(ValveStates::MOVE_TARGET_BENCHMARK);
+  }
+  return(ValveStates::NONE);
+}
+
+ValveStates Valve::moveBegin()
+{
+  int direction = (degNOW < degTARGET)?DIR_POSITIVE:DIR_NEGATIVE;
+
+  degFROM = degNOW;
+  if(degTARGET == degMAX || degTARGET == degMIN) {
+    limitStart(direction);
+  } else {
+    moveStart = micros();
+    relayControl(pinDIR,direction);
+    relayControl(pinON,RELAY_ON);
   }
+  stateTime(targetTime);
+  return(ValveStates::NONE);
 }
 
-int Valve::movementComplete()
-{
-  return(1);
-}
-
-//
-// movementLoop() - this is called from the mail Arduino app loop, and
-//    controls valve movement (as opposed to calibration) - this is done
-//    are more often than calibration.
-//
-//    Movement to points other than the limits is done based upon the
-//    calibrated time.
-//
-//    NOTE - at one point this routine tried to use the current sensor
-//    when going to the limits, as opposed to time - HOWEVER, there
-//    wasn't a simple way to do that due to the sensor value changing
-//    over time as the capacitor in the valve drains. So, instead,
-//    this routine just uses the time PLUS a bit to ensure that it hits
-//    the limits when going to them.
-//
-void Valve::movementLoop()
-{
-    switch(state_current) {
-
-	// note that we can get in to this routine from the "old"
-	//   entry points, too, that used to differentiate between
-	//   limit movement and target movement. Now they just
-	//   initiate a target movement.
-	
-    case ValveStates::MOVE_LIMIT_LOW:
-	degTARGET = degMIN;
-	stateSwitch(ValveStates::MOVE_TARGET);
-	break;
-	
-    case ValveStates::MOVE_LIMIT_HIGH:
-	degTARGET = degMAX;
-	stateSwitch(ValveStates::MOVE_TARGET);
-	break;
-	
-    case ValveStates::MOVE_TARGET:
-
-	// do nothing if we're already at the right target
-    
-	if(degNOW == degTARGET) {
-	    stateSwitch(ValveStates::INACTIVE);
-	    break;
-	}
-
-	// now set the time that we need to move based upon where we are
-
-	if(degNOW < degTARGET) {
-	    targetTime = pos_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degTARGET - degNOW);
-	} else {
-	    targetTime = neg_time / (unsigned long)(degMAX - degMIN) * (unsigned long)(degNOW - degTARGET);
-	}
-
-	// if we're moving to a limit, add a bit of movement time to take
-	//   care of any slop that has accumulated since we're not using
-	//   current sensing (see main comments)
-    
-	if(degTARGET == degMAX || degTARGET == degMIN) {
-	    targetTime += 2000000UL;	// 2 second additional movement for limits
-	}
-
-	// now, split up the time into 6 segments to allow feedback to go back to the user
-	targetTime /= 6;
-	
-	relayControl(pinDIR,(degNOW < degTARGET)?DIR_POSITIVE:DIR_NEGATIVE);	
-	relayControl(pinON,RELAY_ON);
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_1);
-	break;
-
-	// the whole purpose of the next state is to provide periodic
-	//   feedback to the user - we cut the movement into a few
-	//   segments, reporting for each segment
-	
-    case ValveStates::MOVE_TARGET_PROCESS_1:
-	degNOW += (degTARGET - degNOW)/6;
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_2,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_PROCESS_2:
-	configPosition(degNOW);
-	degNOW += (degTARGET - degNOW)/5;
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_3,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_PROCESS_3:
-	configPosition(degNOW);
-	degNOW += (degTARGET - degNOW)/4;
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_4,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_PROCESS_4:
-	configPosition(degNOW);
-	degNOW += (degTARGET - degNOW)/3;
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_5,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_PROCESS_5:
-	configPosition(degNOW);
-	degNOW += (degTARGET - degNOW)/3;
-	stateSwitch(ValveStates::MOVE_TARGET_PROCESS_6,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_PROCESS_6:
-	configPosition(degNOW);
-	degNOW += (degTARGET - degNOW)/2;
-	stateSwitch(ValveStates::MOVE_TARGET_DONE,targetTime);
-	break;
-
-    case ValveStates::MOVE_TARGET_DONE:
-	degNOW = degTARGET;		// make sure we're RIGHT on
-	configPosition(degNOW);
-	relayControl(pinON,RELAY_OFF);
-	stateSwitch(ValveStates::INACTIVE);
-	break;
+//
+// moveCheck() - keeps degNOW up to date along the way (see
+//    positionEstimate()), and for limit moves, watches for the stop.
+//
+int Valve::moveCheck()
+{
+  positionEstimate();
+  return(limitCheck());
+}
+
+ValveStates Valve::moveDone()
+{
+  limitSeek = false;
+  degNOW = degTARGET;		// make sure we're RIGHT on
+  configPosition(degNOW);
+  if(degNOW == degMIN || degNOW == degMAX) {
+    timedMoves = 0;
+  } else if(timedMoves < VALVE_VERIFY_TRUST) {
+    timedMoves++;
+  }
+  relayControl(pinON,RELAY_OFF);
+  return(ValveStates::NONE);
+}
+
+//
+// limitReached() - returns true when the motor has stopped at a limit.
+//    The valve's own limit switch cuts the motor at the stop, so the
+//    current falls back toward idle. But the reading drifts (the
+//    capacitor in the valve drains) so rather than a fixed bracket
+//    around idle, this tracks the average running current and calls
+//    it stopped when the current has been under half of that for
+//    VALVE_LIMIT_SETTLE. The average is a slow one (32 runs) and only
+//    follows readings within a quarter of it - otherwise it follows
+//    the current down as it falls off at the stop, and never sees it
+//    drop.
+//
+//    Nothing is trusted during spin-up - except that a short move can
+//    get to the stop before spin-up is over. If the current is back
+//    near idle when spin-up ends, and well under what was seen while
+//    the motor came on, it is at the stop already. (The average is
+//    started anyway, so a motor that is running, just weakly, gets out
+//    of this before VALVE_LIMIT_SETTLE is up.)
+//
+//    If the running current never gets far enough from idle to tell
+//    the two apart, this never says "stopped" - the move's time budget
+//    ends it instead.
+//
+int Valve::limitReached()
+{
+  unsigned long now = micros();
+  int level = abs(readCurrent() - limitIdle);
+  int running = limitRunning >> 5;
+
+  if(now - moveStart < VALVE_SPINUP) {
+    if(level > limitStarted) {
+      limitStarted = level;
+    }
+    return(false);
+  }
+
+  if(running < VALVE_LIMIT_SIGNAL) {
+    limitRunning += level - running;	// no average yet - start one
+    if(level >= VALVE_LIMIT_SIGNAL || level * 4 >= limitStarted) {
+      limitDropped = false;
+      return(false);
     }
+    // the motor was seen coming on, and the current is back near idle
+    //   already - it got to the stop during spin-up
+  } else if(level * 4 >= running * 3) {
+    limitRunning += level - running;	// still running - keep the average
+    limitDropped = false;
+    return(false);
+  } else if(level * 2 >= running) {	// on its way down (or a dip)
+    limitDropped = false;
+    return(false);
+  }
+
+  if(!limitDropped) {
+    limitDropped = true;
+    limitDropTime = now;
+  }
+  return(now - limitDropTime >= VALVE_LIMIT_SETTLE);
 }
-  
-		 
 
-  
+//
+// positionEstimate() - while moving, degNOW is worked out from how
+//    long the motor has been on and the calibrated time for a full
+//    traverse that way - so status() is right whenever it is asked,
+//    not just at the end. It never goes past the target, and it isn't
+//    written to the position log until the move is done (the start
+//    is already there).
+//
+void Valve::positionEstimate()
+{
+  unsigned long moved;
+
+  if(travelFull < 1000UL) {
+    return;
+  }
+  moved = (micros() - moveStart) / 1000UL * (unsigned long)(degMAX - degMIN) / (travelFull / 1000UL);
+
+  if(degFROM < degTARGET) {
+    degNOW = (moved < (unsigned long)(degTARGET - degFROM))?degFROM + (int)moved:degTARGET;
+  } else {
+    degNOW = (moved < (unsigned long)(degFROM - degTARGET))?degFROM - (int)moved:degTARGET;
+  }
+}
+
+//
+// limitStart() - start the motor toward a stop, watching the current
+//    for it (see limitReached() and limitCheck()). The motor should
+//    have been off for VALVE_LIMIT_SETTLE so that the idle reading is
+//    good.
+//
+void Valve::limitStart(int direction)
+{
+  limitIdle = readCurrent();
+  limitRunning = 0;
+  limitStarted = 0;
+  limitDropped = false;
+  limitSeek = true;
+  moveStart = micros();
+  relayControl(pinDIR,direction);
+  relayControl(pinON,RELAY_ON);
+}
@@ -10,15 +10,48 @@
 #include <time.h>
 #include <Arduino.h>
 #include "eeprom.h"
+#include "config.h"
+#include "filter.h"
+
+#define VALVE_SAMPLE_PERIOD	1000UL	// micros between current readings when active
+#define VALVE_ACTIVE_PERIOD	1000UL	// micros between loop() runs when active (1 kHz)
+#define VALVE_IDLE_PERIOD	20000UL	//   and when inactive (50 Hz)
+
+// moves to a limit stop when the current says the motor has stopped
+//   (see limitReached()) - the time budget is the fallback
+
+#define VALVE_SPINUP		1000000UL	// micros before the current means anything
+#define VALVE_LIMIT_SETTLE	100000UL	// micros the current must stay down at a stop
+#define VALVE_LIMIT_OVERRUN	2000000UL	// extra time in the budget for a limit move
+#define VALVE_STATE_TIMEOUT	90000000UL	// micros a state with a check can last, at
+						//   most - longer than any move's budget
+#define VALVE_LIMIT_SIGNAL	16		// running current (ADC counts from idle) needed
+						//   to trust the current at all - the idle
+						//   reading itself can be off by half this
+
+// a quick verify times one traverse against the calibrated time, and
+//   only does the full calibration if it is off by more than this
+
+#define VALVE_VERIFY_DRIFT	5		// percent
+
+// the verify skips the run to the nearer stop, and times the traverse
+//   from where the valve is, as long as its position can be trusted -
+//   it has been at a stop since it was turned on, and made fewer than
+//   this many timed moves since
+
+#define VALVE_VERIFY_TRUST	8		// timed moves
+
+#define VALVE_STEPS		23	// rows in the state table (see valve.cpp)
+#define VALVE_DWELL_PAGE	10	// states per dwell read (see dwellGet())
 
 // ValveStates defines all of the states that a valve can be in, which
 //  drives the different sub-state-machines for a valve - like "calibration"
 //  and "movement"
 
-enum class ValveStates { 
+enum class ValveStates : uint8_t { 
 
   INACTIVE = 0,			// the valve is not doing anything right now
-  SEEK_FAIL = 1,			// failure during a move to a position
+  SEEK_FAIL = 1,			// a state with a check timed out - the motor is stopped
   // ...
 
   // CALIBRATION STATES
@@ -26,25 +59,23 @@ enum class ValveStates {
   CALIBRATE_START2= 120,		// initial state that kicks-off calibration
   CALIBRATE_START3= 121,		// initial state that kicks-off calibration
   CALIBRATE_START4= 122,		// initial state that kicks-off calibration
-  // Phase 1
+  // Seeking a stop - a sub-machine that each phase runs (see seekDir)
   CALIBRATE_BENCHMARK = 101,		// the state where valve current is benchmarked
-  CALIBRATE_INITIATE = 102,		// calibration starts for the valve
-  CALIBRATE_LIMITSEEK1 = 103,	
-  CALIBRATE_LIMITSEEK2 = 104,	
-  CALIBRATE_LIMIT = 105,		// first limit hit
-  // Phase 2
-  CALIBRATE_BENCHMARK2 = 106,		// the state where valve current is bjenchmarked
-  CALIBRATE_INITIATE2 = 107,		// calibration starts for the valve
-  CALIBRATE_LIMITSEEK21 = 108,	
-  CALIBRATE_LIMITSEEK22 = 109,	
-  CALIBRATE_LIMIT2 = 110,		// first limit hit
-  // Phase 3
-  CALIBRATE_BENCHMARK3 = 111,		// the state where valve current is benchmarked
-  CALIBRATE_INITIATE3 = 112,		// calibration starts for the valve
-  CALIBRATE_LIMITSEEK31 = 113,	
-  CALIBRATE_LIMITSEEK32 = 114,	
-  CALIBRATE_LIMIT3 = 115,		// first limit hit
+  CALIBRATE_INITIATE = 102,		// motor on, waiting out the spin-up
+  CALIBRATE_LIMITSEEK1 = 103,		// running - waiting for the current to drop
+  CALIBRATE_LIMITSEEK2 = 104,		// dropped - waiting to see that it stays down
+  // Phases
+  CALIBRATE_LIMIT = 105,		// at the negative stop - now seek the positive one
+  CALIBRATE_LIMIT2 = 110,		// at the positive stop (timed) - back to negative
+  CALIBRATE_LIMIT3 = 115,		// at the negative stop (timed) - done
   
+  // Quick verify (see verify())
+  CALIBRATE_VERIFY = 130,		// pick the nearer stop
+  CALIBRATE_VERIFY_SEEK = 131,		// running to it
+  CALIBRATE_VERIFY_LIMIT = 132,		// there - let the current settle
+  CALIBRATE_VERIFY_TIMED = 133,		// timing the traverse to the other stop
+  CALIBRATE_VERIFY_CHECK = 134,		// there - compare with the calibrated time
+
   CALIBRATE_END = 150,		// calibrate end-state - used really as a marker
 
   // MOVEMENT STATES
@@ -60,27 +91,63 @@ enum class ValveStates {
   MOVE_LIMIT_HIGH_DONE = 233,
 
   MOVE_TARGET = 210,		// beginning state for a move to position
-  MOVE_TARGET_PROCESS_1 = 211,	// 6 states to provide feedback to the user
-  MOVE_TARGET_PROCESS_2 = 212,
-  MOVE_TARGET_PROCESS_3 = 213,
-  MOVE_TARGET_PROCESS_4 = 214,
-  MOVE_TARGET_PROCESS_5 = 215,
-  MOVE_TARGET_PROCESS_6 = 216,
-  MOVE_TARGET_DONE = 217
+  MOVE_TARGET_PROCESS = 211,	// moving - position follows the time (see positionEstimate())
+  MOVE_TARGET_DONE = 217,
+  MOVE_TARGET_BENCHMARK = 218,	// limit moves - idle current before starting
+
+  // not states - used in the state table (see ValveStep)
+
+  RETURN = 250,			// back from a sub-machine to where it was called
+  NONE = 251			// no state
+
+};
+
+class Valve;
+
+// ValveStep is one row of the state table (see valve.cpp) - what to
+//  do on entering a state, and how it is left:
+//
+//    - if there is a check, it is called on every run, and when it says
+//      true the valve goes to "branch"
+//    - after "time" micros (or right away if there is no check and the
+//      time is 0) the valve goes to "next". An enter action can give
+//      the state a different time (see stateTime()). A check with a time
+//      of 0 has no "next".
+//    - a state with a check goes to "fail" if it is still there after
+//      "timeout" micros. A check without a timeout is a table error,
+//      which fails the state as soon as it is entered.
+//
+//  An enter action can also return a state to go straight to instead.
+//  A state given a "then" calls a sub-machine - whatever state it goes
+//  to - which comes back to "then" when it goes to RETURN.
 
+struct ValveStep {
+  ValveStates state;
+  ValveStates (Valve::*enter)(void);	// on entering (or NULL)
+  int (Valve::*check)(void);		// on each run after (or NULL)
+  unsigned long time;
+  ValveStates next;
+  ValveStates branch;
+  unsigned long timeout;
+  ValveStates fail;
+  ValveStates then;
 };
 
-#define STATE_MACHINE
-#define STATE_TIMEOUT
+// VALVE_PROFILE keeps how long each state took, for dwellGet(). It is
+//   off on the Arduino, as it costs 2 bytes of RAM for each state of
+//   each valve. (The host build turns it on.)
 
-class Valve : public EEPROM_CONTROL {
+// #define VALVE_PROFILE
+
+class Valve {
 
 public:
-  Valve(int,int,int,int);
+  Valve(int,int,int,int,int);
   void configTravelLimits(int,int);
   void configTravelTimes(unsigned long,unsigned long);
   void configPosition(int);
   void loop();
+  int active();		// true if the valve is doing something (calibrating/moving)
 
   void status(byte *);	// fills in the byte array [0] current state, [1] prev [2-3] position
 
@@ -88,12 +155,20 @@ public:
   void travelTime(byte *);	// gets the current calibrated travel time
 
   void calibrate();
+  void verify();		// quick calibration check (falls back to calibrate())
   int calibrateStatus();
 
   void move(int degrees);
   int moveStatus();
+
+#ifdef VALVE_PROFILE
+  int dwellGet(int, byte *);	// how long each state last took (see dwellGet())
+#endif
+
+  Filter<3> currentFilter;	// the current readings (see readCurrent())
   
 private:
+  int myIndex;		// which valve this is (config and events)
   int pinON;		// digital pin that controls the valve "on" relay
   int pinDIR; 		// digital pin that controls the valve "direction" relay
   int pinMONITOR;	// analog pin that monitors the valve
@@ -104,42 +179,94 @@ private:
   int degMAX;		// degrees assigned to max stop
   int degNOW;		// current degrees (may be estimated)
   int degTARGET;	// set when doing a positioned movement
+  int degFROM;		//   and where it started from
 
   int currentBenchmark;	// tracks the measured inactive current
 
+  // limit moves watch the current for the stop (see limitReached())
+
+  int limitSeek;		// true while a limit move is watching
+  int limitIdle;		// current with the motor off
+  int limitRunning;		// average running current (from idle) times 32
+  int limitStarted;		// most current seen during spin-up
+  int limitDropped;		// true while the current is down
+  unsigned long limitDropTime;	//   and micros when it went down
+  unsigned long moveStart;	// micros when the motor was turned on
+  int verifyDir;		// direction of the timed verify traverse
+  byte timedMoves;		// timed moves since it was at a stop (saturates)
+
+  // calibration runs the seek sub-machine for each phase
+
+  int seekDir;			// which way to go
+  unsigned long seekStart;	//   and micros when the motor went on
+
+  ValveConfig *myConfig;	// where the limits and travel times are kept
+  EEPROM_RING positionLog;	// where degNOW is kept (wear-leveled)
+
   void loadTravelLimits(void);
   void loadTravelTimes(void);
   void loadPosition(void);
 
-  void calibrationLoop();	// called by loop() - for calibration operation
-  int calibrationComplete();	// returns true when the calibration is complete
-  void movementLoop();		// called by loop() - for movement operation
-  int movementComplete();	// returns true when the movement is complete
   void relayControl(int,int);   // turns on the given relay pin
   int readCurrent(void);	// reads the valve current sensor
+  int limitReached(void);	// true when the motor has hit a stop
+  void positionEstimate(void);	// degNOW from the time moving
+  void limitStart(int);		// run to a stop, watching the current
+  unsigned long verifySpan(void);	// degrees the timed verify covers
+
+  // the state table's actions (see steps[])
+
+  ValveStates calStart(void);
+  ValveStates calNegative(void);
+  ValveStates calPositive(void);
+  ValveStates calQuiet(void);
+  ValveStates calLimit(void);
+  ValveStates calLimit2(void);
+  ValveStates calLimit3(void);
+  ValveStates seekBenchmark(void);
+  ValveStates seekInitiate(void);
+  int seekIdle(void);
+  int seekBusy(void);
+  ValveStates verifyBegin(void);
+  ValveStates verifySeek(void);
+  ValveStates verifyLimit(void);
+  ValveStates verifyTimed(void);
+  ValveStates verifyCheck(void);
+  int limitCheck(void);
+  ValveStates moveLow(void);
+  ValveStates moveHigh(void);
+  ValveStates moveTarget(void);
+  ValveStates moveBegin(void);
+  int moveCheck(void);
+  ValveStates moveDone(void);
+  ValveStates seekFail(void);
 
   // state maintenance members
-  unsigned long	state_delay;	// micros to delay before the next state
-  ValveStates	state_next;	//   what that next state is (only valid after delay)
 
-  unsigned long	state_timeout;	// micros to wait for state to change
-  ValveStates	state_failure;	//   switch-to state upon timeout failure
+  static const ValveStep steps[VALVE_STEPS];
 
   ValveStates	state_current;
   ValveStates	state_prev;
+  ValveStates	state_next;	// asked for by stateSwitch() - entered on the next run
+  ValveStates	state_return;	// where a sub-machine goes back to
+  int		state_row;	// steps[] row of state_current (-1 if none)
+  unsigned long	state_time;	// micros before going to the row's next
+  unsigned long	state_lastSwitch;	// micros at last state switch
+#ifdef VALVE_PROFILE
+  uint16_t	state_dwell[VALVE_STEPS];	// millis each state last took
+#endif
 
   unsigned long pos_time;	// time to go from 0 to upper limit
   unsigned long neg_time;	// time to go from upper limit to 0
-  
-  unsigned long	state_lastSwitch;	// micros at last state switch
 
-  int stateUpdate(void);
   void stateSwitch(ValveStates);
-  void stateSwitch(ValveStates,unsigned long);
-  void stateTimeout(ValveStates,unsigned long);
+  void stateEnter(ValveStates);
+  void stateRun(void);
+  void stateTime(unsigned long);
 
     // movement loop needs interrim storage
-    unsigned long targetTime;
+    unsigned long targetTime;	// micros the move should take
+    unsigned long travelFull;	//   and a full traverse takes that way
 };
 
 #endif // VALVE_H
@@ -0,0 +1,115 @@
+//
+// Arduino.h
+//
+//   Host (Linux) stand-in for the Arduino core. Only what the
+//   PoolControl sketch actually uses is here: pins, digital/analog
+//   I/O, time, and a Serial that swallows its output.
+//
+//   The behaviour of the "hardware" is controlled through hal.h,
+//   which the sketch never includes - only the host programs do.
+//
+//   NOTE - on the Nano an int is 2 bytes and a long is 4. On the host
+//   they are 4 and 8. Anything that depends on type width (like the
+//   EEPROM layout) is NOT bit-exact on the host.
+//
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH		0x1
+#define LOW		0x0
+
+#define INPUT		0x0
+#define OUTPUT		0x1
+#define INPUT_PULLUP	0x2
+
+// Nano pin numbering - the analog pins follow the 14 digital pins
+
+#define A0	14
+#define A1	15
+#define A2	16
+#define A3	17
+#define A4	18
+#define A5	19
+#define A6	20
+#define A7	21
+
+#define NUM_DIGITAL_PINS	22
+
+// the math macros the core has (min() and max() are left out - they
+//   would trip up the C++ library that the host programs use)
+
+#define PI			3.1415926535897932384626433832795
+#define constrain(x,lo,hi)	((x)<(lo)?(lo):((x)>(hi)?(hi):(x)))
+
+// program memory is just memory on the host
+
+#define PROGMEM
+#define pgm_read_byte(addr)	(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)	(*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t *)(addr))
+#define memcpy_P(dst,src,n)	memcpy((dst),(src),(n))
+
+extern void pinMode(uint8_t,uint8_t);
+extern void digitalWrite(uint8_t,uint8_t);
+extern int digitalRead(uint8_t);
+extern int analogRead(uint8_t);
+
+extern unsigned long micros(void);
+extern unsigned long millis(void);
+extern void delay(unsigned long);
+extern void delayMicroseconds(unsigned int);
+
+extern void noInterrupts(void);
+extern void interrupts(void);
+
+// the status register - only its interrupt flag (bit 7) means anything
+//   here. cli() and noInterrupts() clear it, sei() and interrupts() set
+//   it, and an ISR runs with it cleared.
+
+extern volatile uint8_t SREG;
+extern void cli(void);
+extern void sei(void);
+
+//
+// HardwareSerial - output is counted and thrown away unless it is
+//    given somewhere to go through hal.h. The transmit buffer is
+//    modeled, so availableForWrite() goes down as bytes are written
+//    and back up at the baud rate.
+//
+class HardwareSerial {
+public:
+  void begin(unsigned long);
+
+  int availableForWrite(void);
+  size_t write(uint8_t);
+  size_t print(const char *);
+  size_t print(char);
+  size_t print(int);
+  size_t print(unsigned int);
+  size_t print(long);
+  size_t print(unsigned long);
+  size_t print(double, int = 2);
+
+  size_t println(void);
+  size_t println(const char *);
+  size_t println(char);
+  size_t println(int);
+  size_t println(unsigned int);
+  size_t println(long);
+  size_t println(unsigned long);
+  size_t println(double, int = 2);
+};
+
+extern HardwareSerial Serial;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,49 @@
+//
+// EEPROM.h
+//
+//   Host stand-in for the Arduino EEPROM library. The EEPROM is a
+//   plain 1K byte array that starts out erased (all 0xFF), just like
+//   a fresh Nano. Writes are counted per cell so that wear can be
+//   looked at from the host programs.
+//
+//   Note that this is the <EEPROM.h> library header. The sketch's
+//   own "EEPROM.h" (the address map) is found first for quoted
+//   includes from the sketch directory.
+//
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include "Arduino.h"
+
+#define HOST_EEPROM_SIZE	1024
+
+class EEPROMClass {
+public:
+  uint8_t read(int);
+  void write(int,uint8_t);
+  void update(int,uint8_t);
+  uint16_t length(void) { return(HOST_EEPROM_SIZE); }
+
+  template <typename T> T &get(int addr, T &t)
+  {
+    uint8_t *ptr = (uint8_t *)&t;
+    for(size_t i=0; i < sizeof(T); i++) {
+      *ptr++ = read(addr++);
+    }
+    return(t);
+  }
+
+  template <typename T> const T &put(int addr, const T &t)
+  {
+    const uint8_t *ptr = (const uint8_t *)&t;
+    for(size_t i=0; i < sizeof(T); i++) {
+      update(addr++,*ptr++);
+    }
+    return(t);
+  }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // HOST_EEPROM_H
@@ -0,0 +1,32 @@
+//
+// Wire.h
+//
+//   Host stand-in for the Arduino TWI (I2C) library, slave side only.
+//   The "master" is whatever host program drives the sketch - it uses
+//   halI2CWrite()/halI2CRead() from hal.h to fire the callbacks the
+//   same way the TWI interrupt would.
+//
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH	32	// same as the AVR Wire library
+
+class TwoWire {
+public:
+  void begin(uint8_t);
+  void onReceive(void (*)(int));
+  void onRequest(void (*)(void));
+
+  int available(void);
+  int read(void);
+
+  size_t write(uint8_t);
+  size_t write(const uint8_t *, size_t);
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,223 @@
+//
+// actuator.cpp
+//
+//   A model of the valve actuators and their current sensors, for
+//   running the sketch's valve calibration and moves against on the
+//   simulated clock:
+//
+//     - the motor runs when the "on" relay pin is LOW, positive when
+//       the "direction" relay pin is LOW too (see valve.cpp), at its
+//       own speed for each direction
+//     - it comes up to speed over spinUp, and draws an inrush current
+//       on top of the running current while it does
+//     - at either stop it stalls against the stop for stallTime,
+//       drawing more, until the actuator's own limit switch opens and
+//       cuts the motor - it won't run any further that way, but will
+//       run back the other way
+//     - once the motor is cut (at a stop or by the relay) the reading
+//       falls off toward idle over decay, rather than all at once, as
+//       described at limitReached() in valve.cpp
+//
+//   The current sensor reads forward and reverse current, so running
+//   positive is above idle and negative below it. The idle reading
+//   itself wanders a little.
+//
+//   The motor on time, the number of starts, and the degrees of travel
+//   are kept for scoring.
+//
+
+#include "hal.h"
+#include "actuator.h"
+#include <math.h>
+#include <stdlib.h>
+
+struct Actuator {
+  ActuatorModel model;
+  int onPin;
+  int dirPin;
+  int monitorPin;
+  double position;		// degrees from the negative stop
+  double level;			// counts from idle on the sensor (always +)
+  double idle;			//   and where idle is now
+  int sign;			// which side of idle the reading is on
+  int direction;		// +1 or -1 the last time the motor ran
+  double runTime;		// seconds since the motor was turned on
+  double stopTime;		//   and since it got to a stop (0 if not there)
+  int cutOff;			// true once a limit switch has opened
+  double motorTime;		// seconds the relay has been on
+  double travel;		//   and the degrees it has moved
+  int starts;			//   and the times it has gone on
+  int wasOn;
+};
+
+static Actuator actuators[ACTUATOR_MAX];
+static int attached;		// actuators[] in use (highest index + 1)
+static int (*previousHook)(uint8_t pin);
+
+static double noise(double counts)
+{
+  return(counts * (2.0 * rand() / RAND_MAX - 1.0));
+}
+
+static int actuatorAnalog(uint8_t pin)
+{
+  Actuator *a;
+  double adc;
+  int i;
+
+  for(i=0; i < attached; i++) {
+    a = &actuators[i];
+    if(a->monitorPin == pin) {
+      adc = a->idle + a->sign * a->level + noise(a->model.noise);
+      return((int)constrain(lround(adc),0L,1023L));
+    }
+  }
+  if(previousHook) {
+    return((*previousHook)(pin));
+  }
+  return(halAnalogLevel[pin]);
+}
+
+//
+// ActuatorAttach() - start the given actuator over at the given
+//    position, and hook it up to the sketch's valve pins. Whatever
+//    analogRead() hook was there before (like the thermal plant's)
+//    still gets the other pins.
+//
+void ActuatorAttach(int i, const ActuatorModel *m, int onPin, int dirPin, int monitorPin,
+		    double start)
+{
+  Actuator *a = &actuators[i];
+
+  a->model = *m;
+  a->onPin = onPin;
+  a->dirPin = dirPin;
+  a->monitorPin = monitorPin;
+  a->position = constrain(start,0.0,m->degrees);
+  a->level = 0.0;
+  a->idle = m->idle;
+  a->sign = 1;
+  a->direction = 1;
+  a->runTime = 0.0;
+  a->stopTime = 0.0;
+  a->cutOff = false;
+  a->motorTime = 0.0;
+  a->travel = 0.0;
+  a->starts = 0;
+  a->wasOn = false;
+
+  if(i >= attached) {
+    attached = i + 1;
+  }
+  if(halAnalogHook != actuatorAnalog) {
+    previousHook = halAnalogHook;
+    halAnalogHook = actuatorAnalog;
+  }
+}
+
+//
+// ActuatorChange() - change the actuator (like it wearing and slowing
+//    down) without starting over.
+//
+void ActuatorChange(int i, const ActuatorModel *m)
+{
+  actuators[i].model = *m;
+}
+
+//
+// actuatorStep() - move one actuator along.
+//
+static void actuatorStep(Actuator *a, double seconds)
+{
+  ActuatorModel *m = &a->model;
+  int on = (halPinMode[a->onPin] == OUTPUT && halPinLevel[a->onPin] == LOW);
+  int direction = (halPinLevel[a->dirPin] == LOW)?1:-1;
+  double speed;
+  double moved;
+
+  // the idle reading wanders, but not far
+
+  a->idle = constrain(a->idle + noise(m->drift) * seconds,m->idle - m->drift,m->idle + m->drift);
+
+  if(on && (!a->wasOn || direction != a->direction)) {
+    a->starts++;
+    a->runTime = 0.0;
+    a->stopTime = 0.0;
+  }
+  a->wasOn = on;
+
+  if(!on) {
+    a->level -= a->level * seconds / m->decay;
+    return;
+  }
+
+  a->direction = direction;
+  a->sign = (m->running < 0.0)?-direction:direction;
+  a->runTime += seconds;
+  a->motorTime += seconds;
+
+  if((direction > 0 && a->position < m->degrees) || (direction < 0 && a->position > 0.0)) {
+    speed = m->degrees / ((direction > 0)?m->travelUp:m->travelDown);
+    if(a->runTime < m->spinUp) {
+      speed *= a->runTime / m->spinUp;
+    }
+    moved = speed * seconds;
+    a->position = constrain(a->position + direction * moved,0.0,m->degrees);
+    a->travel += moved;
+    a->cutOff = false;
+    a->level = fabs(m->running);
+    if(a->runTime < m->spinUp) {
+      a->level += m->inrush * (1.0 - a->runTime / m->spinUp);
+    }
+    return;
+  }
+
+  // at the stop - stalled until the limit switch opens, and after
+  //   that it stays open until the motor runs the other way
+
+  a->stopTime += seconds;
+  if(!a->cutOff && a->stopTime < m->stallTime) {
+    a->level = fabs(m->running) + m->stall;
+  } else {
+    a->cutOff = true;
+    a->level -= a->level * seconds / m->decay;
+  }
+}
+
+//
+// ActuatorStep() - move every actuator along by the given time, which
+//    should be short next to the decay (a milli or so).
+//
+void ActuatorStep(double seconds)
+{
+  int i;
+
+  for(i=0; i < attached; i++) {
+    actuatorStep(&actuators[i],seconds);
+  }
+}
+
+double ActuatorPosition(int i)
+{
+  return(actuators[i].position);
+}
+
+double ActuatorMotorTime(int i)
+{
+  return(actuators[i].motorTime);
+}
+
+double ActuatorStopTime(int i)
+{
+  return(actuators[i].stopTime);
+}
+
+double ActuatorTravel(int i)
+{
+  return(actuators[i].travel);
+}
+
+int ActuatorStarts(int i)
+{
+  return(actuators[i].starts);
+}
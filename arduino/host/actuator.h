@@ -0,0 +1,43 @@
+//
+// actuator.h
+//
+//   (see actuator.cpp for information about the valve actuator model)
+//
+
+#ifndef HOST_ACTUATOR_H
+#define HOST_ACTUATOR_H
+
+#define ACTUATOR_MAX	4
+
+// a valve actuator (motor, gears, and its own limit switches) and the
+//   current sensor on its supply - the sensor in ADC counts
+
+struct ActuatorModel {
+  double degrees;		// full travel, stop to stop
+  double travelUp;		// seconds for full travel in the positive direction
+  double travelDown;		//   and in the negative direction
+  double spinUp;		// seconds for the motor to come up to speed
+  double idle;			// ADC counts with no current
+  double running;		// counts from idle while running (+ positive, - negative)
+  double inrush;		// extra counts when the motor starts, gone by spinUp
+  double stall;			// extra counts when it runs into a stop
+  double stallTime;		//   seconds before the limit switch opens
+  double decay;			// seconds for the reading to fall off after that
+  double drift;			// counts the idle reading wanders (+/-)
+  double noise;			// counts of noise (+/-) on each reading
+};
+
+extern void ActuatorAttach(int, const ActuatorModel *, int onPin, int dirPin, int monitorPin,
+			   double start);
+extern void ActuatorStep(double seconds);	// move every actuator along
+extern void ActuatorChange(int, const ActuatorModel *);	// wear, same position
+
+// what an actuator has done since ActuatorAttach()
+
+extern double ActuatorPosition(int);	// degrees from the negative stop
+extern double ActuatorMotorTime(int);	// seconds its relay has been on
+extern double ActuatorStopTime(int);	//   against a stop, the last time it ran
+extern double ActuatorTravel(int);	// degrees it has moved in all
+extern int ActuatorStarts(int);		// times the relay has gone on
+
+#endif // HOST_ACTUATOR_H
@@ -0,0 +1,296 @@
+//
+// bench.cpp
+//
+//   Host benchmark for the PoolControl sketch. The sketch (including
+//   PoolControl.ino) is compiled unchanged against the stand-in core
+//   in this directory, setup() is run once, and then loop() is run
+//   for a few million iterations in a handful of scenarios.
+//
+//   For each scenario, every device's loop() is also timed on its own
+//   so that the cost of loop() can be broken down by device.
+//
+//   At the end, the scheduler's own statistics for each task are
+//   printed (these are in micros, as the sketch sees time).
+//
+//   The I2C handlers (what runs in the TWI interrupt) are timed for a
+//   few typical reads and writes.
+//
+//   The thermometer conversion is also timed against the original
+//   float Steinhart-Hart calculation, along with the biggest error
+//   between the two.
+//
+//   Usage:  bench [iterations]
+//
+//   NOTE - host times are NOT AVR times. The numbers are for
+//   comparing one version of the firmware against another, on the
+//   same machine.
+//
+
+#include "hal.h"
+#include "Wire.h"
+#include "../PoolControl/valve.h"
+#include "../PoolControl/thermometer.h"
+#include "../PoolControl/heater.h"
+#include "../PoolControl/pump.h"
+#include "../PoolControl/light.h"
+#include "../PoolControl/scheduler.h"
+#include "../PoolControl/control.h"
+#include <stdio.h>
+
+#define DEFAULT_ITERATIONS	2000000UL
+
+// these come from PoolControl.ino
+
+extern Valve valve[];
+extern Thermometer therm[];
+extern Heater heater[];
+extern Pump pump[];
+extern Light light[];
+
+extern void setup(void);
+extern void loop(void);
+
+// one row in the device table - a name and how to run its loop()
+
+struct Device {
+  const char *name;
+  void (*run)(void);
+};
+
+static void runValve0(void) { valve[0].loop(); }
+static void runValve1(void) { valve[1].loop(); }
+static void runHeater0(void) { heater[0].loop(); }
+static void runTherm0(void) { therm[0].loop(); }
+static void runPump0(void) { pump[0].loop(); }
+static void runPump1(void) { pump[1].loop(); }
+static void runLight0(void) { light[0].loop(); }
+
+static Device devices[] = {
+  { "valve[0].loop",	runValve0 },
+  { "valve[1].loop",	runValve1 },
+  { "heater[0].loop",	runHeater0 },
+  { "therm[0].loop",	runTherm0 },
+  { "pump[0].loop",	runPump0 },
+  { "pump[1].loop",	runPump1 },
+  { "light[0].loop",	runLight0 },
+};
+
+#define DEVICE_COUNT	(sizeof(devices)/sizeof(devices[0]))
+
+//
+// timeIt() - run the given function the given number of times,
+//    returning the nanoseconds per call.
+//
+static double timeIt(void (*function)(void), unsigned long iterations)
+{
+  unsigned long start = halNanos();
+
+  for(unsigned long i=0; i < iterations; i++) {
+    (*function)();
+  }
+
+  return((double)(halNanos() - start) / (double)iterations);
+}
+
+//
+// referenceConvert() - the thermometer's original conversion, all
+//    float, using the default (TC_MEASURED) curve and 10K resistor.
+//
+static int referenceConvert(int adc)
+{
+  const float c1 = 1.619370382e-03, c2 = 1.448585020e-04, c3 = 5.079933354e-07;
+  float reading = (float)adc;
+  float R2, logR2, T;
+
+  R2 = 10000.0 * (1023.0 / reading - 1.0);
+  logR2 = log(R2);
+  T = (1.0 / (c1 + c2*logR2 + c3*logR2*logR2*logR2));
+  T = T - 273.15;
+  T = (T * 9.0)/ 5.0 + 32.0;
+  return((int)(T * 10.0));
+}
+
+// the conversion benchmark sweeps the thermometer input across the
+//   useful range of readings
+
+#define SWEEP_LOW	150
+#define SWEEP_HIGH	900
+
+static int sweepReading = SWEEP_LOW;
+static volatile int sweepSink;
+
+static int sweepNext(void)
+{
+  if(++sweepReading > SWEEP_HIGH) {
+    sweepReading = SWEEP_LOW;
+  }
+  return(sweepReading);
+}
+
+static void runReference(void) { sweepSink = referenceConvert(sweepNext()); }
+static void runThermConvert(void) { sweepSink = therm[0].convert(sweepNext()); }
+
+//
+// conversion() - time the thermometer conversion, old and new, and
+//    find the worst difference between them over the sweep.
+//
+static void conversion(unsigned long iterations)
+{
+  int worst = 0;
+  int worstReading = 0;
+
+  printf("\nthermometer conversion (readings %d-%d)\n",SWEEP_LOW,SWEEP_HIGH);
+  printf("  %-20s %10.1f ns/conversion\n","float reference",timeIt(runReference,iterations));
+
+  printf("  %-20s %10.1f ns/conversion\n","therm[0].convert",timeIt(runThermConvert,iterations));
+
+  for(int i=SWEEP_LOW; i <= SWEEP_HIGH; i++) {
+    int diff = abs(therm[0].convert(i) - referenceConvert(i));
+    if(diff > worst) {
+      worst = diff;
+      worstReading = i;
+    }
+  }
+
+  printf("  %-20s %10d tenths (at reading %d)\n","worst difference",worst,worstReading);
+}
+
+//
+// i2cRead() - time the interrupt side of a read of the given register:
+//    the register write that selects it, and the request for data.
+//
+static double i2cRead(byte reg, unsigned long iterations)
+{
+  byte buffer[BUFFER_LENGTH];
+  unsigned long start = halNanos();
+
+  for(unsigned long i=0; i < iterations; i++) {
+    halI2CWrite(&reg,1);
+    halI2CRead(buffer,sizeof(buffer));
+  }
+
+  return((double)(halNanos() - start) / (double)iterations);
+}
+
+//
+// i2cWrite() - time the interrupt side of a write. The main loop side
+//    (ControlLoop()) is run after each one, but isn't counted.
+//
+static double i2cWrite(const byte *data, int count, unsigned long iterations)
+{
+  unsigned long total = 0;
+  unsigned long start;
+
+  for(unsigned long i=0; i < iterations; i++) {
+    start = halNanos();
+    halI2CWrite(data,count);
+    total += halNanos() - start;
+    ControlLoop();
+  }
+
+  return((double)total / (double)iterations);
+}
+
+static void i2c(unsigned long iterations)
+{
+  static const byte heaterConfig[] = { 0xb8, 0x02, 0xbc };	// set point 70.0
+  static const byte valveExtended[] = { 0xf8, 0x00, 0x01 };	// status of valve 1
+  static const byte gatherList[] = { 0xea, 0x00, 0x01, 0x04, 0x80 };	// both valves, travel, temp
+
+  printf("\nI2C handlers\n");
+  printf("  %-20s %10.1f ns/transaction\n","read valve status",i2cRead(0x00,iterations));
+  halI2CWrite(valveExtended,sizeof(valveExtended));
+  printf("  %-20s %10.1f ns/transaction\n","read status (ext)",i2cRead(0xf8,iterations));
+  printf("  %-20s %10.1f ns/transaction\n","read temperature",i2cRead(0x80,iterations));
+  printf("  %-20s %10.1f ns/transaction\n","read snapshot",i2cRead(0xe0,iterations));
+  printf("  %-20s %10.1f ns/transaction\n","read discovery",i2cRead(0xe8,iterations));
+  printf("  %-20s %10.1f ns/transaction\n","read queue stats",i2cRead(0xe3,iterations));
+  halI2CWrite(gatherList,sizeof(gatherList));
+  printf("  %-20s %10.1f ns/transaction\n","read gather (4)",i2cRead(0xea,iterations));
+  printf("  %-20s %10.1f ns/transaction\n","write heater config",
+	 i2cWrite(heaterConfig,sizeof(heaterConfig),iterations / 100));
+
+  // a handler that turns interrupts back on lets the TWI interrupt in
+  //   again on the AVR - it should never happen
+
+  printf("  %-20s %10lu handlers\n","interrupts turned on",halISREnables);
+}
+
+//
+// tasks() - print the scheduler's statistics for each task
+//
+static void tasks(void)
+{
+  Task *task;
+
+  printf("\nscheduler tasks\n");
+  printf("  %4s %10s %10s %10s %8s %8s\n","task","period","runs","late","worst","total");
+  for(int i=0; i < TaskCount(); i++) {
+    task = TaskGet(i);
+    printf("  %4d %10lu %10lu %10u %8u %8lu\n",i,task->period,task->runs,task->late,task->worst,task->total);
+  }
+}
+
+//
+// scenario() - time the whole loop() and then each device's loop()
+//    in the current state of the sketch.
+//
+static void scenario(const char *name, unsigned long iterations)
+{
+  unsigned long reads = halAnalogReads;
+  unsigned long writes = halDigitalWrites;
+  double total;
+
+  total = timeIt(loop,iterations);
+
+  printf("\n%s\n",name);
+  printf("  %-20s %10.1f ns/iter  (%.2f analogRead, %.2f digitalWrite)\n",
+	 "loop()",total,
+	 (double)(halAnalogReads - reads) / (double)iterations,
+	 (double)(halDigitalWrites - writes) / (double)iterations);
+
+  for(unsigned int i=0; i < DEVICE_COUNT; i++) {
+    printf("  %-20s %10.1f ns/iter\n",devices[i].name,timeIt(devices[i].run,iterations));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  unsigned long iterations = DEFAULT_ITERATIONS;
+
+  if(argc > 1) {
+    iterations = strtoul(argv[1],NULL,0);
+  }
+
+  setup();
+
+  // long travel times, so that the valves are still moving for all of
+  //   the "valves moving" measurements
+
+  for(int i=0; i < 2; i++) {
+    valve[i].configTravelTimes(20000000UL,20000000UL);
+    valve[i].configTravelLimits(0,180);
+    valve[i].configPosition(0);
+  }
+
+  printf("PoolControl host benchmark: %lu iterations per measurement\n",iterations);
+
+  scenario("idle (everything off)",iterations);
+
+  heater[0].enable(1);
+  pump[0].control(1);
+  light[0].control(1);
+  scenario("heater enabled, pump and light on",iterations);
+
+  valve[0].move(90);
+  valve[1].move(90);
+  scenario("both valves moving",iterations);
+
+  tasks();
+
+  i2c(iterations);
+
+  conversion(iterations);
+
+  return(0);
+}
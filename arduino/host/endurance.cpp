@@ -0,0 +1,138 @@
+//
+// endurance.cpp
+//
+//   EEPROM endurance simulation for the valve position log. The sketch
+//   is run on a simulated clock through days of mode changes (moving
+//   the valves the way modeControl.js does) and the writes to each
+//   EEPROM cell are counted.
+//
+//   The expected lifetime is then figured from the busiest cell and
+//   the rated 100,000 write cycles - both for the position log ring
+//   and for how it used to be, where every position write went to
+//   the same cell.
+//
+//   Usage:  endurance [days] [mode changes per day]
+//
+
+#include "hal.h"
+#include "../PoolControl/valve.h"
+#include "../PoolControl/EEPROM.h"
+#include <stdio.h>
+
+#define DEFAULT_DAYS		30
+#define DEFAULT_MODES_PER_DAY	6
+
+#define RATED_CYCLES		100000.0
+#define LOOP_STEP		250UL		// simulated micros per loop()
+#define MOVE_TIMEOUT		(120UL * 1000000UL)
+
+extern Valve valve[];
+
+extern void setup(void);
+extern void loop(void);
+
+// valve positions for the modes that move valves (see modeControl.js)
+//   spa, high filter, spa clean, low filter
+
+static const int modePositions[][2] = {
+  {   0,   0 },
+  {  90, 180 },
+  { 180,  90 },
+  {  90, 180 },
+};
+
+#define MODE_COUNT	(sizeof(modePositions)/sizeof(modePositions[0]))
+
+//
+// moveValves() - start both valves moving and run the loop until they
+//    are done. Returns false if they never finish.
+//
+static int moveValves(int v0, int v1)
+{
+  unsigned long start = micros();
+
+  valve[0].move(v0);
+  valve[1].move(v1);
+
+  do {
+    loop();
+    halAdvance(LOOP_STEP);
+    if(micros() - start > MOVE_TIMEOUT) {
+      return(false);
+    }
+  } while(valve[0].active() || valve[1].active());
+
+  return(true);
+}
+
+int main(int argc, char **argv)
+{
+  int days = DEFAULT_DAYS;
+  int modesPerDay = DEFAULT_MODES_PER_DAY;
+  int mode = 0;
+  unsigned long before[HOST_EEPROM_SIZE];
+
+  if(argc > 1) {
+    days = atoi(argv[1]);
+  }
+  if(argc > 2) {
+    modesPerDay = atoi(argv[2]);
+  }
+
+  halClockSimulated = 1;
+  setup();
+
+  // known travel settings, whatever the defaults are
+
+  for(int i=0; i < 2; i++) {
+    valve[i].configTravelTimes(20000000UL,20000000UL);
+    valve[i].configTravelLimits(0,180);
+    valve[i].configPosition(0);
+  }
+
+  memcpy(before,halEEPROMWrites,sizeof(before));
+
+  for(int day=0; day < days; day++) {
+    for(int m=0; m < modesPerDay; m++) {
+      if(!moveValves(modePositions[mode][0],modePositions[mode][1])) {
+	printf("valves never finished moving (day %d)\n",day);
+	return(1);
+      }
+      mode = (mode + 1) % MODE_COUNT;
+    }
+  }
+
+  printf("EEPROM endurance: %d days, %d mode changes per day, %.0f rated cycles\n\n",
+	 days,modesPerDay,RATED_CYCLES);
+  printf("  %-6s %12s %14s %14s %14s\n","valve","records/day","hottest/day","single cell","ring");
+  printf("  %-6s %12s %14s %14s %14s\n","","","(ring)","life (years)","life (years)");
+
+  for(int v=0; v < 2; v++) {
+    int base = VALVE_POSITION_LOG_ADDRESS + v * VALVE_POSITION_LOG_INCR;
+    unsigned long records = 0;
+    unsigned long hottest = 0;
+
+    for(int addr=base; addr < base + VALVE_POSITION_LOG_INCR; addr++) {
+      unsigned long writes = halEEPROMWrites[addr] - before[addr];
+
+      // the sequence byte changes on every record
+
+      if((addr - base) % EEPROM_RING_RECORD == 0) {
+	records += writes;
+      }
+      if(writes > hottest) {
+	hottest = writes;
+      }
+    }
+
+    // the single cell got every record
+
+    printf("  %-6d %12.1f %14.1f %14.1f %14.1f\n",v,
+	   (double)records / days,
+	   (double)hottest / days,
+	   RATED_CYCLES / ((double)records / days) / 365.0,
+	   RATED_CYCLES / ((double)hottest / days) / 365.0);
+  }
+
+  return(0);
+}
@@ -0,0 +1,467 @@
+//
+// hal.cpp
+//
+//   Host implementation of the Arduino core pieces that the sketch
+//   uses (see Arduino.h, Wire.h, EEPROM.h) and of the controls that
+//   host programs use to drive it (see hal.h).
+//
+//   Everything here that the sketch's global constructors can reach
+//   is either constant-initialized or set up on first use, because
+//   the sketch's objects are constructed before main() and in no
+//   particular order relative to this file.
+//
+
+#include "hal.h"
+#include "Wire.h"
+#include "EEPROM.h"
+#include <stdio.h>
+#include <time.h>
+
+HardwareSerial Serial;
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+/************************************************************************
+ * pins
+ ************************************************************************/
+
+int halPinMode[NUM_DIGITAL_PINS];
+int halPinLevel[NUM_DIGITAL_PINS];
+
+// analog inputs float at mid-scale until someone says otherwise
+
+int halAnalogLevel[NUM_DIGITAL_PINS] = {
+  512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512,
+  512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512
+};
+
+unsigned long halAnalogReads;
+unsigned long halDigitalWrites;
+
+int (*halAnalogHook)(uint8_t pin);
+void (*halDigitalHook)(uint8_t pin, uint8_t level);
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  if(pin < NUM_DIGITAL_PINS) {
+    halPinMode[pin] = mode;
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+  halDigitalWrites++;
+  if(pin < NUM_DIGITAL_PINS) {
+    halPinLevel[pin] = level?HIGH:LOW;
+  }
+  if(halDigitalHook) {
+    (*halDigitalHook)(pin,level);
+  }
+}
+
+int digitalRead(uint8_t pin)
+{
+  return((pin < NUM_DIGITAL_PINS)?halPinLevel[pin]:LOW);
+}
+
+int analogRead(uint8_t pin)
+{
+  halAnalogReads++;
+  if(halAnalogHook) {
+    return((*halAnalogHook)(pin));
+  }
+  return((pin < NUM_DIGITAL_PINS)?halAnalogLevel[pin]:0);
+}
+
+#define INTERRUPT_FLAG	0x80		// SREG's I bit
+
+volatile uint8_t SREG = INTERRUPT_FLAG;
+unsigned long halISREnables;
+
+void cli(void)
+{
+  SREG &= ~INTERRUPT_FLAG;
+}
+
+void sei(void)
+{
+  SREG |= INTERRUPT_FLAG;
+}
+
+void noInterrupts(void)
+{
+  cli();
+}
+
+void interrupts(void)
+{
+  sei();
+}
+
+/************************************************************************
+ * time
+ ************************************************************************/
+
+unsigned long halNanos(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec);
+}
+
+static unsigned long timeOrigin;	// nanos at the first time call
+
+int halClockSimulated;
+static unsigned long simulatedMicros;
+
+void halAdvance(unsigned long us)
+{
+  simulatedMicros += us;
+}
+
+unsigned long micros(void)
+{
+  if(halClockSimulated) {
+    return(simulatedMicros);
+  }
+  if(timeOrigin == 0) {
+    timeOrigin = halNanos();
+  }
+  return((halNanos() - timeOrigin) / 1000UL);
+}
+
+unsigned long millis(void)
+{
+  return(micros() / 1000UL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  unsigned long start = micros();
+
+  if(halClockSimulated) {
+    halAdvance(us);
+  }
+  while(micros() - start < us) {
+  }
+}
+
+void delay(unsigned long ms)
+{
+  unsigned long start = micros();
+
+  if(halClockSimulated) {
+    halAdvance(ms * 1000UL);
+  }
+  while(micros() - start < ms * 1000UL) {
+  }
+}
+
+/************************************************************************
+ * Serial
+ ************************************************************************/
+
+#define SERIAL_BUFFER	64		// the AVR core's transmit buffer
+
+unsigned long halSerialBytes;
+unsigned long halSerialWaits;
+FILE *halSerialOut;
+
+static unsigned long serialBaud = 9600;
+static int serialQueued;		// bytes in the transmit buffer
+static unsigned long serialLast;	// micros when it was last emptied some
+
+//
+// serialSend() - take out of the transmit buffer what would have been
+//    sent since the last time (10 bits a byte).
+//
+static void serialSend(void)
+{
+  unsigned long now = micros();
+  unsigned long sent = (unsigned long)((now - serialLast) * (double)serialBaud / 10.0 / 1e6);
+
+  if(sent >= (unsigned long)serialQueued) {
+    serialQueued = 0;
+    serialLast = now;
+  } else if(sent > 0) {
+    serialQueued -= sent;
+    serialLast += (unsigned long)(sent * 10.0 * 1e6 / serialBaud);
+  }
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  serialBaud = baud;
+  serialQueued = 0;
+  serialLast = micros();
+}
+
+int HardwareSerial::availableForWrite(void)
+{
+  serialSend();
+  return(SERIAL_BUFFER - 1 - serialQueued);
+}
+
+// write() - if the buffer is full, the AVR would wait for a byte to go
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  serialSend();
+  if(serialQueued >= SERIAL_BUFFER - 1) {
+    halSerialWaits++;
+  } else {
+    serialQueued++;
+  }
+  halSerialBytes++;
+  if(halSerialOut) {
+    fputc(c,halSerialOut);
+  }
+  return(1);
+}
+
+// all of the print() flavors format into a buffer and write() it
+
+static size_t serialString(HardwareSerial *port, const char *str)
+{
+  size_t count = 0;
+
+  while(*str) {
+    count += port->write((uint8_t)*str++);
+  }
+  return(count);
+}
+
+size_t HardwareSerial::print(const char *str)
+{
+  return(serialString(this,str));
+}
+
+size_t HardwareSerial::print(char c)
+{
+  return(write((uint8_t)c));
+}
+
+size_t HardwareSerial::print(int value)
+{
+  return(print((long)value));
+}
+
+size_t HardwareSerial::print(unsigned int value)
+{
+  return(print((unsigned long)value));
+}
+
+size_t HardwareSerial::print(long value)
+{
+  char buffer[24];
+
+  snprintf(buffer,sizeof(buffer),"%ld",value);
+  return(serialString(this,buffer));
+}
+
+size_t HardwareSerial::print(unsigned long value)
+{
+  char buffer[24];
+
+  snprintf(buffer,sizeof(buffer),"%lu",value);
+  return(serialString(this,buffer));
+}
+
+size_t HardwareSerial::print(double value, int digits)
+{
+  char buffer[48];
+
+  snprintf(buffer,sizeof(buffer),"%.*f",digits,value);
+  return(serialString(this,buffer));
+}
+
+size_t HardwareSerial::println(void)
+{
+  return(serialString(this,"\r\n"));
+}
+
+size_t HardwareSerial::println(const char *str)
+{
+  return(print(str) + println());
+}
+
+size_t HardwareSerial::println(char c)
+{
+  return(print(c) + println());
+}
+
+size_t HardwareSerial::println(int value)
+{
+  return(print(value) + println());
+}
+
+size_t HardwareSerial::println(unsigned int value)
+{
+  return(print(value) + println());
+}
+
+size_t HardwareSerial::println(long value)
+{
+  return(print(value) + println());
+}
+
+size_t HardwareSerial::println(unsigned long value)
+{
+  return(print(value) + println());
+}
+
+size_t HardwareSerial::println(double value, int digits)
+{
+  return(print(value,digits) + println());
+}
+
+/************************************************************************
+ * Wire
+ ************************************************************************/
+
+static void (*wireReceive)(int);
+static void (*wireRequest)(void);
+
+static uint8_t wireRxBuffer[BUFFER_LENGTH];
+static int wireRxCount;
+static int wireRxIndex;
+
+static uint8_t wireTxBuffer[BUFFER_LENGTH];
+static int wireTxCount;
+
+void TwoWire::begin(uint8_t)
+{
+}
+
+void TwoWire::onReceive(void (*function)(int))
+{
+  wireReceive = function;
+}
+
+void TwoWire::onRequest(void (*function)(void))
+{
+  wireRequest = function;
+}
+
+int TwoWire::available(void)
+{
+  return(wireRxCount - wireRxIndex);
+}
+
+int TwoWire::read(void)
+{
+  if(wireRxIndex < wireRxCount) {
+    return(wireRxBuffer[wireRxIndex++]);
+  }
+  return(-1);
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if(wireTxCount < BUFFER_LENGTH) {
+    wireTxBuffer[wireTxCount++] = data;
+    return(1);
+  }
+  return(0);
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t count)
+{
+  size_t i;
+
+  for(i=0; i < count; i++) {
+    if(!write(data[i])) {
+      break;
+    }
+  }
+  return(i);
+}
+
+//
+// wireISR() - run a Wire callback (onReceive() if one is given,
+//    otherwise onRequest()) the way the TWI ISR does - with interrupts
+//    off. If the callback turns them back on, the TWI interrupt (still
+//    pending on the AVR) would run the handler again inside itself, so
+//    that is counted.
+//
+static void wireISR(void (*receive)(int), int count)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+  if(receive) {
+    (*receive)(count);
+  } else {
+    (*wireRequest)();
+  }
+  if(SREG & INTERRUPT_FLAG) {
+    halISREnables++;
+  }
+  SREG = sreg;
+}
+
+void halI2CWrite(const uint8_t *data, int count)
+{
+  if(count > BUFFER_LENGTH) {
+    count = BUFFER_LENGTH;		// the AVR library drops the rest too
+  }
+  memcpy(wireRxBuffer,data,count);
+  wireRxCount = count;
+  wireRxIndex = 0;
+
+  if(wireReceive) {
+    wireISR(wireReceive,count);
+  }
+}
+
+int halI2CRead(uint8_t *data, int max)
+{
+  int count;
+
+  wireTxCount = 0;
+  if(wireRequest) {
+    wireISR(NULL,0);
+  }
+
+  count = (wireTxCount < max)?wireTxCount:max;
+  memcpy(data,wireTxBuffer,count);
+  return(count);
+}
+
+/************************************************************************
+ * EEPROM
+ ************************************************************************/
+
+uint8_t halEEPROM[HOST_EEPROM_SIZE];
+unsigned long halEEPROMWrites[HOST_EEPROM_SIZE];
+
+static bool eepromErased;
+
+static void eepromInit(void)
+{
+  if(!eepromErased) {
+    memset(halEEPROM,0xff,sizeof(halEEPROM));
+    eepromErased = true;
+  }
+}
+
+uint8_t EEPROMClass::read(int addr)
+{
+  eepromInit();
+  return(halEEPROM[addr % HOST_EEPROM_SIZE]);
+}
+
+void EEPROMClass::write(int addr, uint8_t value)
+{
+  eepromInit();
+  halEEPROM[addr % HOST_EEPROM_SIZE] = value;
+  halEEPROMWrites[addr % HOST_EEPROM_SIZE]++;
+}
+
+void EEPROMClass::update(int addr, uint8_t value)
+{
+  if(read(addr) != value) {
+    write(addr,value);
+  }
+}
@@ -0,0 +1,62 @@
+//
+// hal.h
+//
+//   The "other side" of the host stand-in for the Arduino core. The
+//   sketch never sees this - host programs (like the benchmark) use
+//   it to play the part of the hardware: set analog inputs, look at
+//   relay pins, act as the I2C master, and so on.
+//
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include <stdio.h>
+
+// pins
+
+extern int halPinMode[NUM_DIGITAL_PINS];	// last pinMode() for each pin
+extern int halPinLevel[NUM_DIGITAL_PINS];	// last digitalWrite() for each pin
+extern int halAnalogLevel[NUM_DIGITAL_PINS];	// what analogRead() returns (0-1023)
+
+extern unsigned long halAnalogReads;		// count of analogRead() calls
+extern unsigned long halDigitalWrites;		// count of digitalWrite() calls
+
+// if set, analogRead() calls this instead of using halAnalogLevel[]
+
+extern int (*halAnalogHook)(uint8_t pin);
+
+// if set, digitalWrite() calls this after recording the level
+
+extern void (*halDigitalHook)(uint8_t pin, uint8_t level);
+
+// time - micros() counts from the first call. If the clock is
+//   simulated, micros() only moves when halAdvance() is called.
+
+extern unsigned long halNanos(void);		// host monotonic nanoseconds
+extern int halClockSimulated;			// true to use the simulated clock
+extern void halAdvance(unsigned long);		// move the simulated clock (micros)
+
+// serial
+
+extern unsigned long halSerialBytes;		// bytes "sent" out Serial
+extern unsigned long halSerialWaits;		//   that would have waited for room
+extern FILE *halSerialOut;			// if set, Serial goes here
+
+// I2C master side - each call is one bus transaction. The write
+//   fires the onReceive() callback, the read fires onRequest() and
+//   returns the number of bytes the sketch wrote (up to max). Both
+//   run with interrupts off, as in the TWI ISR.
+
+extern void halI2CWrite(const uint8_t *, int);
+extern int halI2CRead(uint8_t *, int max);
+extern unsigned long halISREnables;		// callbacks that turned interrupts back on
+
+// EEPROM - the contents are erased (0xFF) on first access, which
+//   happens during static construction of the sketch's objects
+
+extern uint8_t halEEPROM[HOST_EEPROM_SIZE];
+extern unsigned long halEEPROMWrites[HOST_EEPROM_SIZE];	// per cell
+
+#endif // HOST_HAL_H
@@ -0,0 +1,162 @@
+//
+// heaterbench.cpp
+//
+//   Heater control benchmark. The sketch is run on the simulated clock
+//   against the thermal model (see plant.cpp) of the spa being heated
+//   from cold, once for each way of controlling the heater:
+//
+//     - hysteresis (the original on/off with a 2 degree band)
+//     - PID with the default gains
+//     - auto-tuning, and then PID with the gains it found
+//
+//   and each is scored on how long it takes to get to the set point,
+//   how far it overshoots, how closely it holds the set point after
+//   that, and how many times it cycles the heater.
+//
+//   Usage:  heaterbench [hours]
+//
+
+#include "hal.h"
+#include "plant.h"
+#include "../PoolControl/heater.h"
+#include <stdio.h>
+
+#define DEFAULT_HOURS		6
+#define LOOP_STEP		50000UL		// simulated micros per loop()
+#define SET_POINT		1020		// tenths of degrees
+#define REACHED			0.5		// degrees below the set point that is "there"
+#define HOLD_FROM		2.0		// hours after which the hold is scored
+
+#define HEATER_PIN		6		// see PoolControl.ino
+#define THERM_PIN		A3
+
+extern Heater heater[];
+
+extern void setup(void);
+extern void loop(void);
+
+// a 400 gallon spa, with the pool heater, on a cool day
+
+static const PlantModel spa = {
+  400.0,		// gallons
+  60000.0,		// heater watts
+  90.0,			// heater lag (seconds)
+  100.0,		// watts lost per degree
+  55.0,			// ambient
+  60.0,			// sensor lag (seconds)
+  60.0,			// starting temp
+  1.0			// ADC noise
+};
+
+struct Score {
+  double reached;		// minutes to the set point (-1 if never)
+  double overshoot;		// degrees above the set point at most, after reaching it
+  double holdRMS;		// RMS error (degrees) once it has settled
+  double holdWorst;		//   and the worst error
+  int cycles;			// times the heater went on
+};
+
+//
+// gain() - the heater's PID gain (0 - kp, 1 - ki, 2 - kd) as it would
+//    be read over I2C.
+//
+static double gain(int which)
+{
+  byte buffer[16];
+  byte *b = &buffer[4 + which * 4];
+  uint32_t bits;
+  float value;
+
+  heater[0].controlI2C(buffer);
+  bits = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+  memcpy(&value,&bits,4);
+  return(value);
+}
+
+//
+// run() - heat the spa from cold for the given hours in the given mode
+//    and score it. For HEATER_TUNE, scoring starts once tuning is done.
+//
+static void run(const char *name, int mode, double hours)
+{
+  double setPoint = SET_POINT / 10.0;
+  double elapsed = 0.0;
+  double error;
+  double sumSquares = 0.0;
+  long holdSamples = 0;
+  Score score = { -1.0, 0.0, 0.0, 0.0, 0 };
+
+  heater[0].enable(0);
+  PlantStart(&spa,HEATER_PIN,THERM_PIN);
+  heater[0].config(SET_POINT);
+  heater[0].configMode(mode);
+  heater[0].enable(1);
+
+  while(elapsed < hours * 3600.0) {
+    loop();
+    halAdvance(LOOP_STEP);
+    PlantStep(LOOP_STEP / 1000000.0);
+    elapsed += LOOP_STEP / 1000000.0;
+
+    if(mode == HEATER_TUNE) {
+      if(heater[0].tuning) {
+	continue;
+      }
+      printf("  %-12s tuned in %.0f minutes: kp %.3f ki %.6f kd %.1f\n",name,elapsed / 60.0,
+	     gain(0),gain(1),gain(2));
+      mode = HEATER_PID;
+      name = "PID (tuned)";
+      heater[0].enable(0);
+      PlantStart(&spa,HEATER_PIN,THERM_PIN);
+      heater[0].enable(1);
+      elapsed = 0.0;
+      continue;
+    }
+
+    error = PlantWater() - setPoint;
+    if(score.reached < 0.0 && error > -REACHED) {
+      score.reached = elapsed / 60.0;
+    }
+    if(score.reached >= 0.0 && error > score.overshoot) {
+      score.overshoot = error;
+    }
+    if(elapsed >= HOLD_FROM * 3600.0) {
+      sumSquares += error * error;
+      holdSamples++;
+      if(fabs(error) > score.holdWorst) {
+	score.holdWorst = fabs(error);
+      }
+    }
+  }
+
+  score.cycles = PlantCycles();
+  if(holdSamples) {
+    score.holdRMS = sqrt(sumSquares / holdSamples);
+  }
+  printf("  %-12s %10.1f %10.2f %10.2f %10.2f %8d\n",name,score.reached,score.overshoot,
+	 score.holdRMS,score.holdWorst,score.cycles);
+}
+
+int main(int argc, char **argv)
+{
+  double hours = DEFAULT_HOURS;
+
+  if(argc > 1) {
+    hours = atof(argv[1]);
+  }
+
+  halClockSimulated = true;
+  setup();
+
+  printf("spa %.0f gallons, %.0f kW heater, from %.0f to %.1f degrees, %.0f hours\n",
+	 spa.gallons,spa.heaterWatts / 1000.0,spa.start,SET_POINT / 10.0,hours);
+  printf("  (hold is scored from hour %.0f on)\n\n",HOLD_FROM);
+  printf("  %-12s %10s %10s %10s %10s %8s\n","","to set","overshoot","hold RMS","hold worst","heater");
+  printf("  %-12s %10s %10s %10s %10s %8s\n","","(minutes)","(degrees)","(degrees)","(degrees)","cycles");
+
+  run("hysteresis",HEATER_HYSTERESIS,hours);
+  run("PID",HEATER_PID,hours);
+  run("auto-tune",HEATER_TUNE,hours);
+
+  return(0);
+}
@@ -0,0 +1,156 @@
+//
+// plant.cpp
+//
+//   A thermal model of the water that the heater heats, for running
+//   the sketch's heater control against on the simulated clock:
+//
+//     - the heater ramps toward full heat (or none) with a first-order
+//       lag, since the exchanger has to warm up and cool down
+//     - the water gains that heat and loses heat to the air in
+//       proportion to how much warmer it is
+//     - the thermometer follows the water with a lag of its own (it
+//       is in the plumbing, not the spa)
+//
+//   The thermometer is turned into what the sketch reads on its pin:
+//   the resistance from the inverse of the configured Steinhart-Hart
+//   curve (the one in the config image, so a curve set over I2C is
+//   followed), then the ADC count of the voltage divider.
+//
+//   The heater is whatever the sketch has its relay pin set to. The
+//   time it is on, the times it goes on, and the energy it uses (its
+//   rated power for as long as it is on) are kept for scoring.
+//
+
+#include "hal.h"
+#include "plant.h"
+#include "../PoolControl/config.h"
+#include <math.h>
+#include <stdlib.h>
+
+#define DIVIDER_OHMS		10000.0		// the divider resistor (see PoolControl.ino)
+#define BTU_PER_GALLON_F	8.34		// heat to warm a gallon one degree
+#define BTU_PER_WATT_SECOND	(3.412 / 3600.0)
+
+static PlantModel model;
+static int relayPin;
+static int sensorPin;
+static double water;		// degrees F
+static double sensor;		//   and where the thermometer is
+static double heat;		// heater output, 0 - 1
+static double onTime;		// seconds the heater has been on
+static double energy;		//   and kWh it has used
+static int cycles;		// times it has gone on
+static int wasHeating;
+
+//
+// thermistorADC() - the ADC count for the given temperature, by way of
+//    the Steinhart-Hart curve solved for ln(R) (it is a cubic with no
+//    square term, so there is a closed form).
+//
+static int thermistorADC(double fahrenheit)
+{
+  ThermometerConfig *curve = &Config()->therm[0];
+  double kelvin = (fahrenheit - 32.0) * 5.0 / 9.0 + 273.15;
+  double x = (curve->c1 - 1.0 / kelvin) / curve->c3;
+  double y = sqrt(pow(curve->c2 / (3.0 * curve->c3),3) + x * x / 4.0);
+  double lnR = cbrt(y - x / 2.0) - cbrt(y + x / 2.0);
+  double adc = 1023.0 / (1.0 + exp(lnR) / DIVIDER_OHMS);
+
+  if(model.noise > 0.0) {
+    adc += model.noise * (2.0 * rand() / RAND_MAX - 1.0);
+  }
+  return((int)constrain(lround(adc),0L,1023L));
+}
+
+static int plantAnalog(uint8_t pin)
+{
+  if(pin == sensorPin) {
+    return(thermistorADC(sensor));
+  }
+  return(halAnalogLevel[pin]);
+}
+
+//
+// PlantStart() - start the model over, and hook it up to the sketch's
+//    heater relay pin (on when LOW) and thermometer pin.
+//
+void PlantStart(const PlantModel *m, int heaterPin, int thermPin)
+{
+  model = *m;
+  relayPin = heaterPin;
+  sensorPin = thermPin;
+  water = sensor = model.start;
+  heat = 0.0;
+  onTime = 0.0;
+  energy = 0.0;
+  cycles = 0;
+  wasHeating = false;
+  halAnalogHook = plantAnalog;
+}
+
+//
+// PlantChange() - change the conditions (like the air getting colder)
+//    without starting over. The start temp is ignored.
+//
+void PlantChange(const PlantModel *m)
+{
+  model = *m;
+}
+
+int PlantHeating(void)
+{
+  return(halPinMode[relayPin] == OUTPUT && halPinLevel[relayPin] == LOW);
+}
+
+//
+// PlantStep() - move the model along by the given time, which should
+//    be short next to the lags (a second or less).
+//
+void PlantStep(double seconds)
+{
+  double capacity = model.gallons * BTU_PER_GALLON_F;		// BTU per degree
+  double in, out;
+  int heating = PlantHeating();
+
+  if(heating) {
+    onTime += seconds;
+    energy += model.heaterWatts * seconds / 3600000.0;
+    if(!wasHeating) {
+      cycles++;
+    }
+  }
+  wasHeating = heating;
+
+  heat += ((heating?1.0:0.0) - heat) * seconds / model.heaterLag;
+
+  in = heat * model.heaterWatts * BTU_PER_WATT_SECOND;
+  out = (water - model.ambient) * model.lossWatts * BTU_PER_WATT_SECOND;
+  water += (in - out) * seconds / capacity;
+
+  sensor += (water - sensor) * seconds / model.sensorLag;
+}
+
+double PlantWater(void)
+{
+  return(water);
+}
+
+double PlantSensor(void)
+{
+  return(sensor);
+}
+
+double PlantEnergy(void)
+{
+  return(energy);
+}
+
+double PlantOnTime(void)
+{
+  return(onTime);
+}
+
+int PlantCycles(void)
+{
+  return(cycles);
+}
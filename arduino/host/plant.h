@@ -0,0 +1,37 @@
+//
+// plant.h
+//
+//   (see plant.cpp for information about the thermal plant model)
+//
+
+#ifndef HOST_PLANT_H
+#define HOST_PLANT_H
+
+// the water body, its heater, and its thermometer - in the units that
+//   pool equipment comes in
+
+struct PlantModel {
+  double gallons;		// water volume
+  double heaterWatts;		// heat into the water with the heater on
+  double heaterLag;		// seconds for the heater to come up to (or off of) full heat
+  double lossWatts;		// heat lost per degree F above ambient
+  double ambient;		// degrees F
+  double sensorLag;		// seconds for the thermometer to follow the water
+  double start;			// water temperature at the start (F)
+  double noise;			// ADC counts of noise (+/-) on the thermometer
+};
+
+extern void PlantStart(const PlantModel *,int heaterPin,int thermPin);
+extern void PlantStep(double seconds);	// move the model along
+extern double PlantWater(void);		// water temperature (F)
+extern double PlantSensor(void);	// what the thermometer is at (F)
+extern int PlantHeating(void);		// true if the heater relay is on
+extern void PlantChange(const PlantModel *);	// new conditions, same water
+
+// what the heater has done since PlantStart()
+
+extern double PlantEnergy(void);	// kWh the heater has used
+extern double PlantOnTime(void);	// seconds it has been on
+extern int PlantCycles(void);		// times it has gone on
+
+#endif // HOST_PLANT_H
@@ -0,0 +1,124 @@
+//
+// regcheck.cpp
+//
+//   Register check. Runs the sketch's I2C handlers the way the TWI
+//   interrupt would (see hal.h) and checks what some reads return -
+//   the cases where a register read and the same register in a gather
+//   list (see ControlGather()) have to agree:
+//
+//     - a gather of read registers returns each of them, one after
+//       the other, as long as a read of each on its own
+//     - a gather list with a write register in it (direct, or through
+//       the extended address) stops there, as a read of that register
+//       on its own returns nothing
+//
+//   Each case is printed with what came back. If any doesn't match,
+//   regcheck fails.
+//
+//   Usage:  regcheck
+//
+
+#include "hal.h"
+#include "Wire.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GATHER_REGISTER		0xea
+#define EXTENDED_REGISTER	0xf8
+
+extern void setup(void);
+extern void loop(void);
+
+struct GatherCase {
+  const char *name;
+  byte list[8];			// what is written to the gather register
+  int listLength;
+  int expect;			// bytes the frame should have after its count
+};
+
+// register lengths - valve status 4, temperature 2, pump speed 1
+
+static const GatherCase gathers[] = {
+  { "valve 0 status, temperature",		{ 0x00, 0x80 },			2,	6 },
+  { "valve status, pump speed, temperature",	{ 0x00, 0x01, 0x60, 0x80 },	4,	11 },
+  { "valve write stops the frame",		{ 0x00, 0x10, 0x80 },		3,	4 },
+  { "pump write stops the frame",		{ 0x80, 0x7c, 0x00 },		3,	2 },
+  { "system write stops the frame",		{ 0x80, 0xf0, 0x00 },		3,	2 },
+  { "extended write stops the frame",		{ 0x80, EXTENDED_REGISTER, 0x10, 0x01, 0x00 }, 5, 2 },
+  { "write first - empty frame",		{ 0x10, 0x00 },			2,	0 },
+};
+
+#define GATHER_CASES	(sizeof(gathers)/sizeof(gathers[0]))
+
+// reads of a write register on their own, which return nothing
+
+static const byte writes[] = { 0x10, 0x7c, 0xf0 };
+
+#define WRITE_CASES	(sizeof(writes)/sizeof(writes[0]))
+
+//
+// readRegister() - select the register and read it, like the master
+//    would. Returns the number of bytes the sketch sent.
+//
+static int readRegister(byte reg, byte *buffer, int size)
+{
+  halI2CWrite(&reg,1);
+  return(halI2CRead(buffer,size));
+}
+
+//
+// gather() - set up the gather list and read the frame. Returns true
+//    if it came back as long as expected.
+//
+static bool gather(const GatherCase *c)
+{
+  byte write[1 + sizeof(c->list)];
+  byte frame[BUFFER_LENGTH];
+  int count;
+
+  write[0] = GATHER_REGISTER;
+  memcpy(&write[1],c->list,c->listLength);
+  halI2CWrite(write,c->listLength + 1);
+
+  count = readRegister(GATHER_REGISTER,frame,sizeof(frame));
+  printf("  %-40s %2d bytes",c->name,(count > 0)?frame[0]:-1);
+  if(count < 1 || frame[0] != c->expect || count != frame[0] + 1) {
+    printf("  - expected %d\n",c->expect);
+    return(false);
+  }
+  printf("\n");
+  return(true);
+}
+
+int main(void)
+{
+  byte frame[BUFFER_LENGTH];
+  bool ok = true;
+  unsigned int i;
+  int count;
+
+  halClockSimulated = true;
+  setup();
+  for(i=0; i < 10; i++) {
+    halAdvance(20000);
+    loop();
+  }
+
+  printf("gather\n");
+  for(i=0; i < GATHER_CASES; i++) {
+    ok = gather(&gathers[i]) && ok;
+  }
+
+  printf("read of a write register\n");
+  for(i=0; i < WRITE_CASES; i++) {
+    count = readRegister(writes[i],frame,sizeof(frame));
+    printf("  0x%02x %36s %2d bytes%s\n",writes[i],"",count,(count != 0)?"  - expected 0":"");
+    ok = ok && count == 0;
+  }
+
+  if(!ok) {
+    printf("FAILED\n");
+    return(1);
+  }
+  return(0);
+}
@@ -0,0 +1,280 @@
+//
+// thermalsim.cpp
+//
+//   Thermal plant simulator. Runs the sketch - its thermometer and
+//   heater control, unchanged - on the simulated clock against the
+//   thermal model (see plant.cpp), following a scenario file, and
+//   sums up how the heater did:
+//
+//     - minutes to get to the set point, and how far past it it went
+//     - how closely it held the set point after that (RMS and worst,
+//       from HOLD_SETTLE on)
+//     - energy the heater used, its on time, and how many times the
+//       relay cycled
+//
+//   A scenario is a text file of "setting value" lines - the model
+//   (see PlantModel), then set_point, mode (hysteresis, pid, or tune)
+//   and hours - and "at <minutes> <setting> <value>" lines to change
+//   the conditions along the way. # starts a comment. See scenarios/.
+//
+//   Usage:  thermalsim [-m mode] scenario ...
+//
+//   -m runs every scenario in the given mode instead of its own.
+//
+
+#include "hal.h"
+#include "plant.h"
+#include "../PoolControl/heater.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOOP_STEP		50000UL		// simulated micros per loop()
+#define REACHED			0.5		// degrees below the set point that is "there"
+#define HOLD_SETTLE		30.0		// minutes after reaching it that the hold is scored
+#define MAX_CHANGES		32
+
+#define HEATER_PIN		6		// see PoolControl.ino
+#define THERM_PIN		A3
+
+extern Heater heater[];
+
+extern void setup(void);
+extern void loop(void);
+
+struct Change {
+  double minutes;		// when
+  double *setting;		//   this setting (in Scenario.model)
+  double value;			//   gets this value
+};
+
+struct Scenario {
+  PlantModel model;
+  double setPoint;		// degrees
+  double hours;
+  int mode;			// HeaterModes
+  Change changes[MAX_CHANGES];
+  int changeCount;
+};
+
+static const char *modeNames[] = { "hysteresis", "pid", "tune" };
+
+//
+// modeNumber() - the HeaterModes for the given name, or -1.
+//
+static int modeNumber(const char *name)
+{
+  unsigned int i;
+
+  for(i=0; i < sizeof(modeNames)/sizeof(modeNames[0]); i++) {
+    if(strcmp(name,modeNames[i]) == 0) {
+      return(i);
+    }
+  }
+  return(-1);
+}
+
+//
+// setting() - where the given setting is kept in the scenario, or NULL
+//    if there is no such setting.
+//
+static double *setting(Scenario *s, const char *name)
+{
+  static const struct {
+    const char *name;
+    size_t offset;
+  } settings[] = {
+    { "gallons",	offsetof(PlantModel,gallons) },
+    { "heater_watts",	offsetof(PlantModel,heaterWatts) },
+    { "heater_lag",	offsetof(PlantModel,heaterLag) },
+    { "loss_watts",	offsetof(PlantModel,lossWatts) },
+    { "ambient",	offsetof(PlantModel,ambient) },
+    { "sensor_lag",	offsetof(PlantModel,sensorLag) },
+    { "start",		offsetof(PlantModel,start) },
+    { "noise",		offsetof(PlantModel,noise) },
+  };
+  unsigned int i;
+
+  for(i=0; i < sizeof(settings)/sizeof(settings[0]); i++) {
+    if(strcmp(name,settings[i].name) == 0) {
+      return((double *)((char *)&s->model + settings[i].offset));
+    }
+  }
+  if(strcmp(name,"set_point") == 0) {
+    return(&s->setPoint);
+  }
+  if(strcmp(name,"hours") == 0) {
+    return(&s->hours);
+  }
+  return(NULL);
+}
+
+//
+// load() - read a scenario file. Returns false (having said why) if
+//    it can't be read or has something in it that isn't understood.
+//
+static int load(const char *path, Scenario *s)
+{
+  FILE *file = fopen(path,"r");
+  char line[256];
+  char name[64];
+  char word[64];
+  double minutes;
+  double *where;
+  char *hash;
+  int lineNumber = 0;
+  int ok = true;
+
+  if(file == NULL) {
+    fprintf(stderr,"%s: can't open\n",path);
+    return(false);
+  }
+
+  memset(s,0,sizeof(*s));
+  s->mode = HEATER_PID;
+
+  while(ok && fgets(line,sizeof(line),file)) {
+    lineNumber++;
+    if((hash = strchr(line,'#')) != NULL) {
+      *hash = '\0';
+    }
+    if(sscanf(line,"%63s",name) != 1) {
+      continue;					// blank
+    }
+
+    if(strcmp(name,"at") == 0) {
+      ok = (s->changeCount < MAX_CHANGES &&
+	    sscanf(line,"%*s %lf %63s %63s",&minutes,name,word) == 3 &&
+	    (where = setting(s,name)) != NULL &&
+	    where >= (double *)&s->model && where < (double *)(&s->model + 1));
+      if(ok) {
+	s->changes[s->changeCount].minutes = minutes;
+	s->changes[s->changeCount].setting = where;
+	s->changes[s->changeCount].value = atof(word);
+	s->changeCount++;
+      }
+    } else if(strcmp(name,"mode") == 0) {
+      ok = (sscanf(line,"%*s %63s",word) == 1 && (s->mode = modeNumber(word)) >= 0);
+    } else {
+      ok = (sscanf(line,"%*s %63s",word) == 1 && (where = setting(s,name)) != NULL);
+      if(ok) {
+	*where = atof(word);
+      }
+    }
+  }
+  fclose(file);
+
+  if(!ok) {
+    fprintf(stderr,"%s:%d: don't understand \"%s\"\n",path,lineNumber,name);
+  } else if(s->model.gallons <= 0.0 || s->model.heaterLag <= 0.0 || s->model.sensorLag <= 0.0 ||
+	    s->hours <= 0.0) {
+    fprintf(stderr,"%s: needs gallons, heater_lag, sensor_lag, and hours\n",path);
+    ok = false;
+  }
+  return(ok);
+}
+
+//
+// run() - run the scenario and print its summary.
+//
+static void run(const char *path, Scenario *s)
+{
+  double elapsed = 0.0;		// simulated seconds
+  double reached = -1.0;	//   when the set point was reached
+  double overshoot = 0.0;
+  double sumSquares = 0.0;
+  double worst = 0.0;
+  double error;
+  long holdSamples = 0;
+  int next = 0;			// next change
+  unsigned long started = halNanos();
+  double wall;
+
+  heater[0].enable(0);
+  PlantStart(&s->model,HEATER_PIN,THERM_PIN);
+  heater[0].config((int)(s->setPoint * 10.0 + 0.5));
+  heater[0].configMode(s->mode);
+  heater[0].enable(1);
+
+  while(elapsed < s->hours * 3600.0) {
+    while(next < s->changeCount && s->changes[next].minutes * 60.0 <= elapsed) {
+      *s->changes[next].setting = s->changes[next].value;
+      PlantChange(&s->model);
+      next++;
+    }
+
+    loop();
+    halAdvance(LOOP_STEP);
+    PlantStep(LOOP_STEP / 1000000.0);
+    elapsed += LOOP_STEP / 1000000.0;
+
+    error = PlantWater() - s->setPoint;
+    if(reached < 0.0 && error > -REACHED) {
+      reached = elapsed;
+    }
+    if(reached < 0.0) {
+      continue;
+    }
+    if(error > overshoot) {
+      overshoot = error;
+    }
+    if(elapsed - reached >= HOLD_SETTLE * 60.0) {
+      sumSquares += error * error;
+      holdSamples++;
+      if(fabs(error) > worst) {
+	worst = fabs(error);
+      }
+    }
+  }
+  wall = (halNanos() - started) / 1e9;
+
+  printf("%s - %s, %.1f hours\n",path,modeNames[s->mode],s->hours);
+  if(reached < 0.0) {
+    printf("  never got to %.1f (ended at %.2f)\n",s->setPoint,PlantWater());
+  } else {
+    printf("  to %.1f            %8.1f minutes\n",s->setPoint,reached / 60.0);
+    printf("  overshoot          %8.2f degrees\n",overshoot);
+  }
+  if(holdSamples) {
+    printf("  hold RMS           %8.2f degrees\n",sqrt(sumSquares / holdSamples));
+    printf("  hold worst         %8.2f degrees\n",worst);
+  }
+  printf("  energy             %8.1f kWh\n",PlantEnergy());
+  printf("  heater on          %8.1f hours (%.0f%%)\n",PlantOnTime() / 3600.0,
+	 100.0 * PlantOnTime() / elapsed);
+  printf("  relay cycles       %8d\n",PlantCycles());
+  printf("  speed              %8.0f x real time\n\n",elapsed / wall);
+}
+
+int main(int argc, char **argv)
+{
+  Scenario scenario;
+  int mode = -1;
+  int i = 1;
+
+  if(argc > 2 && strcmp(argv[1],"-m") == 0) {
+    if((mode = modeNumber(argv[2])) < 0) {
+      fprintf(stderr,"mode is one of hysteresis, pid, or tune\n");
+      return(1);
+    }
+    i = 3;
+  }
+  if(i >= argc) {
+    fprintf(stderr,"usage: thermalsim [-m mode] scenario ...\n");
+    return(1);
+  }
+
+  halClockSimulated = true;
+  setup();
+
+  for(; i < argc; i++) {
+    if(!load(argv[i],&scenario)) {
+      return(1);
+    }
+    if(mode >= 0) {
+      scenario.mode = mode;
+    }
+    run(argv[i],&scenario);
+  }
+
+  return(0);
+}
@@ -0,0 +1,203 @@
+//
+// tracedump.cpp
+//
+//   Turns the sketch's trace (see trace.cpp) back into text. The input
+//   is what came out of the serial port - or the trace register's
+//   reads, one after the other (the count bytes are skipped over like
+//   any other noise). Each record is printed as
+//
+//     seq  time  what  device  argument
+//
+//   where the time is the sketch's millis (only the low 16 bits - so
+//   it goes around every 65.5 seconds). A gap in the sequence numbers
+//   is records that were overwritten before they were sent.
+//
+//   Usage:  tracedump [file ...]
+//
+//   With no files, the trace is read from stdin.
+//
+
+#include "../PoolControl/trace.h"
+#include <stdio.h>
+#include <string.h>
+
+// how the argument is shown
+
+enum ArgKinds {
+  ARG_NONE,
+  ARG_INT,
+  ARG_VERSION,			// major (high byte) . minor
+  ARG_HEX,
+  ARG_MICROS,			// long - shown in seconds
+  ARG_FLOAT			// long - the bits of a float
+};
+
+struct TraceName {
+  const char *name;
+  const char *device;		// what the device number is (NULL for nothing)
+  int kind;
+};
+
+// by TraceIds - keep in step with trace.h
+
+static const TraceName names[TRACE_IDS] = {
+  { "more",		NULL,			ARG_INT },
+  { "boot",		NULL,			ARG_VERSION },
+  { "state",		"valve",		ARG_INT },
+  { "calibrate",	"valve",		ARG_NONE },
+  { "limit",		"valve",		ARG_INT },
+  { "travel up",	"valve",		ARG_MICROS },
+  { "travel down",	"valve",		ARG_MICROS },
+  { "idle current",	"valve",		ARG_INT },
+  { "init",		"pump pin",		ARG_INT },
+  { "speed",		"pump pin",		ARG_INT },
+  { "coefficient A",	"thermometer pin",	ARG_FLOAT },
+  { "coefficient B",	"thermometer pin",	ARG_FLOAT },
+  { "coefficient C",	"thermometer pin",	ARG_FLOAT },
+  { "set point",	"heater",		ARG_INT },
+  { "factory reset",	NULL,			ARG_NONE },
+  { "unsupported",	"device",		ARG_HEX },
+  { "gave up in state",	"valve",		ARG_INT }
+};
+
+struct Record {
+  int seq;
+  int id;
+  int device;
+  int arg;			// signed 16 bits
+  unsigned int time;
+};
+
+static int lastSeq = -1;
+static Record pending;		// a long waiting for its TRACE_MORE
+static int pendingLong;
+
+//
+// show() - print one record, with a long argument if there is one.
+//
+static void show(const Record *r, int haveLong, unsigned long value)
+{
+  const TraceName *name = &names[r->id];
+  float f;
+  char device[32];
+
+  device[0] = '\0';
+  if(name->device) {
+    snprintf(device,sizeof(device),"%s %d",name->device,r->device);
+  }
+  printf("%3d %6u  %-14s %-18s ",r->seq,r->time,name->name,device);
+
+  if(!haveLong && (name->kind == ARG_MICROS || name->kind == ARG_FLOAT)) {
+    printf("(high word %u - the rest was lost)\n",r->arg & 0xffff);
+    return;
+  }
+  switch(name->kind) {
+  case ARG_NONE:
+    break;
+  case ARG_INT:
+    printf("%d",r->arg);
+    break;
+  case ARG_VERSION:
+    printf("%d.%d",(r->arg >> 8) & 0xff,r->arg & 0xff);
+    break;
+  case ARG_HEX:
+    printf("0x%02x",r->arg & 0xffff);
+    break;
+  case ARG_MICROS:
+    printf("%.3f seconds",value / 1e6);
+    break;
+  case ARG_FLOAT:
+    memcpy(&f,&value,4);
+    printf("%.10g",f);
+    break;
+  }
+  printf("\n");
+}
+
+//
+// record() - one record off the wire. A long's first half is held on
+//    to until its TRACE_MORE comes along.
+//
+static void record(const Record *r)
+{
+  int kind = names[r->id].kind;
+
+  if(lastSeq >= 0 && r->seq != ((lastSeq + 1) & 0xff)) {
+    printf("    (%d lost)\n",(r->seq - lastSeq - 1) & 0xff);
+    if(pendingLong) {
+      show(&pending,false,0);
+      pendingLong = false;
+    }
+  }
+  lastSeq = r->seq;
+
+  if(pendingLong) {
+    pendingLong = false;
+    if(r->id == TRACE_MORE) {
+      show(&pending,true,((unsigned long)(pending.arg & 0xffff) << 16) | (r->arg & 0xffff));
+      return;
+    }
+    show(&pending,false,0);
+  }
+  if(kind == ARG_MICROS || kind == ARG_FLOAT) {
+    pending = *r;
+    pendingLong = true;
+    return;
+  }
+  show(r,false,0);
+}
+
+//
+// dump() - look for records in the stream. Anything that doesn't
+//    start with TRACE_SYNC and have an id that makes sense is skipped
+//    a byte at a time.
+//
+static void dump(FILE *in)
+{
+  unsigned char buffer[TRACE_WIRE_SIZE];
+  int have = 0;
+  int c;
+  Record r;
+
+  while((c = getc(in)) != EOF) {
+    buffer[have++] = c;
+    while(have > 0 && (buffer[0] != TRACE_SYNC || (have > 2 && buffer[2] >= TRACE_IDS))) {
+      memmove(buffer,buffer + 1,--have);
+    }
+    if(have < TRACE_WIRE_SIZE) {
+      continue;
+    }
+    r.seq = buffer[1];
+    r.id = buffer[2];
+    r.device = buffer[3];
+    r.arg = (short)((buffer[4] << 8) | buffer[5]);
+    r.time = (buffer[6] << 8) | buffer[7];
+    record(&r);
+    have = 0;
+  }
+  if(pendingLong) {
+    show(&pending,false,0);
+    pendingLong = false;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  FILE *in;
+  int i;
+
+  printf("seq   time  what           device             argument\n");
+  if(argc < 2) {
+    dump(stdin);
+    return(0);
+  }
+  for(i=1; i < argc; i++) {
+    if((in = fopen(argv[i],"rb")) == NULL) {
+      perror(argv[i]);
+      return(1);
+    }
+    dump(in);
+    fclose(in);
+  }
+  return(0);
+}
@@ -0,0 +1,398 @@
+//
+// valvesim.cpp
+//
+//   Valve simulator. Runs the sketch - its valve calibration and moves,
+//   unchanged - on the simulated clock against a model of each valve's
+//   actuator and current sensor (see actuator.cpp):
+//
+//     - both valves are calibrated from wherever they happen to be,
+//       and the travel times the sketch measured are compared to the
+//       actuators' own
+//     - then both are moved to random positions (now and then to a
+//       limit) over and over, and after each move the position the
+//       sketch thinks the valve is at is compared to where it is -
+//       as it is every MOVING_SAMPLE along the way
+//     - then the calibration is checked with a quick verify, and again
+//       after the actuators have worn (one a little, which the verify
+//       should pass, and one a lot, which should need the full one)
+//
+//   and each valve is scored on its position error, how much its motor
+//   ran, and how long the simulated time took on the host.
+//
+//   Moves to a limit should end when the current shows the valve has
+//   hit its stop (see limitReached()), not when the time budget and its
+//   VALVE_LIMIT_OVERRUN run out. If the motor of any limit move is left
+//   running against the stop for half of the overrun, valvesim fails.
+//   (Moves that start with the valve already at the stop are left out
+//   - its limit switch is open, so there is no current to see.)
+//
+//   Usage:  valvesim [moves [seed [trace]]]
+//
+//   If a trace file is given, what the sketch sends out Serial (its
+//   trace) is written there - see tracedump.
+//
+
+#include "hal.h"
+#include "actuator.h"
+#include "../PoolControl/valve.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_MOVES		2000		// per valve
+#define LOOP_STEP		1000UL		// simulated micros per loop()
+#define LIMIT_MOVES		10		// percent of the moves that go to a limit
+#define MOVING_SAMPLE		100		// loop()s between position checks while moving
+#define CALIBRATE_MAX		300.0		// seconds before calibration has failed
+#define VALVES			2
+#define WEAR_LITTLE		1.02		// travel times after wear
+#define WEAR_LOT		1.12
+
+// see PoolControl.ino
+
+static const int pins[VALVES][3] = {
+  //  on dir monitor
+  { 2, 3, A7 },
+  { 4, 5, A6 }
+};
+
+extern Valve valve[];
+
+extern void setup(void);
+extern void loop(void);
+
+// two actuators that aren't quite alike - the second one is slower,
+//   and faster closing than opening, and its current is on the other
+//   side of idle
+//
+// NOTE - the decay is kept well under the 100 ms that calibration waits
+//   before it benchmarks the idle current. Much longer and the benchmark
+//   is taken while the reading is still on its way down, and calibration
+//   never sees the stop.
+
+static ActuatorModel models[VALVES] = {
+  //  deg    up    down  spinUp  idle  running inrush stall stallTime decay drift noise
+  { 180.0, 22.0, 20.0,  0.25,  512.0,  150.0,  120.0, 90.0,  0.15,   0.04,  3.0,  2.0 },
+  { 180.0, 31.0, 28.5,  0.40,  508.0, -140.0,  100.0, 70.0,  0.25,   0.03,  4.0,  3.0 }
+};
+
+struct Score {
+  long moves;
+  double sumError;		// degrees, after each move
+  double sumSquares;
+  double worst;
+  long limitMoves;
+  double sumLimitError;		//   just before a limit move (the slop it clears)
+  double worstLimitError;
+  long limitOnCurrent;		//   how they ended (see limitEnd())
+  long limitOnBudget;
+  long limitAtStop;
+  double worstStop;		//   and the longest the motor ran against the stop
+  long movingSamples;		//   and along the way
+  double sumMoving;
+  double worstMoving;
+};
+
+static double elapsed;		// simulated seconds
+
+static void step(void)
+{
+  loop();
+  halAdvance(LOOP_STEP);
+  ActuatorStep(LOOP_STEP / 1000000.0);
+  elapsed += LOOP_STEP / 1000000.0;
+}
+
+//
+// sketchPosition() - where the sketch thinks the valve is.
+//
+static int sketchPosition(int i)
+{
+  byte buffer[4];
+
+  valve[i].status(buffer);
+  return((int16_t)((buffer[2] << 8) | buffer[3]));
+}
+
+//
+// actualPosition() - where the valve really is, in the sketch's degrees.
+//
+static double actualPosition(int i)
+{
+  ValveConfig *c = &Config()->valve[i];
+
+  return(c->limitMin + ActuatorPosition(i) / models[i].degrees * (c->limitMax - c->limitMin));
+}
+
+static double positionError(int i)
+{
+  return(fabs(actualPosition(i) - sketchPosition(i)));
+}
+
+//
+// limitEnd() - score how a limit move ended, from how long the motor
+//    was left running against the stop: just long enough for the
+//    current to show it, or on into the overrun.
+//
+static void limitEnd(int i, Score *s, int atStop)
+{
+  double stop = ActuatorStopTime(i);
+
+  if(atStop) {
+    s->limitAtStop++;
+    return;
+  }
+  if(stop < VALVE_LIMIT_OVERRUN / 2e6) {
+    s->limitOnCurrent++;
+  } else {
+    s->limitOnBudget++;
+  }
+  if(stop > s->worstStop) {
+    s->worstStop = stop;
+  }
+}
+
+static void score(Score *s, double error)
+{
+  s->moves++;
+  s->sumError += error;
+  s->sumSquares += error * error;
+  if(error > s->worst) {
+    s->worst = error;
+  }
+}
+
+//
+// dwell() - print how long the valve spent in each state of the state
+//    table the last time it was there (see dwellGet()).
+//
+static void dwell(int i)
+{
+  byte buffer[VALVE_DWELL_PAGE * 3];
+  int page;
+  int count;
+  int j;
+
+  printf("  valve %d dwell   ",i);
+  for(page=0; (count = valve[i].dwellGet(page,buffer)) > 0; page++) {
+    for(j=0; j < count; j += 3) {
+      if(buffer[j+1] || buffer[j+2]) {
+	printf(" %d:%u",buffer[j],(buffer[j+1] << 8) | buffer[j+2]);
+      }
+    }
+  }
+  printf(" (state:ms)\n");
+}
+
+//
+// calibrate() - calibrate both valves at once, or just verify them.
+//    Returns false if either doesn't finish.
+//
+static int calibrate(const char *title, int quick)
+{
+  double start = elapsed;
+  int full[VALVES];		// true if a verify went to a full calibration
+  ValveConfig *c;
+  byte buffer[4];
+  int i;
+
+  for(i=0; i < VALVES; i++) {
+    full[i] = !quick;
+    if(quick) {
+      valve[i].verify();
+    } else {
+      valve[i].calibrate();
+    }
+  }
+  while(elapsed - start < CALIBRATE_MAX && (valve[0].active() || valve[1].active())) {
+    step();
+    for(i=0; i < VALVES; i++) {
+      valve[i].status(buffer);
+      if(buffer[0] == (byte)ValveStates::CALIBRATE_START) {
+	full[i] = true;
+      }
+    }
+  }
+
+  printf("%-17s %8.1f seconds\n",title,elapsed - start);
+  for(i=0; i < VALVES; i++) {
+    c = &Config()->valve[i];
+    if(quick) {
+      printf("  valve %d          %s\n",i,full[i]?"drifted - full calibration":"verified");
+    }
+    printf("  valve %d up       %8.2f seconds (actual %.2f)\n",i,c->travelUp / 1e6,models[i].travelUp);
+    printf("  valve %d down     %8.2f seconds (actual %.2f)\n",i,c->travelDown / 1e6,models[i].travelDown);
+    printf("  valve %d at       %8d degrees (actual %.1f)\n",i,sketchPosition(i),actualPosition(i));
+    dwell(i);
+  }
+  return(!valve[0].active() && !valve[1].active());
+}
+
+//
+// nextTarget() - a random position to move to, other than where the
+//    valve is now - now and then one of the limits.
+//
+static int nextTarget(int i)
+{
+  ValveConfig *c = &Config()->valve[i];
+  int target;
+
+  do {
+    if(rand() % 100 < LIMIT_MOVES) {
+      target = (rand() & 1)?c->limitMax:c->limitMin;
+    } else {
+      target = c->limitMin + 1 + rand() % (c->limitMax - c->limitMin - 1);
+    }
+  } while(target == sketchPosition(i));
+  return(target);
+}
+
+static void report(int i, Score *s)
+{
+  printf("valve %d - %ld moves\n",i,s->moves);
+  printf("  position error   %8.2f degrees mean, %.2f RMS, %.2f worst\n",
+	 s->sumError / s->moves,sqrt(s->sumSquares / s->moves),s->worst);
+  if(s->movingSamples) {
+    printf("  while moving     %8.2f degrees mean, %.2f worst\n",
+	   s->sumMoving / s->movingSamples,s->worstMoving);
+  }
+  if(s->limitMoves) {
+    printf("  before a limit   %8.2f degrees mean, %.2f worst\n",
+	   s->sumLimitError / s->limitMoves,s->worstLimitError);
+    printf("  limit moves      %8ld ended on the current, %ld on the budget, %ld already there\n",
+	   s->limitOnCurrent,s->limitOnBudget,s->limitAtStop);
+    printf("  at the stop      %8.2f seconds worst, motor on\n",s->worstStop);
+  }
+  printf("  motor on         %8.1f minutes (%.1f seconds per move)\n",
+	 ActuatorMotorTime(i) / 60.0,ActuatorMotorTime(i) / s->moves);
+  printf("  travel           %8.0f degrees, %d starts\n",ActuatorTravel(i),ActuatorStarts(i));
+}
+
+int main(int argc, char **argv)
+{
+  long moves = (argc > 1)?atol(argv[1]):DEFAULT_MOVES;
+  unsigned int seed = (argc > 2)?atoi(argv[2]):1;
+  const char *trace = (argc > 3)?argv[3]:NULL;
+  Score scores[VALVES];
+  int moving[VALVES];
+  int limiting[VALVES];		// true if the move is to a limit
+  int atStop[VALVES];		//   that the valve is already at
+  ValveConfig *c;
+  unsigned long started;
+  double wall;
+  double error;
+  long steps = 0;
+  int target;
+  int i;
+
+  if(moves <= 0) {
+    fprintf(stderr,"usage: valvesim [moves [seed [trace]]]\n");
+    return(1);
+  }
+  if(trace && (halSerialOut = fopen(trace,"wb")) == NULL) {
+    perror(trace);
+    return(1);
+  }
+
+  srand(seed);
+  halClockSimulated = true;
+  setup();
+
+  started = halNanos();
+  for(i=0; i < VALVES; i++) {
+    ActuatorAttach(i,&models[i],pins[i][0],pins[i][1],pins[i][2],
+		   models[i].degrees * rand() / RAND_MAX);
+  }
+
+  if(!calibrate("calibration",false)) {
+    printf("calibration didn't finish\n");
+    return(1);
+  }
+
+  // both valves are kept moving - as soon as one is done, it is
+  //   scored and sent somewhere else
+
+  memset(scores,0,sizeof(scores));
+  memset(moving,0,sizeof(moving));
+  memset(limiting,0,sizeof(limiting));
+  while(scores[0].moves < moves || scores[1].moves < moves) {
+    steps++;
+    for(i=0; i < VALVES; i++) {
+      if(valve[i].active()) {
+	if(steps % MOVING_SAMPLE == 0) {
+	  error = positionError(i);
+	  scores[i].movingSamples++;
+	  scores[i].sumMoving += error;
+	  if(error > scores[i].worstMoving) {
+	    scores[i].worstMoving = error;
+	  }
+	}
+	continue;
+      }
+      if(moving[i]) {
+	score(&scores[i],positionError(i));
+	if(limiting[i]) {
+	  limitEnd(i,&scores[i],atStop[i]);
+	}
+	moving[i] = false;
+      }
+      if(scores[i].moves >= moves) {
+	continue;
+      }
+      target = nextTarget(i);
+      c = &Config()->valve[i];
+      limiting[i] = (target == c->limitMin || target == c->limitMax);
+      if(limiting[i]) {
+	atStop[i] = (target == c->limitMin)?(ActuatorPosition(i) <= 0.0):
+					    (ActuatorPosition(i) >= models[i].degrees);
+	scores[i].limitMoves++;
+	scores[i].sumLimitError += positionError(i);
+	if(positionError(i) > scores[i].worstLimitError) {
+	  scores[i].worstLimitError = positionError(i);
+	}
+      }
+      valve[i].move(target);
+      moving[i] = true;
+    }
+    step();
+  }
+
+  printf("\n");
+  for(i=0; i < VALVES; i++) {
+    report(i,&scores[i]);
+  }
+  for(i=0; i < VALVES; i++) {
+    if(scores[i].limitOnBudget) {
+      printf("valve %d limit moves ran on against the stop - the current didn't end them\n",i);
+      return(1);
+    }
+  }
+
+  // a routine check, and then one after some wear
+
+  printf("\n");
+  if(!calibrate("quick verify",true)) {
+    printf("verify didn't finish\n");
+    return(1);
+  }
+  for(i=0; i < VALVES; i++) {
+    models[i].travelUp *= (i == 0)?WEAR_LITTLE:WEAR_LOT;
+    models[i].travelDown *= (i == 0)?WEAR_LITTLE:WEAR_LOT;
+    ActuatorChange(i,&models[i]);
+  }
+  printf("\n");
+  if(!calibrate("verify after wear",true)) {
+    printf("verify didn't finish\n");
+    return(1);
+  }
+  wall = (halNanos() - started) / 1e9;
+  printf("\nsimulated         %8.1f hours in %.2f seconds (%.0f x real time)\n",
+	 elapsed / 3600.0,wall,elapsed / wall);
+  printf("serial out        %8lu bytes, %lu would have waited\n",halSerialBytes,halSerialWaits);
+  if(halSerialOut) {
+    fclose(halSerialOut);
+  }
+
+  return(0);
+}
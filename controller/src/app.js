@@ -14,28 +14,62 @@ const System = require('./systemControl');
 const i2c = require('i2c-bus');
 const i2cBusNum = 1;
 
-// need to read configuration here to create the valves
-global.Valves = [
-    /* valve 0 */ new Valve(180,'norm',0),
-    /* valve 1 */ new Valve(180,'rev',1),
-    /* more valves go here - read the config */
-];
-global.Thermometers = [
-    /* therm 0 */ new Thermometer(0),
+// the devices are set up for what is normally hooked up, and then for
+//   what the Arduino says is there (see configure()). What discovery
+//   can't say is how far each valve turns and which way.
+
+const VALVE_SETUP = [
+    /* valve 0 */ {span:180,dir:'norm'},
+    /* valve 1 */ {span:180,dir:'rev'},
 ];
+const VALVE_DEFAULT = {span:180,dir:'norm'};
+const DISCOVERY_VERSION = 1;
+
+function newValve(i)
+{
+    var setup = VALVE_SETUP[i] || VALVE_DEFAULT;
+    return(new Valve(setup.span,setup.dir,i));
+}
 
+global.Valves = [ newValve(0), newValve(1) ];
+global.Thermometers = [ new Thermometer(0) ];
 global.Pumps = [
     /* pump 0 - main */ new Pump(0),
     /* pump 1 - booster */ new Pump(1),
 ];
+global.Heaters = [ new Heater(0) ];
+global.Lights = [ new Light(0) ];
+
+//
+// resize() - make the list of devices the given length, keeping the
+//    ones that are already there.
+//
+function resize(list,count,make)
+{
+    list.length = Math.min(list.length,count);
+    while(list.length < count) {
+	list.push(make(list.length));
+    }
+}
 
-global.Heaters = [
-    /* heater 0 */ new Heater(0),
-];
-
-global.Lights = [
-    /* light 0 */ new Light(0),
-];
+//
+// configure() - set up the devices for what the Arduino has (see
+//    Arduino.discover()). Firmware that doesn't know the discovery
+//    register leaves things as they are.
+//
+function configure(found)
+{
+    if(found.version != DISCOVERY_VERSION) {
+	console.log("Arduino discovery not there - using the default devices");
+	return;
+    }
+    console.log("Arduino firmware",found.firmware,found);
+    resize(Valves,found.valves,newValve);
+    resize(Thermometers,found.thermometers,(i) => new Thermometer(i));
+    resize(Heaters,found.heaters,(i) => new Heater(i));
+    resize(Pumps,found.pumps,(i) => new Pump(i));
+    resize(Lights,found.lights,(i) => new Light(i));
+}
 
 global.ModeControl = Modes;
 
@@ -58,6 +92,14 @@ async function main() {
 	    global.LCD = new LCDClass(i2cObj,i2cBusNum);   // shouldn't have to pass bus num :-(
 	})
 
+    // find out what the Arduino has hooked up to it
+
+	.then(() => (
+	    Arduino.discover()
+		.then((found) => configure(found))
+		.catch((e) => console.log("Arduino discovery failed (ignored)",e))
+	))
+
     // then fire-up the LCD
 
 	.then(() => LCD.displayStart())
@@ -6,11 +6,45 @@
 
 ARDUINO_ADDR = 0x20;
 
+const EXTENDED_REGISTER = 0xf8;		// see control.cpp
+const DISCOVERY_REGISTER = 0xe8;
+const DEVICES_SHORT = 4;		// devices a register's target field reaches
+
+const BATCH_REGISTER = 0xf4;
+const BATCH_STATUS_REGISTER = 0xe9;
+const BATCH_OK = 0;			// BATCH_* status (control.cpp)
+const BATCH_DUPLICATE = 1;
+const BATCH_MAX = 27;			// bytes of commands that fit in one write
+const BATCH_TRIES = 3;
+
+const GATHER_REGISTER = 0xea;
+const GATHER_MAX = 8;			// registers in one list
+
+//
+// crc8() - the SMBus PEC (CRC-8, x^8 + x^2 + x + 1) of the given bytes.
+//
+function crc8(bytes)
+{
+    var crc = 0;
+
+    for(var byte of bytes) {
+	crc ^= byte;
+	for(var bit = 0; bit < 8; bit++) {
+	    crc = (crc & 0x80)?((crc << 1) ^ 0x07) & 0xff:(crc << 1) & 0xff;
+	}
+    }
+    return(crc);
+}
+
 class Arduino {
 
     constructor(i2cObj)
     {
 	this.i2c = i2cObj;
+	this.extended = Promise.resolve();	// extended reads, one at a time
+	this.batches = Promise.resolve();	//   and batches
+	this.gathers = Promise.resolve();	//   and gathers
+	this.batchSeq = Math.floor(Math.random() * 256);
     }
 
     writeByte(register,byte)
@@ -62,6 +96,160 @@ class Arduino {
 		.then(() => rbuf)
 	);
     }
+
+    //
+    // writeDevice()/readDevice() - like writeBytes()/readBytes(), but
+    //    for the given device of the kind the register is for. The
+    //    register's target field only reaches the first four, so
+    //    devices past that go through the extended address register.
+    //
+    //    An extended read is two transactions - picking the device and
+    //    then the read - so they are kept from overlapping each other.
+    //
+    writeDevice(register,device,bytes)
+    {
+	var command = this.command(register,device,bytes);
+
+	return(this.writeBytes(command.register,command.bytes.length,command.bytes));
+    }
+
+    //
+    // command() - a write to the given register of the given device, as
+    //    {register,bytes} - for writeDevice() or writeBatch().
+    //
+    command(register,device,bytes)
+    {
+	if(device < DEVICES_SHORT) {
+	    return({register:register | device,bytes:bytes});
+	}
+	return({register:EXTENDED_REGISTER,bytes:[register,device,...bytes]});
+    }
+
+    //
+    // writeBatch() - send the given commands (see command()) so that the
+    //    Arduino carries them out together, in order - as few writes as
+    //    they fit in. Each write carries a sequence number and a CRC,
+    //    and the Arduino's status is read back after it. If it didn't
+    //    go through, the same write is sent again - the Arduino ignores
+    //    it if it already has it.
+    //
+    writeBatch(commands)
+    {
+	var chain = this.batches;
+	var batch = [];
+	var size = 0;
+
+	for(var command of commands) {
+	    if(batch.length && size + command.bytes.length + 2 > BATCH_MAX) {
+		chain = this.sendBatch(chain,batch);
+		batch = [];
+		size = 0;
+	    }
+	    batch.push(command);
+	    size += command.bytes.length + 2;
+	}
+	if(batch.length) {
+	    chain = this.sendBatch(chain,batch);
+	}
+	this.batches = chain.catch(() => null);
+	return(chain);
+    }
+
+    sendBatch(chain,batch)
+    {
+	var seq = this.batchSeq = (this.batchSeq + 1) & 0xff;
+	var frame = [seq,batch.length];
+	var tries = 0;
+
+	for(var command of batch) {
+	    frame.push(command.register,command.bytes.length,...command.bytes);
+	}
+	frame.push(crc8([ARDUINO_ADDR << 1,BATCH_REGISTER,...frame]));
+
+	var send = () => (
+	    this.writeBytes(BATCH_REGISTER,frame.length,frame)
+		.then(() => this.readBytes(BATCH_STATUS_REGISTER,2))
+		.then((status) => {
+		    if(status[0] != seq || (status[1] != BATCH_OK && status[1] != BATCH_DUPLICATE)) {
+			throw new Error(`batch ${seq} not taken (status ${status[1]})`);
+		    }
+		})
+		.catch((e) => {
+		    if(++tries >= BATCH_TRIES) {
+			throw e;
+		    }
+		    return(send());
+		})
+	);
+
+	return(chain.then(send));
+    }
+
+    readDevice(register,device,count)
+    {
+	if(device < DEVICES_SHORT) {
+	    return(this.readBytes(register | device,count));
+	}
+	var read = this.extended
+	    .then(() => this.writeBytes(EXTENDED_REGISTER,2,[register,device]))
+	    .then(() => this.readBytes(EXTENDED_REGISTER,count));
+	this.extended = read.catch(() => null);
+	return(read);
+    }
+
+    //
+    // gather() - read a list of registers at once. Each is given as
+    //    {register,device,length} and the result is a Buffer for each,
+    //    in the same order. Like an extended read, it is two
+    //    transactions (the list and then the read), so gathers are
+    //    kept from overlapping each other.
+    //
+    gather(registers)
+    {
+	var list = [];
+	var length = 1;
+
+	if(registers.length > GATHER_MAX) {
+	    return(Promise.reject(new Error(`gather of more than ${GATHER_MAX} registers`)));
+	}
+	for(var reg of registers) {
+	    var command = this.command(reg.register,reg.device,[]);
+	    list.push(command.register,...command.bytes);
+	    length += reg.length;
+	}
+
+	var read = this.gathers
+	    .then(() => this.writeBytes(GATHER_REGISTER,list.length,list))
+	    .then(() => this.readBytes(GATHER_REGISTER,length))
+	    .then((data) => {
+		var at = 1;
+		if(data[0] != length - 1) {
+		    throw new Error(`gather returned ${data[0]} bytes, not ${length - 1}`);
+		}
+		return(registers.map((reg) => data.subarray(at,at += reg.length)));
+	    });
+	this.gathers = read.catch(() => null);
+	return(read);
+    }
+
+    //
+    // discover() - what the firmware is and what it has hooked up to it
+    //    (see ControlDiscovery() in control.cpp).
+    //
+    discover()
+    {
+	return(
+	    this.readBytes(DISCOVERY_REGISTER,10)
+		.then((data) => ({version:data[0],
+				  firmware:`${data[1]}.${data[2]}`,
+				  valves:data[3],
+				  thermometers:data[4],
+				  heaters:data[5],
+				  pumps:data[6],
+				  lights:data[7],
+				  features:data.readUInt16BE(8)}))
+	);
+    }
 }
     
 module.exports = Arduino;
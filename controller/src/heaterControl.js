@@ -4,6 +4,10 @@
 //    Control the heater(s). But we really only have one.
 //
 
+// heater modes, in the order of HeaterModes (heater.h)
+
+const HEATER_MODES = ['hysteresis','pid','tune'];
+
 module.exports = class {
 
     constructor(num)
@@ -38,6 +42,59 @@ module.exports = class {
 	);
     }
     
+    //
+    // control() - how the heater is being controlled (see HeaterModes in
+    //    heater.h): the mode, whether it is auto-tuning, the PID output
+    //    (0 - 1), and the PID gains.
+    //
+    control()
+    {
+	var command = 0xa0 | (0x03 << 2) | this.heaterNum;
+
+	return(
+	    Arduino.readBytes(command,16)
+		.then((data) => ({mode:HEATER_MODES[data[0]] || 'unknown',
+				  tuning:data[1]?true:false,
+				  output:data.readUInt16BE(2) / 1000,
+				  kp:data.readFloatBE(4),
+				  ki:data.readFloatBE(8),
+				  kd:data.readFloatBE(12)}))
+	);
+    }
+
+    //
+    // mode() - 'hysteresis', 'pid', or 'tune' (which auto-tunes and then
+    //    switches to pid). If gains are given ({kp,ki,kd}) they are set
+    //    too.
+    //
+    mode(mode,gains)
+    {
+	var command = 0xb0 | (0x03 << 2) | this.heaterNum;
+	var sendArray = Buffer.alloc(gains?13:1);
+
+	sendArray[0] = HEATER_MODES.indexOf(mode);
+	if(gains) {
+	    sendArray.writeFloatBE(gains.kp,1);
+	    sendArray.writeFloatBE(gains.ki,5);
+	    sendArray.writeFloatBE(gains.kd,9);
+	}
+	if(sendArray[0] == 0xff) {
+	    return(Promise.resolve({status:0}));
+	}
+	return(
+	    Arduino.writeBytes(command,sendArray.length,Array.from(sendArray))
+		.then(() => ({status:1}))
+		.catch(() => ({status:0}))
+	);
+    }
+
+    // enableCommand() - enable() for Arduino.writeBatch()
+
+    enableCommand(onoff)
+    {
+	return(Arduino.command(0xb0 | ((onoff & 0x01) << 2),this.heaterNum,[]));
+    }
+
     enable(onoff)
     {
 	var command = 0xb0 | ((onoff & 0x01) << 2) | this.heaterNum;
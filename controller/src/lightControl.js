@@ -14,7 +14,7 @@ module.exports = class {
 
     status()
     {
-	var command = 0xc0 | this.heaterNum;
+	var command = 0xc0 | this.lightNum;
 
 	return(
 	    Arduino.readBytes(command,1)
@@ -26,11 +26,18 @@ module.exports = class {
 
     control(onoff)
     {
-	var command = 0xd0 | ((onoff & 0x01) << 2) | this.heaterNum;
+	var command = 0xd0 | ((onoff & 0x01) << 2) | this.lightNum;
 	return(
 	    Arduino.writeByte(command,0)
 		.then(() => ({result:true}))
 		.catch(() => ({result:false}))
 	);
     }
+
+    // controlCommand() - control() for Arduino.writeBatch()
+
+    controlCommand(onoff)
+    {
+	return(Arduino.command(0xd0 | ((onoff & 0x01) << 2),this.lightNum,[]));
+    }
 }
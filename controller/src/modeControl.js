@@ -109,17 +109,26 @@ var Mode_WarmPool_Plan = [
 //  mappings to objects that control them. These keys are those that MUST
 //  be used in mode setting definitions.
 
+//  Each also has the Arduino command that sets it (batch), so that the
+//  settings in a row in a plan can be sent all at once (see setMode()).
+
 const resources = { 'heater':{set:(h) => Heaters[0].enable(h),
+			      batch:(h) => Heaters[0].enableCommand(h),
 			      get:(h) => Heaters[0].status().then((status) => status.enabled)},
 		    'valve0':{set:(v) => Valves[0].move(v),
+			      batch:(v) => Valves[0].moveCommand(v),
 			      get:(v) => Valves[0].status().then((status) => status.position)},
 		    'valve1':{set:(v) => Valves[1].move(v),
+			      batch:(v) => Valves[1].moveCommand(v),
 			      get:(v) => Valves[1].status().then((status) => status.position)},
 		    'pump0':{set:(p) => Pumps[0].setSpeed(p),
+			     batch:(p) => Pumps[0].speedCommand(p),
 			     get:(p) => Pumps[0].status().then((status) => status.status) },
 		    'pump1':{set:(p) => Pumps[1].setSpeed(p),
+			     batch:(p) => Pumps[1].speedCommand(p),
 			     get:(p) => Pumps[1].status().then((status) => status.status) },
 		    'light':{set:(l) => Lights[0].control(l),
+			     batch:(l) => Lights[0].controlCommand(l),
 			     get:(l) => Lights[0].status().then((status) => status.status) },
 		  };
 
@@ -174,16 +183,30 @@ class ControlMode {
 	//
 	// Note that this routine builds up the complete chain prior
 	//   to returning.
+	//
+	// Resource settings in a row (up to the next command) are sent
+	//   to the Arduino as one batch, which it carries out in order.
+
+	let batch = [];
+	let send = () => {
+	    let commands = batch;
+	    batch = [];
+	    if(commands.length) {
+		chain = chain.then(() => Arduino.writeBatch(commands.map((make) => make())));
+	    }
+	};
 
 	this.myPlan.forEach((instruction) => {
 	    var resource = Object.keys(instruction)[0];   // all but #1 ignoerd
 
 	    if(resources.hasOwnProperty(resource)) {     // command or resource setting?
-		chain = chain.then(() => resources[resource].set(instruction[resource]));
+		batch.push(() => resources[resource].batch(instruction[resource]));
 	    } else {
+		send();
 		chain = chain.then(() => commands[resource](instruction[resource]));
 	    }
 	});
+	send();
 
 	return(chain);
     }
@@ -16,24 +16,21 @@ const valveStateMachine = {
     121:"Cal. Start - 3 seconds positive",
     122:"Cal. Start - quiescent",
 
-    101:"Cal. Known State (neg) Seek",
-    102:"Cal. Known State (neg) Initiation - spin-up",
-    103:"Cal. Looking for Known State (neg) Limit",
-    104:"Cal. Looking for Known State (neg) Limit - settling",
-    105:"Cal. Found Known State (neg) Limit",
+    101:"Seek Limit - current benchmark",
+    102:"Seek Limit - initiation, spin-up",
+    103:"Seek Limit - looking for the limit",
+    104:"Seek Limit - settling",
 
-    106:"Cal. Positive Benchmark",
-    107:"Cal. Positive Initiation - spin-up",
-    108:"Cal. Looking for Positive Limit",
-    109:"Cal. Looking for Positive Limit - settling",
+    105:"Cal. Found Known State (neg) Limit",
     110:"Cal. Found Positive Limit",
-
-    111:"Cal. Negative Benchmark",
-    112:"Cal. Negative Initiation - spin-up",
-    113:"Cal. Looking for Negative Limit",
-    114:"Cal. Looking for Negative Limit - settling",
     115:"Cal. Found Negative Limit",
 
+    130:"Verify - picking the nearer limit",
+    131:"Verify - seeking the nearer limit",
+    132:"Verify - at the limit",
+    133:"Verify - timing travel to the other limit",
+    134:"Verify - checking the travel time",
+
     200:"Move Low Limit Initiate",
     201:"Move Low Limit Current Wait",
     202:"Move Low Limit Current check",
@@ -45,12 +42,8 @@ const valveStateMachine = {
     233:"Move High Limit Done",
 
     210:"Move to Position Initiate (timed)",
-    211:"Move to Position - moving - 1",
-    212:"Move to Position - moving - 2",
-    213:"Move to Position - moving - 3",
-    214:"Move to Position - moving - 4",
-    215:"Move to Position - moving - 5",
-    216:"Move to Position - moving - 6",
+    211:"Move to Position - moving",
     217:"Move to Position Done",
+    218:"Move to Limit - current benchmark",
 };
 
@@ -32,6 +32,13 @@ module.exports = class {
 	);
     }
 
+    // speedCommand() - setSpeed() for Arduino.writeBatch()
+
+    speedCommand(speed)
+    {
+	return(Arduino.command(0x70 + ((speed & 0x03) << 2),this.pumpNum,[]));
+    }
+
     status()
     {
 	var command = 0x60 + this.pumpNum;
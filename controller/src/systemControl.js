@@ -4,6 +4,22 @@
 //   "System" control functions, like factory reset.
 //
 
+const SNAPSHOT_VERSION = 1;	// must match the Arduino (control.cpp)
+const STATS_VERSION = 2;
+
+// the tasks, in the order they are added in setup() (PoolControl.ino)
+
+const TASK_NAMES = ['analog','control','valve0','valve1','therm0','heater0','config','history'];
+
+// event kinds (see events.h)
+
+const EVENT_KINDS = ['unknown','valve','heater','pump','light'];
+
+// sensor filter channels (see control.cpp) - the device kind is the
+//   high nibble and which one is the low nibble
+
+const FILTER_KINDS = {valve:0x00, therm:0x10};
+
 module.exports = class {
 
     floopy = "hello";
@@ -21,5 +37,286 @@ module.exports = class {
 		.catch(() => ({result:false}))
 	);
     }
+
+    //
+    // snapshot() - read the state of everything on the Arduino in one
+    //    transaction. The frame layout is described in control.cpp
+    //    (ControlPublish() - the snapshot is the start of the shadow
+    //    registers). Returns an object with arrays for each of the
+    //    device types, in the same form as their status() calls.
+    //
+    async snapshot()
+    {
+	var command = 0xe0;    // command 0b111 + read, register 0
+
+	return(
+	    Arduino.readBytes(command,32)
+		.then((data) => {
+		    if(data[0] != SNAPSHOT_VERSION) {
+			throw new Error(`snapshot version ${data[0]} unknown`);
+		    }
+
+		    var ptr = 6;
+		    var result = {valves:[],therms:[],heaters:[],pumps:[],lights:[]};
+
+		    for(var i=0; i < data[1]; i++, ptr += 4) {
+			result.valves.push({state:data[ptr],prev:data[ptr+1],
+					    position:(data[ptr+2]<<8)+data[ptr+3]});
+		    }
+		    for(var i=0; i < data[2]; i++, ptr += 2) {
+			result.therms.push({temp:(data[ptr]<<8)+data[ptr+1]});
+		    }
+		    for(var i=0; i < data[3]; i++, ptr += 4) {
+			result.heaters.push({enabled:data[ptr],active:data[ptr+1],
+					     setPoint:(data[ptr+2]<<8)|data[ptr+3]});
+		    }
+		    for(var i=0; i < data[4]; i++, ptr++) {
+			result.pumps.push({status:data[ptr]});
+		    }
+		    for(var i=0; i < data[5]; i++, ptr++) {
+			result.lights.push({status:data[ptr]});
+		    }
+		    return(result);
+		})
+	);
+    }
+
+    //
+    // loopStats() - read the main loop timing from the Arduino. Counts
+    //    and totals wrap, so compare two readings to get an average.
+    //    All times are in microseconds. stackFree is the stack the
+    //    Arduino has never used since it booted (bytes).
+    //
+    async loopStats()
+    {
+	var command = 0xe1;    // command 0b111 + read, register 1
+
+	return(
+	    Arduino.readBytes(command,31)
+		.then((data) => {
+		    if(data[0] != STATS_VERSION) {
+			throw new Error(`stats version ${data[0]} unknown`);
+		    }
+		    return({passes:data.readUInt32BE(1),
+			    total:data.readUInt32BE(5),
+			    shortest:data.readUInt16BE(9),
+			    longest:data.readUInt16BE(11),
+			    histogram:{under128:data.readUInt32BE(13),
+				       under512:data.readUInt32BE(17),
+				       under2048:data.readUInt32BE(21),
+				       over2048:data.readUInt32BE(25)},
+			    stackFree:data.readUInt16BE(29)});
+		})
+	);
+    }
+
+    //
+    // taskStats() - read the cumulative time, worst-case time, and
+    //    late runs for each of the Arduino's tasks (microseconds).
+    //    Cumulative time and late runs wrap.
+    //
+    async taskStats()
+    {
+	var totals = 0xe2;    // command 0b111 + read, register 2
+	var worst = 0xe4;     //   and register 4
+
+	return(
+	    Arduino.readBytes(totals,32)
+		.then((data) => {
+		    var result = {};
+		    for(var i=0; i < data[0]; i++) {
+			var name = TASK_NAMES[i] || `task${i}`;
+			result[name] = {total:data.readUInt32BE(1+i*4)};
+		    }
+		    return(result);
+		})
+		.then((result) =>
+		      Arduino.readBytes(worst,32)
+		      .then((data) => {
+			  for(var i=0; i < data[0]; i++) {
+			      var name = TASK_NAMES[i] || `task${i}`;
+			      if(result[name]) {
+				  result[name].worst = data.readUInt16BE(1+i*4);
+				  result[name].late = data.readUInt16BE(3+i*4);
+			      }
+			  }
+			  return(result);
+		      }))
+	);
+    }
+
+    //
+    // queueStats() - read the Arduino's command queue statistics. The
+    //    depths are bytes of its 64-byte queue (a write takes 3 plus its
+    //    data). Any "overflows" mean that writes were thrown away.
+    //
+    async queueStats()
+    {
+	var command = 0xe3;    // command 0b111 + read, register 3
+
+	return(
+	    Arduino.readBytes(command,10)
+		.then((data) => ({depth:data[0],
+				  maxDepth:data[1],
+				  commands:data.readUInt32BE(2),
+				  overflows:data.readUInt32BE(6)}))
+	);
+    }
+
+    //
+    // events() - read the events that the Arduino has logged since the
+    //    last read (see ControlEvents() in control.cpp). If "after" is
+    //    given, reading starts with the event after that sequence number
+    //    instead - use it to re-read after a lost read. "more" is true
+    //    if there are events left for the next read. Ages are in ms.
+    //
+    async events(after)
+    {
+	var command = 0xe5;    // command 0b111 + read, register 5
+	var seek = (after === undefined)?Promise.resolve():
+	    Arduino.writeBytes(command,1,[after & 0xff]);
+
+	return(
+	    seek.then(() => Arduino.readBytes(command,32))
+		.then((data) => {
+		    var result = {newest:data[0],now:data.readUInt32BE(2),events:[]};
+		    var ptr = 6;
+
+		    for(var i=0; i < data[1]; i++, ptr += 6) {
+			result.events.push({seq:data[ptr],
+					    kind:EVENT_KINDS[data[ptr+1] >> 4] || 'unknown',
+					    device:data[ptr+1] & 0x0f,
+					    value:data.readInt16BE(ptr+2),
+					    age:data.readUInt16BE(ptr+4)});
+		    }
+		    result.more = (data[1] > 0 && result.events[data[1]-1].seq != data[0]);
+		    return(result);
+		})
+	);
+    }
+
+    //
+    // filter() - read the settings of the sensor filter of the given
+    //    kind ('valve' or 'therm') and device number (see filter.h and
+    //    ControlFilter() in control.cpp). Period is in micros.
+    //
+    async filter(kind,device)
+    {
+	var command = 0xe6;    // command 0b111 + read, register 6
+	var channel = FILTER_KINDS[kind] | (device & 0x0f);
+
+	return(
+	    Arduino.writeBytes(command,1,[channel])
+		.then(() => Arduino.readBytes(command,8))
+		.then((data) => ((data[0] == 0xff)?{result:false}:
+				 {kind:kind,
+				  device:device,
+				  oversample:data[1],
+				  median:data[2],
+				  average:data[3],
+				  period:data.readUInt32BE(4)}))
+	);
+    }
+
+    //
+    // filterSet() - change the settings of a sensor filter. The Arduino
+    //    brings them into range, so read them back with filter() to see
+    //    what it used. They are not saved - a reset puts the defaults back.
+    //
+    async filterSet(kind,device,oversample,median,average,period)
+    {
+	var command = 0xf2;    // command 0b111 + write, register 2
+	var channel = FILTER_KINDS[kind] | (device & 0x0f);
+	var data = [channel,oversample,median,average,
+		    (period >> 24) & 0xff,(period >> 16) & 0xff,(period >> 8) & 0xff,period & 0xff];
+
+	return(
+	    Arduino.writeBytes(command,data.length,data)
+		.then(() => ({result:true}))
+		.catch(() => ({result:false}))
+	);
+    }
+
+    //
+    // history() - read the per-minute temperature history kept on the
+    //    Arduino (see history.cpp), starting with entry "from" - or the
+    //    oldest one it has if that is left out (or too old). It comes in
+    //    chunks, which are read until the newest entry. Returns the
+    //    entries with their time (ms, the controller's clock) and temp
+    //    (tenths of degrees). The next read can start from "next".
+    //
+    async history(from)
+    {
+	var command = 0xe7;    // command 0b111 + read, register 7
+	var start = (from === undefined)?0xffff:from;    // 0xffff is the oldest
+	var result = {entries:[]};
+	var received = Date.now();
+
+	var empty = 0;
+
+	var chunk = () => Arduino.readBytes(command,32)
+	    .then((data) => {
+		var newest = data.readUInt16BE(0);
+		var age = data.readUInt16BE(2);
+		var first = data.readUInt16BE(4);
+		var count = data[6];
+		var value = data.readInt16BE(7);
+		var crumb = 0;
+		var next = () => (data[9 + (crumb >> 2)] >> ((crumb++ & 3) * 2)) & 0x03;
+
+		for(var i=0; i < count; i++) {
+		    if(i > 0) {
+			var c = next();
+			if(c == 3) {    // a bigger difference - a varint of nibbles
+			    var zigzag = 0;
+			    var shift = 0;
+			    var n;
+			    do {
+				n = next();
+				n |= next() << 2;
+				zigzag |= (n & 0x07) << shift;
+				shift += 3;
+			    } while(n & 0x08);
+			    value += (zigzag & 1)?-(zigzag >> 1) - 1:(zigzag >> 1);
+			} else {
+			    value += (c == 2)?-1:c;
+			}
+		    }
+		    var seq = (first + i) & 0xffff;
+		    result.entries.push({seq:seq,
+					 time:received - age * 1000 - ((newest - seq) & 0xffff) * 60000,
+					 temp:value});
+		}
+		result.next = (count > 0)?(first + count) & 0xffff:first;
+
+		// an empty chunk that isn't the end caught the Arduino's EEPROM
+		//   being written - it is read again, a couple of times at most
+
+		if(result.next == ((newest + 1) & 0xffff) || (count == 0 && ++empty > 2)) {
+		    return(result);
+		}
+		if(count > 0) {
+		    empty = 0;
+		}
+		return(chunk());
+	    });
+
+	return(
+	    Arduino.writeBytes(command,2,[(start >> 8) & 0xff,start & 0xff])
+		.then(chunk)
+	);
+    }
+
+    //
+    // resetStats() - clear the loop, task, and queue statistics
+    //
+    async resetStats()
+    {
+	var command = 0xf1;    // command 0b111 + write, register 1
+	return(
+	    Arduino.writeByte(command,0)
+		.then(() => ({result:true}))
+		.catch(() => ({result:false}))
+	);
+    }
 }
-	    
@@ -8,15 +8,13 @@ module.exports = class {
 
     constructor(num)
     {
-	this.thermNum = num & 0x03;
+	this.thermNum = num;
     }
 
     read()
     {
-	var command = 0x80 | this.thermNum;
-
 	return(
-	    Arduino.readBytes(command,2)
+	    Arduino.readDevice(0x80,this.thermNum,2)
 		.then((data) => {
 //		    console.log("therm",data);
 		    return({temp:(data[0]<<8)+data[1]});
@@ -31,8 +29,6 @@ module.exports = class {
     //
     config(params)
     {
-	var command = 0b10010000 | this.heaterNum;
-
 	var sendArray =  [
 	    params.tA, params.tB, params.tC,
 	    params.rA >> 8, params.rA&0xff,
@@ -41,7 +37,7 @@ module.exports = class {
 	];
 
 	return(
-	    Arduino.writeBytes(command,sendArray.length,sendArray)
+	    Arduino.writeDevice(0b10010000,this.thermNum,sendArray)
 		.then(() => ({status:1}))
 		.catch(() => ({status:0}))
 	);
@@ -28,6 +28,8 @@ app.use(express.static(path.join(__dirname,'public')));
 //
 //   VALVES
 //      .../[#]/calibrate
+//      .../[#]/verify
+//      .../[#]/dwell
 //      .../[#]/status
 
 // sub-routers are here
@@ -47,6 +49,100 @@ systemAPI.get('/factoryReset',(req,res) => {
 	    .then((json) => res.send(json));
 });
 
+//
+// /api/system/snapshot - the status of everything, in one Arduino read
+//
+systemAPI.get('/snapshot',(req,res) => {
+    SystemControl.snapshot()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+//
+// /api/system/loopStats, taskStats, queueStats, resetStats - Arduino timing
+//
+systemAPI.get('/loopStats',(req,res) => {
+    SystemControl.loopStats()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+systemAPI.get('/taskStats',(req,res) => {
+    SystemControl.taskStats()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+systemAPI.get('/queueStats',(req,res) => {
+    SystemControl.queueStats()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+//
+// /api/system/events[?after=N] - events logged on the Arduino since the
+//        last read (or after sequence N)
+//
+systemAPI.get('/events',(req,res) => {
+    var after = (req.query.after === undefined)?undefined:parseInt(req.query.after);
+    SystemControl.events(after)
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+//
+// /api/system/filter/:kind/:device - settings of a sensor filter (kind
+//        is valve or therm)
+// /api/system/filter/:kind/:device/set?oversample=&median=&average=&period=
+//        - change them (any that are left out stay as they are)
+//
+systemAPI.get('/filter/:kind/:device',(req,res) => {
+    SystemControl.filter(req.params.kind,parseInt(req.params.device))
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+systemAPI.get('/filter/:kind/:device/set',(req,res) => {
+    var kind = req.params.kind;
+    var device = parseInt(req.params.device);
+    var value = (name,now) => (req.query[name] === undefined)?now:parseInt(req.query[name]);
+
+    SystemControl.filter(kind,device)
+	    .then((now) => SystemControl.filterSet(kind,device,
+						   value('oversample',now.oversample),
+						   value('median',now.median),
+						   value('average',now.average),
+						   value('period',now.period)))
+	    .then(() => SystemControl.filter(kind,device))
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+//
+// /api/system/history[?from=N] - the per-minute temperature history on
+//        the Arduino (all of it, or from entry N)
+//
+systemAPI.get('/history',(req,res) => {
+    var from = (req.query.from === undefined)?undefined:parseInt(req.query.from);
+    SystemControl.history(from)
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json))
+	    .catch((e) => res.send(`ERROR - ${e.message}`));
+});
+
+systemAPI.get('/resetStats',(req,res) => {
+    SystemControl.resetStats()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json));
+});
+
 modeAPI.get('/set/:mode',(req,res) => {
     ModeControl.setMode(req.params.mode)
 	    .then((data) => { console.log(data); return(data); })
@@ -108,6 +204,33 @@ heaterAPI.get('/:heater/status', (req,res) => {
     }
 });
 
+heaterAPI.get('/:heater/control', (req,res) => {
+    if(req.params.heater >= Heaters.length) {
+	res.send(`ERROR - heater ${req.params.heater} unknown`);
+    } else {
+	Heaters[req.params.heater].control()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json));
+    }
+});
+
+// mode is hysteresis, pid, or tune - gains can be given as ?kp=&ki=&kd=
+
+heaterAPI.get('/:heater/mode/:mode', (req,res) => {
+    var gains;
+
+    if(req.query.kp !== undefined && req.query.ki !== undefined && req.query.kd !== undefined) {
+	gains = {kp:parseFloat(req.query.kp),ki:parseFloat(req.query.ki),kd:parseFloat(req.query.kd)};
+    }
+    if(req.params.heater >= Heaters.length) {
+	res.send(`ERROR - heater ${req.params.heater} unknown`);
+    } else {
+	Heaters[req.params.heater].mode(req.params.mode,gains)
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json));
+    }
+});
+
 heaterAPI.get('/:heater/enable/:enable', (req,res) => {
     if(req.params.heater >= Heaters.length) {
 	res.send(`ERROR - heater ${req.params.heater} unknown`);
@@ -166,6 +289,24 @@ valveAPI.get('/:valve/calibrate',(req,res) => {
     }
 });
 
+valveAPI.get('/:valve/verify',(req,res) => {
+    if(req.params.valve >= Valves.length) {
+	res.send(`ERROR - valve ${req.params.valve} unknown`);
+    } else {
+	res.send(Valves[req.params.valve].verify());
+    }
+});
+
+valveAPI.get('/:valve/dwell',(req,res) => {
+    if(req.params.valve >= Valves.length) {
+	res.send(`ERROR - valve ${req.params.valve} unknown`);
+    } else {
+	Valves[req.params.valve].dwell()
+	    .then((data) => JSON.stringify(data))
+	    .then((json) => res.send(json));
+    }
+});
+
 valveAPI.get('/:valve/status',(req,res) => {
     if(req.params.valve >= Valves.length) {
 	res.send(`ERROR - valve ${req.params.valve} unknown`);
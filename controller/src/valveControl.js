@@ -29,28 +29,42 @@ module.exports = class {
     {
 	this.span = span;
 	this.dir = dir;
-	this.valveNum = num & 0x03;
+	this.valveNum = num;
     }
 
     calibrate()
     {
-	var command = 0x30 + this.valveNum;
-	
-	Arduino.writeByte(command,0);
+	Arduino.writeDevice(0x30,this.valveNum,[0]);
 	return('Calling calibrate() on ' + this.span + ' ' + this.dir);
     }
 
-    move(degrees)
+    //
+    // verify() - a quick check of the calibration - one timed run
+    //    from stop to stop. The Arduino only does the full calibration
+    //    if the travel time has drifted.
+    //
+    verify()
     {
-	var command = 0x50 + this.valveNum;
+	Arduino.writeDevice(0x34,this.valveNum,[0]);
+	return('Calling verify() on ' + this.span + ' ' + this.dir);
+    }
 
+    move(degrees)
+    {
 	var sendArray =  [degrees>>8,degrees&0xff];
 	return(
-	    Arduino.writeBytes(command,sendArray.length,sendArray)
+	    Arduino.writeDevice(0x50,this.valveNum,sendArray)
 		.then(() => ({status:'ok'}))
 	);
     }
 
+    // moveCommand() - move() for Arduino.writeBatch()
+
+    moveCommand(degrees)
+    {
+	return(Arduino.command(0x50,this.valveNum,[degrees>>8,degrees&0xff]));
+    }
+
     //
     // secondCheck() - this routine is used when waiting for a valve
     //     to get back to quiescent. It returns a Promise, that
@@ -97,21 +111,28 @@ module.exports = class {
     wait()
     {
 	return(
-	    // first, get the rotational speed to plan for timeout
-	    this.travelTimes()
-		.then((times) => (times.pos + times.neg)/10)
+	    // first, get the rotational speed to plan for timeout - and
+	    //   the status, since it may well be done already
+
+	    Arduino.gather([{register:0x04,device:this.valveNum,length:4},
+			    {register:0x00,device:this.valveNum,length:4}])
+		.then(([times,status]) => {
+		    if(status[0] == VALVE_INACTIVE) {
+			return(true);
+		    }
 
-	    // now we set-up to wait, while checking every second - noting
-	    //   that this routine can throw an error
-		.then((maxWaitSecs) => this.secondCheck(maxWaitSecs))
+		    // now we set-up to wait, while checking every second - noting
+		    //   that this routine can throw an error
+
+		    return(this.secondCheck((((times[0]<<8)+times[1]) + ((times[2]<<8)+times[3]))/10));
+		})
 	);
     }
 
     status()
     {
-	var register = this.valveNum;
 	return(
-	    Arduino.readBytes(register,4)
+	    Arduino.readDevice(0x00,this.valveNum,4)
 		.then((data) => {
 		    return({state:data[0],prev:data[1],position:(data[2]<<8)+data[3]});
 		})
@@ -120,33 +141,46 @@ module.exports = class {
 
     degrees()
     {
-	var minRegister = 0x08 | this.valveNum;
-	var maxRegister = 0x0c | this.valveNum;
 	return(
-	    Arduino.readBytes(minRegister,2)
-		.then((data) => {
-		    var min = (data[0]<<8)+data[1];
-		    return(
-			Arduino.readBytes(maxRegister,2)
-			    .then((data) => {
-				var max = (data[0]<<8)+data[1];
-				return({min,max});
-			    })
-		    );
-		})
+	    Arduino.gather([{register:0x08,device:this.valveNum,length:2},
+			    {register:0x0c,device:this.valveNum,length:2}])
+		.then(([min,max]) => ({min:(min[0]<<8)+min[1],max:(max[0]<<8)+max[1]}))
 	);
     }
 
     travelTimes()
     {
-	var register = 0x04 | this.valveNum;
 	return(
-	    Arduino.readBytes(register,4)
+	    Arduino.readDevice(0x04,this.valveNum,4)
 		.then((data) => {
 //		    console.log("travel",data);
 		    return({pos:(data[0]<<8)+data[1],neg:(data[2]<<8)+data[3]});
 		})
 	);
     }
+
+    //
+    // dwell() - how long (ms) the valve spent in each state the last
+    //    time it was there, by state code (see codes.js). The Arduino
+    //    hands them out a page (10 states) at a time. There are none
+    //    unless its sketch was built with VALVE_PROFILE (the "dwell"
+    //    feature in its discovery register).
+    //
+    dwell(page = 0, times = {})
+    {
+	return(
+	    Arduino.readDevice(0x20 | (page << 2),this.valveNum,30)
+		.then((data) => {
+		    var i;
+		    for(i=0; i + 2 < data.length && data[i] != 0 && data[i] != 0xff; i += 3) {
+			times[data[i]] = (data[i+1]<<8)+data[i+2];
+		    }
+		    if(i < 30 || page == 3) {
+			return(times);
+		    }
+		    return(this.dwell(page+1,times));
+		})
+	);
+    }
 	
 }